@@ -3,13 +3,29 @@
 #include <SFML/System.hpp>
 #include <SFML/Window.hpp>
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <queue>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EDGE_KERNELS_X86
+#endif
 using namespace std;
 using namespace sf;
 
@@ -21,21 +37,41 @@ struct Route {
   int cost;
   string company;
   int travelTime;
+  int destIdx = -1;
+  int companyId = -1;
+  int depStamp = 0;
+  int arrStamp = 0;
+  int edgeId = -1;
 };
 
 struct Port {
   string name;
   int cost;
   vector<string> weatherConditions;
+  unsigned weatherMask;
+  int minConnectionTime;
+  bool hasCoordinates = false;
+  float latitude = 0, longitude = 0;
   Port(string n, int c) {
     name = n;
     cost = c;
     weatherConditions = {};
+    weatherMask = 0;
+    minConnectionTime = 0;
+  }
+
+  void setCoordinates(float lat, float lon) {
+    if (lat < -90 || lat > 90 || lon < -180 || lon > 180) return;
+    latitude = lat;
+    longitude = lon;
+    hasCoordinates = true;
   }
   Port(string n, int c, vector<string> weather) {
     name = n;
     cost = c;
     weatherConditions = weather;
+    weatherMask = 0;
+    minConnectionTime = 0;
   }
 };
 struct CompleteRoute {
@@ -44,18 +80,24 @@ struct CompleteRoute {
   int totalCost;
   int totalTime;
   int layoverCount;
+  int weightedCost = 0;
+  int totalDuration = 0;
 };
+// Booked itineraries never change, so every stage holding one shares the
+// same copy through a handle instead of duplicating its legs.
+typedef shared_ptr<const CompleteRoute> ItineraryHandle;
 struct BookedRoute {
   string bookingID;
-  CompleteRoute route;
+  ItineraryHandle route;
   string originPort;
   string destPort;
   string bookingDate;
   string customerName;
+  int volume = 0;
 
-  BookedRoute(const CompleteRoute& r, const string& from, const string& to,
+  BookedRoute(ItineraryHandle r, const string& from, const string& to,
               const string& date, const string& customer = "Guest")
-      : route(r),
+      : route(move(r)),
         originPort(from),
         destPort(to),
         bookingDate(date),
@@ -66,7 +108,7 @@ struct BookedRoute {
 };
 struct Ship {
   string shipID;
-  CompleteRoute route;
+  ItineraryHandle route;
   string originPort;
   string destPort;
   int currentLegIndex;
@@ -78,10 +120,10 @@ struct Ship {
   float dockingTimeRemaining;
   Color shipColor;
 
-  Ship(const string& id, const CompleteRoute& r, const string& from,
+  Ship(const string& id, ItineraryHandle r, const string& from,
        const string& to)
       : shipID(id),
-        route(r),
+        route(move(r)),
         originPort(from),
         destPort(to),
         currentLegIndex(0),
@@ -99,15 +141,53 @@ struct ShortestRouteResult {
   vector<int> parent;
   int srcIdx;
   bool found;
+  vector<Route> parentLeg;
 };
 
 struct UserPreferences {
   vector<string> preferredCompanies;
   vector<string> avoidPorts;
+  int maxVoyageTime = 999999;
+  bool hasCompanyFilter = false;
+  bool hasPortFilter = false;
+  bool hasTimeFilter = false;
+  vector<string> avoidWeather;
+  vector<pair<string, float>> weatherPenalties;
+  bool hasWeatherFilter = false;
+
+  bool filtersActive() const {
+    return hasCompanyFilter || hasPortFilter || hasTimeFilter ||
+           hasWeatherFilter;
+  }
+};
+
+struct SearchConstraints {
+  vector<char> portAllowed;
+  vector<char> companyAllowed;
+  vector<float> portPenalty;
   int maxVoyageTime;
   bool hasCompanyFilter;
-  bool hasPortFilter;
   bool hasTimeFilter;
+  bool hasWeatherPenalty;
+
+  bool allowsPort(int idx) const {
+    return idx >= 0 && idx < (int)portAllowed.size() && portAllowed[idx];
+  }
+
+  bool allowsLeg(const Route& route) const {
+    if (!allowsPort(route.destIdx)) return false;
+    if (hasCompanyFilter &&
+        (route.companyId < 0 || route.companyId >= (int)companyAllowed.size() ||
+         !companyAllowed[route.companyId]))
+      return false;
+    if (hasTimeFilter && route.travelTime > maxVoyageTime) return false;
+    return true;
+  }
+
+  int weighLeg(int legCost, int destIdx) const {
+    if (!hasWeatherPenalty) return legCost;
+    return (int)lround(legCost * portPenalty[destIdx]);
+  }
 };
 
 struct FilteredGraphData {
@@ -120,6 +200,20 @@ struct JourneyLeg {
   Route route;
   bool isValid;
 };
+struct GraphChange {
+  enum ChangeType { PORT_ADDED, ROUTE_ADDED, ROUTE_REMOVED };
+  ChangeType type;
+  int srcIdx;
+  int destIdx;
+  Route route;
+};
+struct CargoDemand {
+  int originIdx;
+  int destIdx;
+  int volume;
+  string readyDate;
+  string customerName;
+};
 struct PortDockingQueue {
   string portName;
   int portIndex;
@@ -188,32 +282,538 @@ struct PortDockingQueue {
 const int INF = 1e9;
 const int MAX_LAYOVERS = 3;
 
+struct SearchOptions {
+  enum Strategy { AUTO, EXHAUSTIVE, PARETO };
+  int maxLayovers = MAX_LAYOVERS;
+  Strategy strategy = AUTO;
+  double branchingLimit = 20000;
+  const SearchConstraints* constraints = nullptr;
+};
+
+// Bulk predicates and reductions over int columns. Masks hold one bit per
+// edge; predicates AND their result into the mask. Each instruction set
+// processes whole 64-edge words and leaves the tail to the scalar loop.
+struct EdgeKernels {
+  const char* name;
+  void (*maskLessEqual)(const int* values, size_t count, int limit,
+                        uint64_t* mask);
+  void (*maskEquals)(const int* values, size_t count, int key,
+                     uint64_t* mask);
+  void (*maskBitsetIn)(const int* values, size_t count, uint64_t allowed,
+                       uint64_t* mask);
+  void (*reduceMasked)(const int* values, size_t count, const uint64_t* mask,
+                       int& minValue, int& maxValue, long long& sum);
+};
+
+void maskLessEqualScalar(const int* values, size_t count, int limit,
+                         uint64_t* mask) {
+  for (size_t base = 0; base < count; base += 64) {
+    int n = min<size_t>(64, count - base);
+    uint64_t bits = 0;
+    for (int j = 0; j < n; j++) {
+      bits |= uint64_t(values[base + j] <= limit) << j;
+    }
+    mask[base / 64] &= bits;
+  }
+}
+
+void maskEqualsScalar(const int* values, size_t count, int key,
+                      uint64_t* mask) {
+  for (size_t base = 0; base < count; base += 64) {
+    int n = min<size_t>(64, count - base);
+    uint64_t bits = 0;
+    for (int j = 0; j < n; j++) {
+      bits |= uint64_t(values[base + j] == key) << j;
+    }
+    mask[base / 64] &= bits;
+  }
+}
+
+void maskBitsetInScalar(const int* values, size_t count, uint64_t allowed,
+                        uint64_t* mask) {
+  for (size_t base = 0; base < count; base += 64) {
+    int n = min<size_t>(64, count - base);
+    uint64_t bits = 0;
+    for (int j = 0; j < n; j++) {
+      unsigned id = values[base + j];
+      bits |= (uint64_t(id < 64) & (allowed >> (id & 63))) << j;
+    }
+    mask[base / 64] &= bits;
+  }
+}
+
+void reduceMaskedScalar(const int* values, size_t count, const uint64_t* mask,
+                        int& minValue, int& maxValue, long long& sum) {
+  for (size_t w = 0; w * 64 < count; w++) {
+    uint64_t remaining = mask[w];
+    while (remaining) {
+      int value = values[w * 64 + __builtin_ctzll(remaining)];
+      remaining &= remaining - 1;
+      minValue = min(minValue, value);
+      maxValue = max(maxValue, value);
+      sum += value;
+    }
+  }
+}
+
+#ifdef EDGE_KERNELS_X86
+__attribute__((target("sse4.1"))) void maskLessEqualSse4(const int* values,
+                                                          size_t count,
+                                                          int limit,
+                                                          uint64_t* mask) {
+  size_t fullWords = count / 64;
+  __m128i vlimit = _mm_set1_epi32(limit);
+  for (size_t w = 0; w < fullWords; w++) {
+    const int* v = values + w * 64;
+    uint64_t over = 0;
+    for (int j = 0; j < 64; j += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(v + j));
+      __m128i gt = _mm_cmpgt_epi32(x, vlimit);
+      over |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(gt))) << j;
+    }
+    mask[w] &= ~over;
+  }
+  maskLessEqualScalar(values + fullWords * 64, count - fullWords * 64, limit,
+                      mask + fullWords);
+}
+
+__attribute__((target("sse4.1"))) void maskEqualsSse4(const int* values,
+                                                       size_t count, int key,
+                                                       uint64_t* mask) {
+  size_t fullWords = count / 64;
+  __m128i vkey = _mm_set1_epi32(key);
+  for (size_t w = 0; w < fullWords; w++) {
+    if (!mask[w]) continue;
+    const int* v = values + w * 64;
+    uint64_t hits = 0;
+    for (int j = 0; j < 64; j += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(v + j));
+      __m128i eq = _mm_cmpeq_epi32(x, vkey);
+      hits |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(eq))) << j;
+    }
+    mask[w] &= hits;
+  }
+  maskEqualsScalar(values + fullWords * 64, count - fullWords * 64, key,
+                   mask + fullWords);
+}
+
+__attribute__((target("sse4.1"))) void reduceMaskedSse4(
+    const int* values, size_t count, const uint64_t* mask, int& minValue,
+    int& maxValue, long long& sum) {
+  size_t fullWords = count / 64;
+  const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+  __m128i vmin = _mm_set1_epi32(INT_MAX), vmax = _mm_set1_epi32(INT_MIN);
+  __m128i vsum = _mm_setzero_si128();
+  for (size_t w = 0; w < fullWords; w++) {
+    uint64_t word = mask[w];
+    for (int j = 0; word && j < 64; j += 4) {
+      int nibble = (word >> j) & 0xF;
+      if (!nibble) continue;
+      __m128i x = _mm_loadu_si128((const __m128i*)(values + w * 64 + j));
+      __m128i lanes = _mm_cmpeq_epi32(
+          _mm_and_si128(_mm_set1_epi32(nibble), laneBits), laneBits);
+      vmin = _mm_min_epi32(
+          vmin, _mm_blendv_epi8(_mm_set1_epi32(INT_MAX), x, lanes));
+      vmax = _mm_max_epi32(
+          vmax, _mm_blendv_epi8(_mm_set1_epi32(INT_MIN), x, lanes));
+      __m128i picked = _mm_and_si128(x, lanes);
+      vsum = _mm_add_epi64(vsum, _mm_cvtepi32_epi64(picked));
+      vsum = _mm_add_epi64(vsum,
+                           _mm_cvtepi32_epi64(_mm_srli_si128(picked, 8)));
+    }
+  }
+  int mins[4], maxs[4];
+  long long sums[2];
+  _mm_storeu_si128((__m128i*)mins, vmin);
+  _mm_storeu_si128((__m128i*)maxs, vmax);
+  _mm_storeu_si128((__m128i*)sums, vsum);
+  for (int i = 0; i < 4; i++) {
+    minValue = min(minValue, mins[i]);
+    maxValue = max(maxValue, maxs[i]);
+  }
+  sum += sums[0] + sums[1];
+  reduceMaskedScalar(values + fullWords * 64, count - fullWords * 64,
+                     mask + fullWords, minValue, maxValue, sum);
+}
+
+__attribute__((target("avx2"))) void maskLessEqualAvx2(const int* values,
+                                                        size_t count,
+                                                        int limit,
+                                                        uint64_t* mask) {
+  size_t fullWords = count / 64;
+  __m256i vlimit = _mm256_set1_epi32(limit);
+  for (size_t w = 0; w < fullWords; w++) {
+    const int* v = values + w * 64;
+    uint64_t over = 0;
+    for (int j = 0; j < 64; j += 8) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(v + j));
+      __m256i gt = _mm256_cmpgt_epi32(x, vlimit);
+      over |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(gt))) << j;
+    }
+    mask[w] &= ~over;
+  }
+  maskLessEqualScalar(values + fullWords * 64, count - fullWords * 64, limit,
+                      mask + fullWords);
+}
+
+__attribute__((target("avx2"))) void maskEqualsAvx2(const int* values,
+                                                     size_t count, int key,
+                                                     uint64_t* mask) {
+  size_t fullWords = count / 64;
+  __m256i vkey = _mm256_set1_epi32(key);
+  for (size_t w = 0; w < fullWords; w++) {
+    if (!mask[w]) continue;
+    const int* v = values + w * 64;
+    uint64_t hits = 0;
+    for (int j = 0; j < 64; j += 8) {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(v + j));
+      __m256i eq = _mm256_cmpeq_epi32(x, vkey);
+      hits |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(eq))) << j;
+    }
+    mask[w] &= hits;
+  }
+  maskEqualsScalar(values + fullWords * 64, count - fullWords * 64, key,
+                   mask + fullWords);
+}
+
+// Ids below 64 are tested against the allowed word with per-lane variable
+// shifts: the low half covers ids 0-31, the high half ids 32-63, and
+// out-of-range shift counts produce zero.
+__attribute__((target("avx2"))) void maskBitsetInAvx2(const int* values,
+                                                       size_t count,
+                                                       uint64_t allowed,
+                                                       uint64_t* mask) {
+  size_t fullWords = count / 64;
+  __m256i low = _mm256_set1_epi32((int)(allowed & 0xFFFFFFFFu));
+  __m256i high = _mm256_set1_epi32((int)(allowed >> 32));
+  __m256i one = _mm256_set1_epi32(1), thirtyTwo = _mm256_set1_epi32(32);
+  for (size_t w = 0; w < fullWords; w++) {
+    const int* v = values + w * 64;
+    uint64_t hits = 0;
+    for (int j = 0; j < 64; j += 8) {
+      __m256i id = _mm256_loadu_si256((const __m256i*)(v + j));
+      __m256i bit = _mm256_or_si256(
+          _mm256_srlv_epi32(low, id),
+          _mm256_srlv_epi32(high, _mm256_sub_epi32(id, thirtyTwo)));
+      __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(bit, one), one);
+      hits |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(set))) << j;
+    }
+    mask[w] &= hits;
+  }
+  maskBitsetInScalar(values + fullWords * 64, count - fullWords * 64, allowed,
+                     mask + fullWords);
+}
+
+__attribute__((target("avx2"))) void reduceMaskedAvx2(
+    const int* values, size_t count, const uint64_t* mask, int& minValue,
+    int& maxValue, long long& sum) {
+  size_t fullWords = count / 64;
+  const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256i intMax = _mm256_set1_epi32(INT_MAX);
+  const __m256i intMin = _mm256_set1_epi32(INT_MIN);
+  __m256i vmin = intMax, vmax = intMin, vsum = _mm256_setzero_si256();
+  for (size_t w = 0; w < fullWords; w++) {
+    uint64_t word = mask[w];
+    for (int j = 0; word && j < 64; j += 8) {
+      int byte = (word >> j) & 0xFF;
+      if (!byte) continue;
+      __m256i x = _mm256_loadu_si256((const __m256i*)(values + w * 64 + j));
+      __m256i lanes = _mm256_cmpeq_epi32(
+          _mm256_and_si256(_mm256_set1_epi32(byte), laneBits), laneBits);
+      vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(intMax, x, lanes));
+      vmax = _mm256_max_epi32(vmax, _mm256_blendv_epi8(intMin, x, lanes));
+      __m256i picked = _mm256_and_si256(x, lanes);
+      vsum = _mm256_add_epi64(
+          vsum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(picked)));
+      vsum = _mm256_add_epi64(
+          vsum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(picked, 1)));
+    }
+  }
+  int mins[8], maxs[8];
+  long long sums[4];
+  _mm256_storeu_si256((__m256i*)mins, vmin);
+  _mm256_storeu_si256((__m256i*)maxs, vmax);
+  _mm256_storeu_si256((__m256i*)sums, vsum);
+  for (int i = 0; i < 8; i++) {
+    minValue = min(minValue, mins[i]);
+    maxValue = max(maxValue, maxs[i]);
+  }
+  sum += sums[0] + sums[1] + sums[2] + sums[3];
+  reduceMaskedScalar(values + fullWords * 64, count - fullWords * 64,
+                     mask + fullWords, minValue, maxValue, sum);
+}
+#endif
+
+const EdgeKernels scalarEdgeKernels = {"scalar", maskLessEqualScalar,
+                                       maskEqualsScalar, maskBitsetInScalar,
+                                       reduceMaskedScalar};
+#ifdef EDGE_KERNELS_X86
+const EdgeKernels sse4EdgeKernels = {"sse4.1", maskLessEqualSse4,
+                                     maskEqualsSse4, maskBitsetInScalar,
+                                     reduceMaskedSse4};
+const EdgeKernels avx2EdgeKernels = {"avx2", maskLessEqualAvx2, maskEqualsAvx2,
+                                     maskBitsetInAvx2, reduceMaskedAvx2};
+#endif
+
+vector<const EdgeKernels*> availableEdgeKernels() {
+  vector<const EdgeKernels*> kernels = {&scalarEdgeKernels};
+#ifdef EDGE_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1")) kernels.push_back(&sse4EdgeKernels);
+  if (__builtin_cpu_supports("avx2")) kernels.push_back(&avx2EdgeKernels);
+#endif
+  return kernels;
+}
+
+const EdgeKernels* activeEdgeKernels = nullptr;
+
+const EdgeKernels& edgeKernels() {
+  if (!activeEdgeKernels) activeEdgeKernels = availableEdgeKernels().back();
+  return *activeEdgeKernels;
+}
+
+struct EdgeStats {
+  size_t count;
+  int minCost;
+  int maxCost;
+  long long sumCost;
+  int minTime;
+  int maxTime;
+  long long sumTime;
+
+  double avgCost() const { return count ? (double)sumCost / count : 0.0; }
+  double avgTime() const { return count ? (double)sumTime / count : 0.0; }
+};
+
+// Column-wise copy of every leg in the graph. Edge ids are append-only;
+// removed legs are cleared from the alive bitmask instead of compacted so
+// the ids stored in Route::edgeId stay valid. Predicates work on 64-edge
+// words and AND their result into an allowed-edge bitmask.
+struct EdgeTable {
+  vector<int> cost;
+  vector<int> travelTime;
+  vector<int> srcId;
+  vector<int> dstId;
+  vector<int> companyId;
+  vector<int> depStamp;
+  vector<int> arrStamp;
+  vector<uint64_t> alive;
+  size_t count = 0;
+
+  size_t words() const { return (count + 63) / 64; }
+
+  int add(int src, const Route& route) {
+    cost.push_back(route.cost);
+    travelTime.push_back(route.travelTime);
+    srcId.push_back(src);
+    dstId.push_back(route.destIdx);
+    companyId.push_back(route.companyId);
+    depStamp.push_back(route.depStamp);
+    arrStamp.push_back(route.arrStamp);
+    if (count % 64 == 0) alive.push_back(0);
+    alive[count / 64] |= uint64_t(1) << (count % 64);
+    return count++;
+  }
+
+  void remove(int id) {
+    if (id >= 0 && id < count) {
+      alive[id / 64] &= ~(uint64_t(1) << (id % 64));
+    }
+  }
+
+  static bool test(const vector<uint64_t>& mask, int id) {
+    return id >= 0 && id / 64 < mask.size() &&
+           ((mask[id / 64] >> (id % 64)) & 1);
+  }
+
+  static size_t countBits(const vector<uint64_t>& mask) {
+    size_t total = 0;
+    for (uint64_t word : mask) total += __builtin_popcountll(word);
+    return total;
+  }
+
+  void keepTravelTimeAtMost(int maxTime, vector<uint64_t>& mask) const {
+    edgeKernels().maskLessEqual(travelTime.data(), count, maxTime,
+                                mask.data());
+  }
+
+  // Up to 64 companies fit one word and use the dense kernel; otherwise
+  // only edges still set in the mask are looked up.
+  void keepCompanies(const vector<uint64_t>& companyBits,
+                     vector<uint64_t>& mask) const {
+    unsigned limit = companyBits.size() * 64;
+    if (limit == 64) {
+      edgeKernels().maskBitsetIn(companyId.data(), count, companyBits[0],
+                                 mask.data());
+      return;
+    }
+    for (size_t w = 0; w < mask.size(); w++) {
+      uint64_t remaining = mask[w];
+      while (remaining) {
+        int bit = __builtin_ctzll(remaining);
+        remaining &= remaining - 1;
+        unsigned id = companyId[w * 64 + bit];
+        if (id >= limit || !((companyBits[id / 64] >> (id % 64)) & 1)) {
+          mask[w] &= ~(uint64_t(1) << bit);
+        }
+      }
+    }
+  }
+
+  void keepPorts(const vector<char>& portAllowed,
+                 vector<uint64_t>& mask) const {
+    unsigned limit = portAllowed.size();
+    for (size_t w = 0; w < mask.size(); w++) {
+      uint64_t remaining = mask[w];
+      while (remaining) {
+        int bit = __builtin_ctzll(remaining);
+        remaining &= remaining - 1;
+        unsigned src = srcId[w * 64 + bit], dst = dstId[w * 64 + bit];
+        if (src >= limit || dst >= limit || !portAllowed[src] ||
+            !portAllowed[dst]) {
+          mask[w] &= ~(uint64_t(1) << bit);
+        }
+      }
+    }
+  }
+
+  vector<uint64_t> filter(const SearchConstraints& constraints) const {
+    vector<uint64_t> mask = alive;
+    if (constraints.hasTimeFilter) {
+      keepTravelTimeAtMost(constraints.maxVoyageTime, mask);
+    }
+    if (constraints.hasCompanyFilter) {
+      vector<uint64_t> companyBits(
+          (constraints.companyAllowed.size() + 63) / 64, 0);
+      for (size_t id = 0; id < constraints.companyAllowed.size(); id++) {
+        if (constraints.companyAllowed[id]) {
+          companyBits[id / 64] |= uint64_t(1) << (id % 64);
+        }
+      }
+      keepCompanies(companyBits, mask);
+    }
+    keepPorts(constraints.portAllowed, mask);
+    return mask;
+  }
+
+  EdgeStats stats(const vector<uint64_t>& mask) const {
+    EdgeStats result = {countBits(mask), INT_MAX, INT_MIN, 0,
+                        INT_MAX, INT_MIN, 0};
+    if (result.count == 0) return {0, 0, 0, 0, 0, 0, 0};
+    edgeKernels().reduceMasked(cost.data(), count, mask.data(), result.minCost,
+                               result.maxCost, result.sumCost);
+    edgeKernels().reduceMasked(travelTime.data(), count, mask.data(),
+                               result.minTime, result.maxTime, result.sumTime);
+    return result;
+  }
+
+  // Grouped stats scatter into per-group accumulators in one pass; a
+  // masked SIMD reduction per group only wins for a handful of groups.
+  vector<EdgeStats> statsByKey(const vector<int>& keys, int groupCount,
+                               const vector<uint64_t>& mask) const {
+    if (groupCount <= 4) {
+      vector<EdgeStats> groups;
+      vector<uint64_t> groupMask;
+      for (int key = 0; key < groupCount; key++) {
+        groupMask = mask;
+        edgeKernels().maskEquals(keys.data(), count, key, groupMask.data());
+        groups.push_back(stats(groupMask));
+      }
+      return groups;
+    }
+    vector<EdgeStats> groups(groupCount, {0, INT_MAX, INT_MIN, 0, INT_MAX,
+                                          INT_MIN, 0});
+    for (size_t w = 0; w < mask.size(); w++) {
+      uint64_t remaining = mask[w];
+      while (remaining) {
+        size_t i = w * 64 + __builtin_ctzll(remaining);
+        remaining &= remaining - 1;
+        unsigned key = keys[i];
+        if (key >= groupCount) continue;
+        EdgeStats& g = groups[key];
+        g.count++;
+        g.minCost = min(g.minCost, cost[i]);
+        g.maxCost = max(g.maxCost, cost[i]);
+        g.sumCost += cost[i];
+        g.minTime = min(g.minTime, travelTime[i]);
+        g.maxTime = max(g.maxTime, travelTime[i]);
+        g.sumTime += travelTime[i];
+      }
+    }
+    for (EdgeStats& g : groups) {
+      if (g.count == 0) g = {0, 0, 0, 0, 0, 0, 0};
+    }
+    return groups;
+  }
+};
+
+bool parseDate(const string& date, int& day, int& month, int& year) {
+  return sscanf(date.c_str(), "%d/%d/%d", &day, &month, &year) == 3;
+}
+
 int dateToInt(const string& date) {
-  int day = stoi(date.substr(0, 2));
-  int month = stoi(date.substr(3, 2));
-  int year = stoi(date.substr(6, 4));
+  int day = 0, month = 0, year = 0;
+  parseDate(date, day, month, year);
   return year * 10000 + month * 100 + day;
 }
 
 int timeToMinutes(const string& time) {
-  int hours = stoi(time.substr(0, 2));
-  int minutes = stoi(time.substr(3, 2));
+  int hours = 0, minutes = 0;
+  sscanf(time.c_str(), "%d:%d", &hours, &minutes);
   return hours * 60 + minutes;
 }
 
-bool isValidLegTransition(const Route& prevLeg, const Route& currentLeg) {
-  int prevArrivalDate = dateToInt(prevLeg.date);
-  int currentDepDate = dateToInt(currentLeg.date);
-  int prevArrivalTime = timeToMinutes(prevLeg.arrTime);
-  int currentDepTime = timeToMinutes(currentLeg.depTime);
+// Days since 1970-01-01 for a proleptic Gregorian date.
+int daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int yoe = year - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
 
-  if (currentDepDate > prevArrivalDate) {
-    return true;
-  } else if (currentDepDate == prevArrivalDate) {
-    return currentDepTime > prevArrivalTime;
-  } else {
-    return false;
-  }
+void civilFromDays(int days, int& year, int& month, int& day) {
+  days += 719468;
+  int era = (days >= 0 ? days : days - 146096) / 146097;
+  int doe = days - era * 146097;
+  int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp + (mp < 10 ? 3 : -9);
+  year = yoe + era * 400 + (month <= 2);
+}
+
+string daysToDate(int days) {
+  int year, month, day;
+  civilFromDays(days, year, month, day);
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d", day, month, year);
+  return buffer;
+}
+
+int toTimestamp(const string& date, const string& time) {
+  int day = 0, month = 0, year = 0;
+  if (!parseDate(date, day, month, year)) return 0;
+  return daysFromCivil(year, month, day) * 24 * 60 + timeToMinutes(time);
+}
+
+void decodeRouteTimes(Route& route) {
+  route.depStamp = toTimestamp(route.date, route.depTime);
+  route.arrStamp = route.depStamp + route.travelTime;
+}
+
+bool isValidLegTransition(const Route& prevLeg, const Route& currentLeg,
+                          int minConnection = 0) {
+  int gap = currentLeg.depStamp - prevLeg.arrStamp;
+  return gap > 0 && gap >= minConnection;
+}
+
+bool isSameRoute(const Route& a, const Route& b) {
+  return a.destination == b.destination && a.date == b.date &&
+         a.depTime == b.depTime && a.arrTime == b.arrTime &&
+         a.cost == b.cost && a.company == b.company;
 }
 
 bool isValidRoutePath(const vector<int>& path, const vector<Route>& routeLegs) {
@@ -228,14 +828,114 @@ bool isValidRoutePath(const vector<int>& path, const vector<Route>& routeLegs) {
   return true;
 }
 
+// An itinerary whose legs are a span of edge ids. The span lives in the
+// ItineraryArena that produced it and dies when that arena is reset.
+struct Itinerary {
+  const int* legs = nullptr;
+  int legCount = 0;
+  int originIdx = -1;
+  int totalCost = 0;
+  int totalTime = 0;
+  int layoverCount = 0;
+  int weightedCost = 0;
+  int totalDuration = 0;
+};
+
+// Result storage for one route query. Leg spans are carved out of a
+// monotonic buffer and all released at once by reset().
+class ItineraryArena {
+ public:
+  ItineraryArena() : pool(initialBlock, sizeof(initialBlock)) {}
+  ItineraryArena(const ItineraryArena&) = delete;
+  ItineraryArena& operator=(const ItineraryArena&) = delete;
+
+  const Itinerary& add(const Itinerary& scored, const vector<Route>& legs) {
+    int* span = static_cast<int*>(
+        pool.allocate(legs.size() * sizeof(int), alignof(int)));
+    for (size_t i = 0; i < legs.size(); i++) span[i] = legs[i].edgeId;
+    items.push_back(scored);
+    items.back().legs = span;
+    items.back().legCount = legs.size();
+    return items.back();
+  }
+
+  void reset() {
+    items.clear();
+    pool.release();
+  }
+
+  // Drops itineraries that repeat an earlier one's origin and leg ids, which
+  // also fixes the port path. Keeps first occurrences in order, in one pass.
+  size_t removeDuplicates() {
+    auto hash = [this](size_t i) {
+      const Itinerary& it = items[i];
+      uint64_t h = 1469598103934665603ull ^ uint32_t(it.originIdx);
+      for (int k = 0; k < it.legCount; k++) {
+        h = (h ^ uint32_t(it.legs[k])) * 1099511628211ull;
+      }
+      return size_t(h);
+    };
+    auto same = [this](size_t a, size_t b) {
+      const Itinerary& x = items[a];
+      const Itinerary& y = items[b];
+      return x.originIdx == y.originIdx && x.legCount == y.legCount &&
+             equal(x.legs, x.legs + x.legCount, y.legs);
+    };
+    unordered_set<size_t, decltype(hash), decltype(same)> seen(
+        items.size() * 2, hash, same);
+    size_t kept = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+      items[kept] = items[i];
+      if (seen.insert(kept).second) kept++;
+    }
+    size_t dropped = items.size() - kept;
+    items.resize(kept);
+    return dropped;
+  }
+
+  size_t size() const { return items.size(); }
+  bool empty() const { return items.empty(); }
+  const Itinerary& operator[](size_t i) const { return items[i]; }
+  vector<Itinerary>::const_iterator begin() const { return items.begin(); }
+  vector<Itinerary>::const_iterator end() const { return items.end(); }
+
+ private:
+  alignas(int) char initialBlock[4096];
+  pmr::monotonic_buffer_resource pool;
+  vector<Itinerary> items;
+};
+
 class Graph {
  public:
   vector<Port> ports;
   vector<vector<Route>> routes;
+  vector<GraphChange> changeLog;
+  vector<string> weatherNames;
+  vector<string> companyNames;
+  vector<vector<int>> departureOrder;
+  // Edge ids of the legs arriving at each port, kept in step with routes.
+  vector<vector<int>> incoming;
+  // Position of each edge id in routes[srcId], or -1 once removed.
+  vector<int> edgeSlot;
+  bool useDepartureIndex = true;
+  EdgeTable edgeTable;
 
   void addPort(const string& name, int cost) {
     ports.push_back(Port(name, cost));
     routes.push_back(vector<Route>());
+    departureOrder.push_back(vector<int>());
+    incoming.push_back(vector<int>());
+    int newIdx = ports.size() - 1;
+    for (vector<Route>& portRoutes : routes) {
+      for (Route& route : portRoutes) {
+        if (route.destIdx == -1 && route.destination == name) {
+          route.destIdx = newIdx;
+          edgeTable.dstId[route.edgeId] = newIdx;
+          incoming[newIdx].push_back(route.edgeId);
+        }
+      }
+    }
+    changeLog.push_back({GraphChange::PORT_ADDED, newIdx, -1, Route{}});
   }
 
   void addRoute(const string& src, const Route& route) {
@@ -246,7 +946,123 @@ class Graph {
       addPort(src, 0);
       srcIdx = ports.size() - 1;
     }
-    routes[srcIdx].push_back(route);
+    Route stored = route;
+    stored.destIdx = getPortIndex(route.destination);
+    stored.companyId = registerCompany(route.company);
+    decodeRouteTimes(stored);
+    stored.edgeId = edgeTable.add(srcIdx, stored);
+    routes[srcIdx].push_back(stored);
+    edgeSlot.push_back(routes[srcIdx].size() - 1);
+    if (stored.destIdx != -1) incoming[stored.destIdx].push_back(stored.edgeId);
+
+    const vector<Route>& legs = routes[srcIdx];
+    vector<int>& order = departureOrder[srcIdx];
+    auto pos = upper_bound(order.begin(), order.end(), stored.depStamp,
+                           [&](int stamp, int routeIdx) {
+                             return stamp < legs[routeIdx].depStamp;
+                           });
+    order.insert(pos, (int)legs.size() - 1);
+    changeLog.push_back(
+        {GraphChange::ROUTE_ADDED, srcIdx, stored.destIdx, stored});
+  }
+
+  bool removeRoute(int srcIdx, int routeIdx) {
+    if (srcIdx < 0 || srcIdx >= ports.size() || routeIdx < 0 ||
+        routeIdx >= routes[srcIdx].size()) {
+      return false;
+    }
+    Route removed = routes[srcIdx][routeIdx];
+    routes[srcIdx].erase(routes[srcIdx].begin() + routeIdx);
+    edgeTable.remove(removed.edgeId);
+    edgeSlot[removed.edgeId] = -1;
+    for (size_t i = routeIdx; i < routes[srcIdx].size(); i++) {
+      edgeSlot[routes[srcIdx][i].edgeId]--;
+    }
+    if (removed.destIdx != -1) {
+      vector<int>& in = incoming[removed.destIdx];
+      in.erase(find(in.begin(), in.end(), removed.edgeId));
+    }
+    vector<int>& order = departureOrder[srcIdx];
+    order.erase(remove(order.begin(), order.end(), routeIdx), order.end());
+    for (int& idx : order) {
+      if (idx > routeIdx) idx--;
+    }
+    changeLog.push_back({GraphChange::ROUTE_REMOVED, srcIdx,
+                         getPortIndex(removed.destination), removed});
+    return true;
+  }
+
+  size_t getChangeCount() const { return changeLog.size(); }
+
+  const Route* edgeRoute(int edgeId) const {
+    if (edgeId < 0 || edgeId >= edgeSlot.size() || edgeSlot[edgeId] == -1) {
+      return nullptr;
+    }
+    return &routes[edgeTable.srcId[edgeId]][edgeSlot[edgeId]];
+  }
+
+  // False once removeRoute has dropped any of the itinerary's legs; its
+  // edge ids then no longer resolve to routes or ports.
+  bool itineraryLive(const Itinerary& it) const {
+    for (int i = 0; i < it.legCount; i++) {
+      if (!edgeRoute(it.legs[i])) return false;
+    }
+    return true;
+  }
+
+  // Port at position i of an itinerary's path (0 is the origin).
+  int itineraryPort(const Itinerary& it, int i) const {
+    return i == 0 ? it.originIdx : edgeTable.dstId[it.legs[i - 1]];
+  }
+
+  CompleteRoute toCompleteRoute(const Itinerary& it) const {
+    CompleteRoute cr;
+    for (int i = 0; i <= it.legCount; i++) {
+      cr.portPath.push_back(itineraryPort(it, i));
+    }
+    for (int i = 0; i < it.legCount; i++) {
+      const Route* leg = edgeRoute(it.legs[i]);
+      cr.routeLegs.push_back(leg ? *leg : Route{});
+    }
+    cr.totalCost = it.totalCost;
+    cr.totalTime = it.totalTime;
+    cr.layoverCount = it.layoverCount;
+    cr.weightedCost = it.weightedCost;
+    cr.totalDuration = it.totalDuration;
+    return cr;
+  }
+
+  vector<CompleteRoute> toCompleteRoutes(const ItineraryArena& arena) const {
+    vector<CompleteRoute> out;
+    out.reserve(arena.size());
+    for (const Itinerary& it : arena) out.push_back(toCompleteRoute(it));
+    return out;
+  }
+
+  int incomingCount(int portIdx) const { return incoming[portIdx].size(); }
+
+  bool canConnect(const Route& prevLeg, const Route& nextLeg) const {
+    int minConnection = prevLeg.destIdx >= 0 && prevLeg.destIdx < ports.size()
+                            ? ports[prevLeg.destIdx].minConnectionTime
+                            : 0;
+    return isValidLegTransition(prevLeg, nextLeg, minConnection);
+  }
+
+  // Index into departureOrder[portIdx] of the first leg that can be taken
+  // after prevLeg, so searches skip legs that have already departed.
+  size_t firstConnection(int portIdx, const Route* prevLeg) const {
+    if (!useDepartureIndex || !prevLeg) return 0;
+    int minConnection = prevLeg->destIdx >= 0 && prevLeg->destIdx < ports.size()
+                            ? ports[prevLeg->destIdx].minConnectionTime
+                            : 0;
+    int earliest = prevLeg->arrStamp + max(1, minConnection);
+    const vector<Route>& legs = routes[portIdx];
+    const vector<int>& order = departureOrder[portIdx];
+    return lower_bound(order.begin(), order.end(), earliest,
+                       [&](int routeIdx, int stamp) {
+                         return legs[routeIdx].depStamp < stamp;
+                       }) -
+           order.begin();
   }
 
   int getPortIndex(const string& name) const {
@@ -257,6 +1073,48 @@ class Graph {
     }
     return -1;
   }
+
+  int getCompanyId(const string& company) const {
+    for (int i = 0; i < companyNames.size(); i++) {
+      if (companyNames[i] == company) return i;
+    }
+    return -1;
+  }
+
+  int registerCompany(const string& company) {
+    int id = getCompanyId(company);
+    if (id != -1) return id;
+    companyNames.push_back(company);
+    return companyNames.size() - 1;
+  }
+
+  int getWeatherId(const string& weather) const {
+    for (int i = 0; i < weatherNames.size(); i++) {
+      if (weatherNames[i] == weather) return i;
+    }
+    return -1;
+  }
+
+  int registerWeather(const string& weather) {
+    int id = getWeatherId(weather);
+    if (id != -1) return id;
+    if (weatherNames.size() >= 32) {
+      cout << "Too many weather conditions, ignoring: " << weather << endl;
+      return -1;
+    }
+    weatherNames.push_back(weather);
+    return weatherNames.size() - 1;
+  }
+
+  unsigned weatherMaskFor(const vector<string>& conditions) const {
+    unsigned mask = 0;
+    for (const string& weather : conditions) {
+      int id = getWeatherId(weather);
+      if (id != -1) mask |= 1u << id;
+    }
+    return mask;
+  }
+
   void parseWeatherData(const string& filename) {
     ifstream file(filename);
     if (!file) {
@@ -276,22 +1134,63 @@ class Graph {
         string weather;
         while (ss >> weather) {
           ports[portIdx].weatherConditions.push_back(weather);
+          int weatherId = registerWeather(weather);
+          if (weatherId != -1) ports[portIdx].weatherMask |= 1u << weatherId;
         }
       }
     }
     file.close();
   }
 
+  void parseConnectionTimes(const string& filename) {
+    ifstream file(filename);
+    if (!file) {
+      cout << "No connection time file, using zero minimum connection."
+           << endl;
+      return;
+    }
+    string name;
+    int minutes;
+    while (file >> name >> minutes) {
+      int portIdx = getPortIndex(name);
+      if (portIdx != -1 && minutes >= 0) {
+        ports[portIdx].minConnectionTime = minutes;
+      }
+    }
+    file.close();
+  }
+
   void parsePorts(const string& filename) {
     ifstream file(filename);
     if (!file) {
       cout << "Error opening port file!" << endl;
       return;
     }
-    string name;
-    int cost;
-    while (file >> name >> cost) {
+    // Each line is "Name cost", optionally followed by "latitude longitude".
+    string line;
+    while (getline(file, line)) {
+      stringstream ss(line);
+      string name;
+      int cost;
+      if (!(ss >> name >> cost)) continue;
       addPort(name, cost);
+      float lat, lon;
+      if (ss >> lat >> lon) ports.back().setCoordinates(lat, lon);
+    }
+    file.close();
+  }
+
+  void parsePortCoordinates(const string& filename) {
+    ifstream file(filename);
+    if (!file) {
+      cout << "No port coordinate file, using generated map layout." << endl;
+      return;
+    }
+    string name;
+    float lat, lon;
+    while (file >> name >> lat >> lon) {
+      int portIdx = getPortIndex(name);
+      if (portIdx != -1) ports[portIdx].setCoordinates(lat, lon);
     }
     file.close();
   }
@@ -363,8 +1262,52 @@ class Graph {
     }
   }
 
+  SearchConstraints compileConstraints(const UserPreferences& prefs) const {
+    SearchConstraints c;
+    int n = ports.size();
+    c.portAllowed.assign(n, 1);
+    c.companyAllowed.assign(companyNames.size(), 0);
+    c.portPenalty.assign(n, 1.0f);
+    c.maxVoyageTime = prefs.maxVoyageTime;
+    c.hasCompanyFilter = prefs.hasCompanyFilter;
+    c.hasTimeFilter = prefs.hasTimeFilter;
+    c.hasWeatherPenalty = false;
+
+    if (prefs.hasPortFilter) {
+      for (const string& avoidPort : prefs.avoidPorts) {
+        int idx = getPortIndex(avoidPort);
+        if (idx != -1) c.portAllowed[idx] = 0;
+      }
+    }
+    if (prefs.hasCompanyFilter) {
+      for (const string& company : prefs.preferredCompanies) {
+        int id = getCompanyId(company);
+        if (id != -1) c.companyAllowed[id] = 1;
+      }
+    }
+    if (prefs.hasWeatherFilter) {
+      unsigned bannedMask = weatherMaskFor(prefs.avoidWeather);
+      vector<float> multiplier(weatherNames.size(), 1.0f);
+      for (const auto& penalty : prefs.weatherPenalties) {
+        int id = getWeatherId(penalty.first);
+        if (id != -1 && penalty.second > 0) {
+          multiplier[id] = penalty.second;
+          c.hasWeatherPenalty = true;
+        }
+      }
+      for (int i = 0; i < n; i++) {
+        unsigned mask = ports[i].weatherMask;
+        if (mask & bannedMask) c.portAllowed[i] = 0;
+        for (int w = 0; w < multiplier.size(); w++) {
+          if (mask & (1u << w)) c.portPenalty[i] *= multiplier[w];
+        }
+      }
+    }
+    return c;
+  }
+
   ShortestRouteResult dijkstra(Port* src, bool findCheapest,
-                               const UserPreferences* prefs = nullptr) {
+                               const SearchConstraints* constraints = nullptr) {
     int n = ports.size();
     vector<int> dist(n, INF);
     vector<bool> visited(n, false);
@@ -374,13 +1317,12 @@ class Graph {
     int srcIdx = getPortIndex(src->name);
     if (srcIdx == -1) {
       cout << "Source port not found!" << endl;
-      return {dist, parent, -1, false};
+      return {dist, parent, -1, false, lastRoute};
     }
 
-    if (prefs && prefs->hasPortFilter &&
-        portIsAvoid(ports[srcIdx].name, *prefs)) {
-      cout << "Source port is in avoid list!" << endl;
-      return {dist, parent, -1, false};
+    if (constraints && !constraints->allowsPort(srcIdx)) {
+      cout << "Source port is excluded by the search filters!" << endl;
+      return {dist, parent, -1, false, lastRoute};
     }
 
     dist[srcIdx] = 0;
@@ -399,29 +1341,23 @@ class Graph {
       if (u == -1 || dist[u] == INF) break;
       visited[u] = true;
 
-      for (const Route& route : routes[u]) {
-        int v = getPortIndex(route.destination);
+      const Route* prev =
+          u != srcIdx && parent[u] != -1 ? &lastRoute[u] : nullptr;
+      const vector<int>& order = departureOrder[u];
+      for (size_t k = firstConnection(u, prev); k < order.size(); k++) {
+        const Route& route = routes[u][order[k]];
+        int v = route.destIdx;
         if (v == -1 || visited[v]) continue;
+        if (constraints && !constraints->allowsLeg(route)) continue;
+        if (prev && !canConnect(*prev, route)) continue;
 
-        if (prefs) {
-          if (prefs->hasPortFilter && portIsAvoid(ports[v].name, *prefs))
-            continue;
-          if (prefs->hasCompanyFilter &&
-              !routeHasPreferredCompany(route, *prefs))
-            continue;
-          if (prefs->hasTimeFilter && route.travelTime > prefs->maxVoyageTime)
-            continue;
-        }
-
-        bool validTiming = true;
-        if (u != srcIdx && parent[u] != -1) {
-          validTiming = isValidLegTransition(lastRoute[u], route);
-        }
-
-        if (!validTiming) continue;
-
-        int newDist = findCheapest ? dist[u] + route.cost + ports[v].cost
-                                   : dist[u] + route.travelTime;
+        // Time is door-to-door: past the source a leg also costs the wait
+        // for it at u.
+        int legCost = findCheapest ? route.cost + ports[v].cost
+                      : prev       ? route.arrStamp - prev->arrStamp
+                                   : route.travelTime;
+        if (constraints) legCost = constraints->weighLeg(legCost, v);
+        int newDist = dist[u] + legCost;
 
         if (newDist < dist[v]) {
           dist[v] = newDist;
@@ -431,22 +1367,82 @@ class Graph {
       }
     }
 
-    return {dist, parent, srcIdx, true};
+    return {dist, parent, srcIdx, true, lastRoute};
+  }
+
+  // The legs the search itself used to reach destIdx, in travel order.
+  vector<Route> pathLegs(const ShortestRouteResult& result,
+                         int destIdx) const {
+    vector<Route> legs;
+    if (!result.found || result.dist[destIdx] == INF) return legs;
+    for (int v = destIdx; v != result.srcIdx && result.parent[v] != -1;
+         v = result.parent[v]) {
+      legs.push_back(result.parentLeg[v]);
+    }
+    reverse(legs.begin(), legs.end());
+    return legs;
   }
 
   ShortestRouteResult findShortestRoute(
       Port* src, const UserPreferences* prefs = nullptr) {
-    return dijkstra(src, false, prefs);
+    if (!prefs) return dijkstra(src, false);
+    SearchConstraints constraints = compileConstraints(*prefs);
+    return dijkstra(src, false, &constraints);
+  }
+
+  ShortestRouteResult findShortestRoute(Port* src,
+                                        const SearchConstraints& constraints) {
+    return dijkstra(src, false, &constraints);
   }
 
   ShortestRouteResult findCheapestRoute(
       Port* src, const UserPreferences* prefs = nullptr) {
-    return dijkstra(src, true, prefs);
+    if (!prefs) return dijkstra(src, true);
+    SearchConstraints constraints = compileConstraints(*prefs);
+    return dijkstra(src, true, &constraints);
+  }
+
+  ShortestRouteResult findCheapestRoute(Port* src,
+                                        const SearchConstraints& constraints) {
+    return dijkstra(src, true, &constraints);
+  }
+
+  Itinerary scoreItinerary(const vector<int>& path, const vector<Route>& legs,
+                           const SearchConstraints* constraints) const {
+    Itinerary it;
+    it.originIdx = path.front();
+    for (size_t i = 0; i < legs.size(); i++) {
+      int legCost = legs[i].cost + ports[path[i + 1]].cost;
+      it.totalCost += legCost;
+      it.totalTime += legs[i].travelTime;
+      it.weightedCost +=
+          constraints ? constraints->weighLeg(legCost, path[i + 1]) : legCost;
+    }
+    it.totalDuration = legs.back().arrStamp - legs.front().depStamp;
+    it.layoverCount =
+        path.size() >= 2 ? static_cast<int>(path.size()) - 2 : 0;
+    return it;
+  }
+
+  CompleteRoute makeCompleteRoute(const vector<int>& path,
+                                  const vector<Route>& legs,
+                                  const SearchConstraints* constraints) const {
+    Itinerary it = scoreItinerary(path, legs, constraints);
+    CompleteRoute cr;
+    cr.portPath = path;
+    cr.routeLegs = legs;
+    cr.totalCost = it.totalCost;
+    cr.totalTime = it.totalTime;
+    cr.weightedCost = it.weightedCost;
+    cr.totalDuration = it.totalDuration;
+    cr.layoverCount = it.layoverCount;
+    return cr;
   }
 
   void dfsEnumerateRoutes(int currentIdx, int destIdx, vector<int>& currentPath,
                           vector<Route>& currentLegs,
-                          vector<CompleteRoute>& results, int maxLegs) {
+                          ItineraryArena& results, int maxLegs,
+                          const SearchConstraints* constraints = nullptr) {
     if (currentLegs.size() > static_cast<size_t>(maxLegs)) {
       return;
     }
@@ -456,24 +1452,8 @@ class Graph {
         return;
       }
 
-      CompleteRoute cr;
-      cr.portPath = currentPath;
-      cr.routeLegs = currentLegs;
-      cr.totalCost = 0;
-      cr.totalTime = 0;
-
-      for (const Route& leg : currentLegs) {
-        cr.totalCost += leg.cost;
-        cr.totalTime += leg.travelTime;
-      }
-      for (size_t i = 1; i < currentPath.size(); i++) {
-        cr.totalCost += ports[currentPath[i]].cost;
-      }
-      cr.layoverCount = currentPath.size() >= 2
-                            ? static_cast<int>(currentPath.size()) - 2
-                            : 0;
-
-      results.push_back(cr);
+      results.add(scoreItinerary(currentPath, currentLegs, constraints),
+                  currentLegs);
       return;
     }
 
@@ -481,38 +1461,35 @@ class Graph {
       return;
     }
 
-    for (const Route& route : routes[currentIdx]) {
-      int nextIdx = getPortIndex(route.destination);
+    bool hasPrev = !currentLegs.empty();
+    const vector<int>& order = departureOrder[currentIdx];
+    size_t start =
+        firstConnection(currentIdx, hasPrev ? &currentLegs.back() : nullptr);
+    for (size_t k = start; k < order.size(); k++) {
+      const Route& route = routes[currentIdx][order[k]];
+      int nextIdx = route.destIdx;
       if (nextIdx == -1) continue;
+      if (constraints && !constraints->allowsLeg(route)) continue;
+      if (hasPrev && !canConnect(currentLegs.back(), route)) continue;
 
       if (find(currentPath.begin(), currentPath.end(), nextIdx) !=
           currentPath.end()) {
         continue;
       }
 
-      bool validTiming = true;
-      if (!currentLegs.empty()) {
-        validTiming = isValidLegTransition(currentLegs.back(), route);
-      }
-
-      if (!validTiming) continue;
-
       currentPath.push_back(nextIdx);
       currentLegs.push_back(route);
       dfsEnumerateRoutes(nextIdx, destIdx, currentPath, currentLegs, results,
-                         maxLegs);
+                         maxLegs, constraints);
       currentLegs.pop_back();
       currentPath.pop_back();
     }
   }
   bool portHasWeather(const string& portName, const string& weather) const {
     int idx = getPortIndex(portName);
-    if (idx == -1) return false;
-
-    for (const string& w : ports[idx].weatherConditions) {
-      if (w == weather) return true;
-    }
-    return false;
+    int weatherId = getWeatherId(weather);
+    if (idx == -1 || weatherId == -1) return false;
+    return (ports[idx].weatherMask >> weatherId) & 1u;
   }
   vector<string> getAllWeatherConditions() const {
     set<string> conditions;
@@ -523,51 +1500,234 @@ class Graph {
     }
     return vector<string>(conditions.begin(), conditions.end());
   }
-  vector<CompleteRoute> findAllPossibleRoutes(int originIdx, int destIdx) {
-    vector<CompleteRoute> allRoutes;
+  void findAllPossibleRoutes(int originIdx, int destIdx,
+                             ItineraryArena& results,
+                             const SearchConstraints* constraints = nullptr,
+                             int maxLayovers = MAX_LAYOVERS) {
     if (originIdx < 0 || originIdx >= ports.size() || destIdx < 0 ||
         destIdx >= ports.size()) {
-      return allRoutes;
+      return;
     }
+    if (constraints && !constraints->allowsPort(originIdx)) return;
 
     vector<int> currentPath = {originIdx};
     vector<Route> currentLegs;
-    int maxLegs = MAX_LAYOVERS + 1;
-    dfsEnumerateRoutes(originIdx, destIdx, currentPath, currentLegs, allRoutes,
-                       maxLegs);
-
-    return allRoutes;
+    int maxLegs = maxLayovers + 1;
+    dfsEnumerateRoutes(originIdx, destIdx, currentPath, currentLegs, results,
+                       maxLegs, constraints);
   }
 
-  bool findCheapestEnumeratedRoute(int originIdx, int destIdx,
-                                   CompleteRoute& cheapestOut) {
-    vector<CompleteRoute> allRoutes = findAllPossibleRoutes(originIdx, destIdx);
+  vector<CompleteRoute> findAllPossibleRoutes(
+      int originIdx, int destIdx,
+      const SearchConstraints* constraints = nullptr,
+      int maxLayovers = MAX_LAYOVERS) {
+    ItineraryArena arena;
+    findAllPossibleRoutes(originIdx, destIdx, arena, constraints, maxLayovers);
+    return toCompleteRoutes(arena);
+  }
 
-    if (allRoutes.empty()) {
-      return false;
+  // Upper bound on the number of walks the DFS could explore, ignoring
+  // timing, used to decide whether exhaustive enumeration is affordable.
+  double estimateBranching(int originIdx, int maxLegs,
+                           const SearchConstraints* constraints) const {
+    int n = ports.size();
+    vector<double> walks(n, 0.0), next(n, 0.0);
+    walks[originIdx] = 1.0;
+    double total = 0.0;
+    for (int leg = 0; leg < maxLegs && total < 1e15; leg++) {
+      fill(next.begin(), next.end(), 0.0);
+      for (int u = 0; u < n; u++) {
+        if (walks[u] == 0.0) continue;
+        for (const Route& route : routes[u]) {
+          if (route.destIdx == -1) continue;
+          if (constraints && !constraints->allowsLeg(route)) continue;
+          next[route.destIdx] += walks[u];
+        }
+      }
+      for (int v = 0; v < n; v++) total += next[v];
+      walks.swap(next);
     }
+    return total;
+  }
 
-    auto cmp = [](const CompleteRoute& a, const CompleteRoute& b) {
-      if (a.totalCost == b.totalCost) {
-        return a.totalTime < b.totalTime;
-      }
-      return a.totalCost < b.totalCost;
+  SearchOptions::Strategy selectStrategy(int originIdx,
+                                         const SearchOptions& options) const {
+    if (options.strategy != SearchOptions::AUTO) return options.strategy;
+    double estimate = estimateBranching(originIdx, options.maxLayovers + 1,
+                                        options.constraints);
+    return estimate > options.branchingLimit ? SearchOptions::PARETO
+                                             : SearchOptions::EXHAUSTIVE;
+  }
+
+  // Label-setting search keeping, per port, only itineraries that are not
+  // dominated on arrival time, cost, leg count and first departure.
+  void paretoRouteSearch(int originIdx, int destIdx, int maxLegs,
+                         ItineraryArena& results,
+                         const SearchConstraints* constraints = nullptr) {
+    struct Label {
+      int port;
+      int arrStamp;
+      int firstDep;
+      int cost;
+      int legs;
+      int parent;
+      const Route* route;
+      bool dominated;
+    };
+    auto dominates = [](const Label& a, const Label& b) {
+      return a.arrStamp <= b.arrStamp && a.cost <= b.cost &&
+             a.legs <= b.legs && a.firstDep >= b.firstDep;
     };
 
-    auto bestIt = min_element(allRoutes.begin(), allRoutes.end(), cmp);
-    cheapestOut = *bestIt;
-    return true;
-  }
+    int n = ports.size();
+    if (originIdx < 0 || originIdx >= n || destIdx < 0 || destIdx >= n ||
+        originIdx == destIdx) {
+      return;
+    }
+    if (constraints && !constraints->allowsPort(originIdx)) return;
+
+    vector<Label> labels;
+    vector<vector<int>> alive(n);
+    priority_queue<pair<int, int>, vector<pair<int, int>>,
+                   greater<pair<int, int>>>
+        open;
+    labels.push_back({originIdx, -INF, INF, 0, 0, -1, nullptr, false});
+    open.push({-INF, 0});
+
+    while (!open.empty()) {
+      int id = open.top().second;
+      open.pop();
+      if (labels[id].dominated || labels[id].legs >= maxLegs) continue;
+      Label cur = labels[id];
+
+      const vector<int>& order = departureOrder[cur.port];
+      for (size_t k = firstConnection(cur.port, cur.route); k < order.size();
+           k++) {
+        const Route& route = routes[cur.port][order[k]];
+        int v = route.destIdx;
+        if (v == -1) continue;
+        if (constraints && !constraints->allowsLeg(route)) continue;
+        if (cur.route && !canConnect(*cur.route, route)) continue;
+
+        bool onPath = false;
+        for (int l = id; l != -1 && !onPath; l = labels[l].parent) {
+          onPath = labels[l].port == v;
+        }
+        if (onPath) continue;
+
+        int legCost = route.cost + ports[v].cost;
+        if (constraints) legCost = constraints->weighLeg(legCost, v);
+        Label next = {v,
+                      route.arrStamp,
+                      cur.route ? cur.firstDep : route.depStamp,
+                      cur.cost + legCost,
+                      cur.legs + 1,
+                      id,
+                      &route,
+                      false};
+
+        bool dominated = false;
+        for (int other : alive[v]) {
+          if (dominates(labels[other], next)) {
+            dominated = true;
+            break;
+          }
+        }
+        if (dominated) continue;
 
-  bool portIsAvoid(const string& portName, const UserPreferences& prefs) const {
-    if (!prefs.hasPortFilter) return false;
-    for (const string& avoidPort : prefs.avoidPorts) {
-      if (portName == avoidPort) return true;
+        vector<int> kept;
+        for (int other : alive[v]) {
+          if (dominates(next, labels[other])) {
+            labels[other].dominated = true;
+          } else {
+            kept.push_back(other);
+          }
+        }
+        int nextId = labels.size();
+        labels.push_back(next);
+        kept.push_back(nextId);
+        alive[v].swap(kept);
+        if (v != destIdx) open.push({next.arrStamp, nextId});
+      }
     }
-    return false;
-  }
 
-  bool routeHasPreferredCompany(const Route& route,
+    for (int id : alive[destIdx]) {
+      vector<int> path;
+      vector<Route> legs;
+      for (int l = id; l != -1; l = labels[l].parent) {
+        path.push_back(labels[l].port);
+        if (labels[l].route) legs.push_back(*labels[l].route);
+      }
+      reverse(path.begin(), path.end());
+      reverse(legs.begin(), legs.end());
+      results.add(scoreItinerary(path, legs, constraints), legs);
+    }
+  }
+
+  vector<CompleteRoute> paretoRouteSearch(
+      int originIdx, int destIdx, int maxLegs,
+      const SearchConstraints* constraints = nullptr) {
+    ItineraryArena arena;
+    paretoRouteSearch(originIdx, destIdx, maxLegs, arena, constraints);
+    return toCompleteRoutes(arena);
+  }
+
+  void searchRoutes(int originIdx, int destIdx, const SearchOptions& options,
+                    ItineraryArena& results) {
+    if (originIdx < 0 || originIdx >= ports.size() || destIdx < 0 ||
+        destIdx >= ports.size()) {
+      return;
+    }
+    int maxLayovers = max(0, options.maxLayovers);
+    if (selectStrategy(originIdx, options) == SearchOptions::PARETO) {
+      cout << "Using Pareto search for up to " << maxLayovers << " layovers"
+           << endl;
+      paretoRouteSearch(originIdx, destIdx, maxLayovers + 1, results,
+                        options.constraints);
+      return;
+    }
+    findAllPossibleRoutes(originIdx, destIdx, results, options.constraints,
+                          maxLayovers);
+  }
+
+  vector<CompleteRoute> searchRoutes(int originIdx, int destIdx,
+                                     const SearchOptions& options) {
+    ItineraryArena arena;
+    searchRoutes(originIdx, destIdx, options, arena);
+    return toCompleteRoutes(arena);
+  }
+
+  bool findCheapestEnumeratedRoute(
+      int originIdx, int destIdx, CompleteRoute& cheapestOut,
+      const SearchConstraints* constraints = nullptr) {
+    ItineraryArena allRoutes;
+    findAllPossibleRoutes(originIdx, destIdx, allRoutes, constraints);
+
+    if (allRoutes.empty()) {
+      return false;
+    }
+
+    auto cmp = [](const Itinerary& a, const Itinerary& b) {
+      if (a.weightedCost == b.weightedCost) {
+        return a.totalTime < b.totalTime;
+      }
+      return a.weightedCost < b.weightedCost;
+    };
+
+    auto bestIt = min_element(allRoutes.begin(), allRoutes.end(), cmp);
+    cheapestOut = toCompleteRoute(*bestIt);
+    return true;
+  }
+
+  bool portIsAvoid(const string& portName, const UserPreferences& prefs) const {
+    if (!prefs.hasPortFilter) return false;
+    for (const string& avoidPort : prefs.avoidPorts) {
+      if (portName == avoidPort) return true;
+    }
+    return false;
+  }
+
+  bool routeHasPreferredCompany(const Route& route,
                                 const UserPreferences& prefs) const {
     if (!prefs.hasCompanyFilter) return true;
     for (const string& company : prefs.preferredCompanies) {
@@ -584,21 +1744,40 @@ class Graph {
     return true;
   }
 
+  vector<uint64_t> allowedEdgeMask(const UserPreferences& prefs) const {
+    return edgeTable.filter(compileConstraints(prefs));
+  }
+
+  EdgeStats routeStats(const vector<uint64_t>& mask) const {
+    return edgeTable.stats(mask);
+  }
+
+  vector<EdgeStats> routeStatsByCompany(const vector<uint64_t>& mask) const {
+    return edgeTable.statsByKey(edgeTable.companyId, companyNames.size(),
+                                mask);
+  }
+
+  vector<EdgeStats> routeStatsByPort(const vector<uint64_t>& mask,
+                                     bool bySource = true) const {
+    return edgeTable.statsByKey(
+        bySource ? edgeTable.srcId : edgeTable.dstId, ports.size(), mask);
+  }
+
   FilteredGraphData applyFilters(const UserPreferences& prefs) const {
     FilteredGraphData result;
     result.filteredRoutes.resize(ports.size());
+    SearchConstraints constraints = compileConstraints(prefs);
+    vector<uint64_t> mask = edgeTable.filter(constraints);
 
     for (int i = 0; i < ports.size(); i++) {
-      if (!portIsAvoid(ports[i].name, prefs)) {
+      if (constraints.allowsPort(i)) {
         result.allowedPorts.push_back(i);
       }
     }
 
     for (int i = 0; i < routes.size(); i++) {
       for (const Route& route : routes[i]) {
-        if (!portIsAvoid(ports[i].name, prefs) &&
-            !portIsAvoid(route.destination, prefs) &&
-            routeMatchesPreferences(route, prefs)) {
+        if (EdgeTable::test(mask, route.edgeId)) {
           result.filteredRoutes[i].push_back(route);
         }
       }
@@ -670,156 +1849,64 @@ class Graph {
 
     details.push_back("Total Travel Time: " + to_string(hours) + "h " +
                       to_string(minutes) + "m");
+    if (!routeLegs.empty()) {
+      int duration = routeLegs.back().arrStamp - routeLegs.front().depStamp;
+      details.push_back("Door-to-Door: " + to_string(duration / 60) + "h " +
+                        to_string(duration % 60) + "m");
+    }
 
     details.push_back("Number of Legs: " + to_string(routeLegs.size()));
 
     return details;
   }
 
-  vector<string> formatAllRoutes(int originIdx, int destIdx) {
-    vector<string> display;
-    string originName = ports[originIdx].name;
-    string destName = ports[destIdx].name;
-
-    vector<CompleteRoute> allRoutes = findAllPossibleRoutes(originIdx, destIdx);
-
-    if (allRoutes.empty()) {
-      display.push_back("=== NO ROUTES FOUND ===");
-      display.push_back("");
-      display.push_back("No direct or connected routes available between " +
-                        originName + " and " + destName + ".");
-      return display;
-    }
-
-    vector<CompleteRoute> uniqueRoutes;
-    for (const auto& route : allRoutes) {
-      bool isDuplicate = false;
-      for (const auto& existing : uniqueRoutes) {
-        if (route.portPath == existing.portPath &&
-            route.totalCost == existing.totalCost &&
-            route.totalTime == existing.totalTime) {
-          isDuplicate = true;
-          break;
-        }
-      }
-      if (!isDuplicate) {
-        uniqueRoutes.push_back(route);
-      }
-    }
-
-    CompleteRoute shortestRoute = uniqueRoutes[0];
-    CompleteRoute cheapestRoute = uniqueRoutes[0];
-
-    for (const auto& route : uniqueRoutes) {
-      if (route.totalTime < shortestRoute.totalTime) {
-        shortestRoute = route;
-      }
-      if (route.totalCost < cheapestRoute.totalCost) {
-        cheapestRoute = route;
-      }
-    }
-
-    vector<CompleteRoute> directRoutes, singleLayoverRoutes, multiLayoverRoutes;
-    for (const auto& route : uniqueRoutes) {
-      if (route.layoverCount == 0)
-        directRoutes.push_back(route);
-      else if (route.layoverCount == 1)
-        singleLayoverRoutes.push_back(route);
-      else
-        multiLayoverRoutes.push_back(route);
+  string formatItineraryPath(const Itinerary& route) const {
+    string s;
+    for (int i = 0; i <= route.legCount; i++) {
+      s += ports[itineraryPort(route, i)].name;
+      if (i < route.legCount) s += " -> ";
     }
+    return s;
+  }
 
-    auto formatPath = [this](const vector<int>& path) {
-      string s;
-      for (size_t i = 0; i < path.size(); i++) {
-        s += ports[path[i]].name;
-        if (i < path.size() - 1) s += " -> ";
-      }
-      return s;
-    };
-
-    display.push_back(
-        "==================== ROUTE SEARCH RESULTS ====================");
-    display.push_back("");
-    display.push_back("Number of Available Routes: " +
-                      to_string(uniqueRoutes.size()));
-    display.push_back("");
-
-    display.push_back(
-        "==================== QUICK SUMMARY ====================");
+  // Result-list lines for one itinerary: 5 header lines plus 6 per leg.
+  void appendItineraryLines(const Itinerary& route, size_t number,
+                            vector<string>& display) const {
+    display.push_back("ROUTE " + to_string(number));
     display.push_back("");
-    display.push_back("FASTEST ROUTE:");
-    display.push_back(formatPath(shortestRoute.portPath));
-    display.push_back("Time: " + to_string(shortestRoute.totalTime / 60) +
-                      "h " + to_string(shortestRoute.totalTime % 60) +
-                      "m | Cost: $" + to_string(shortestRoute.totalCost));
-    display.push_back("");
-    display.push_back("CHEAPEST ROUTE:");
-    display.push_back(formatPath(cheapestRoute.portPath));
-    display.push_back("Cost: $" + to_string(cheapestRoute.totalCost) +
-                      "  Time: " + to_string(cheapestRoute.totalTime / 60) +
-                      "h " + to_string(cheapestRoute.totalTime % 60) + "m");
+    if (!itineraryLive(route)) {
+      display.push_back("A leg of this route is no longer scheduled.");
+      display.resize(display.size() - 3 + itineraryLineCount(route));
+      return;
+    }
+    display.push_back("Path: " + formatItineraryPath(route));
+    display.push_back("Cost: $" + to_string(route.totalCost) +
+                      "  Time: " + to_string(route.totalTime / 60) + "h " +
+                      to_string(route.totalTime % 60) + "m");
     display.push_back("");
 
-    auto displayRouteCategory = [&](const vector<CompleteRoute>& routes,
-                                    const string& title, const string& icon) {
-      if (!routes.empty()) {
-        display.push_back(icon + " " + title + " (" + to_string(routes.size()) +
-                          ") ====================");
+    for (int j = 0; j < route.legCount; j++) {
+      const Route& leg = *edgeRoute(route.legs[j]);
+      display.push_back("---- LEG " + to_string(j + 1) + "----");
+      display.push_back(ports[itineraryPort(route, j)].name + " -> " +
+                        ports[itineraryPort(route, j + 1)].name);
+      display.push_back("Date: " + leg.date + "   " + leg.depTime + " - " +
+                        leg.arrTime);
+      display.push_back("Cost: $" + to_string(leg.cost) + "  Duration: " +
+                        to_string(leg.travelTime / 60) + "h " +
+                        to_string(leg.travelTime % 60) + "m");
+      display.push_back("Company: " + leg.company);
+      if (j < route.legCount - 1) {
         display.push_back("");
-
-        for (size_t i = 0; i < routes.size(); i++) {
-          display.push_back("ROUTE " + to_string(i + 1));
-          display.push_back("");
-          display.push_back("Path: " + formatPath(routes[i].portPath));
-          display.push_back("Cost: $" + to_string(routes[i].totalCost) +
-                            "  Time: " + to_string(routes[i].totalTime / 60) +
-                            "h " + to_string(routes[i].totalTime % 60) + "m");
-          display.push_back("");
-
-          for (size_t j = 0; j < routes[i].routeLegs.size(); j++) {
-            const Route& leg = routes[i].routeLegs[j];
-            display.push_back("---- LEG " + to_string(j + 1) + "----");
-            display.push_back(ports[routes[i].portPath[j]].name + " -> " +
-                              ports[routes[i].portPath[j + 1]].name);
-            display.push_back("Date: " + leg.date + "   " + leg.depTime +
-                              " - " + leg.arrTime);
-            display.push_back("Cost: $" + to_string(leg.cost) +
-                              "  Duration: " + to_string(leg.travelTime / 60) +
-                              "h " + to_string(leg.travelTime % 60) + "m");
-            display.push_back("Company: " + leg.company);
-            if (j < routes[i].routeLegs.size() - 1) {
-              display.push_back("");
-            }
-          }
-          display.push_back("");
-        }
       }
-    };
-
-    displayRouteCategory(directRoutes, "DIRECT ROUTES",
-                         " ====================");
-    displayRouteCategory(singleLayoverRoutes, "SINGLE LAYOVER ROUTES",
-                         " ====================");
-    displayRouteCategory(multiLayoverRoutes, "MULTI-LAYOVER ROUTES",
-                         " ====================");
-
-    display.push_back("==================== SUMMARY ====================");
-    display.push_back("");
-    display.push_back("Direct Routes: " + to_string(directRoutes.size()));
-    display.push_back("Single Layover: " +
-                      to_string(singleLayoverRoutes.size()));
-    display.push_back("Multi-Layover: " + to_string(multiLayoverRoutes.size()));
-    display.push_back("Total Unique Routes: " + to_string(uniqueRoutes.size()));
-    display.push_back("");
-    display.push_back("==================== COLOR LEGEND ====================");
-    display.push_back("");
-    display.push_back("MAGENTA = Direct Routes (No layovers)");
-    display.push_back("ORANGE = Single Layover Routes");
-    display.push_back("BLUE = Multi-Layover Routes (2+ stops)");
+    }
     display.push_back("");
-    return display;
   }
+
+  static size_t itineraryLineCount(const Itinerary& route) {
+    return 5 + 6 * route.legCount;
+  }
+
   bool hasDirectRoute(int fromIdx, int toIdx) const {
     if (fromIdx < 0 || fromIdx >= ports.size() || toIdx < 0 ||
         toIdx >= ports.size()) {
@@ -851,6 +1938,36 @@ class Graph {
   }
 };
 
+// Fills g with departuresPerDay random legs per port per day, starting at
+// startDate. Used by the --bench mode to get a dense schedule.
+void generateSyntheticSchedule(Graph& g, const string& startDate, int days,
+                               int departuresPerDay, unsigned seed) {
+  int n = g.ports.size();
+  if (n < 2) return;
+  int startDay = toTimestamp(startDate, "00:00") / (24 * 60);
+  const char* companies[] = {"Maersk", "MSC", "CMA_CGM", "Evergreen",
+                             "Hapag-Lloyd"};
+  srand(seed);
+  for (int d = 0; d < days; d++) {
+    string date = daysToDate(startDay + d);
+    for (int src = 0; src < n; src++) {
+      for (int k = 0; k < departuresPerDay; k++) {
+        int dest = rand() % (n - 1);
+        if (dest >= src) dest++;
+        int dep = rand() % (24 * 60);
+        int arr = (dep + 120 + rand() % (21 * 60)) % (24 * 60);
+        char depTime[8], arrTime[8];
+        snprintf(depTime, sizeof(depTime), "%02d:%02d", dep / 60, dep % 60);
+        snprintf(arrTime, sizeof(arrTime), "%02d:%02d", arr / 60, arr % 60);
+        Route r = {g.ports[dest].name, date, depTime, arrTime,
+                   500 + rand() % 4500, companies[rand() % 5],
+                   g.calculateTravelTime(depTime, arrTime)};
+        g.addRoute(g.ports[src].name, r);
+      }
+    }
+  }
+}
+
 struct MultiLegJourney {
   vector<int> portPath;
   vector<JourneyLeg> legs;
@@ -874,601 +1991,2252 @@ struct MultiLegJourney {
     }
   }
 };
-class Button {
- public:
-  RectangleShape shape;
-  Text text;
-  Color normalColor;
-  Color hoverColor;
-  Color clickColor;
-  Button(Vector2f position, Vector2f size, string buttonText, Font& font) {
-    shape.setSize(size);
-    shape.setPosition(position);
-
-    normalColor = Color(70, 130, 180);
-    hoverColor = Color(100, 160, 210);
-    clickColor = Color(50, 100, 150);
-    shape.setFillColor(normalColor);
-    shape.setOutlineThickness(2);
-    shape.setOutlineColor(Color::White);
-
-    text.setFont(font);
-    text.setString(buttonText);
-    text.setCharacterSize(24);
-    text.setFillColor(Color::White);
 
-    FloatRect textBounds = text.getLocalBounds();
-    text.setOrigin(textBounds.left + textBounds.width / 2.0f,
-                   textBounds.top + textBounds.height / 2.0f);
-    text.setPosition(position.x + size.x / 2.0f, position.y + size.y / 2.0f);
+// Keeps dijkstra() results for a set of source ports up to date as routes are
+// added or removed, repairing only the part of each tree a change touches.
+class DynamicShortestPaths {
+ private:
+  struct SourceTree {
+    int srcIdx;
+    vector<int> dist;
+    vector<int> parent;
+    vector<Route> lastRoute;
+  };
+  typedef priority_queue<pair<int, int>, vector<pair<int, int>>,
+                         greater<pair<int, int>>>
+      MinQueue;
+
+  Graph* graph;
+  bool findCheapest;
+  size_t syncedChange;
+  vector<SourceTree> trees;
+
+  // Legs are scanned in departure order, as Graph::dijkstra does, so equal
+  // distances settle on the same parent leg in both.
+  const Route* arrivalLeg(const SourceTree& t, int u) const {
+    if (u == t.srcIdx || t.parent[u] == -1) return nullptr;
+    return &t.lastRoute[u];
+  }
+
+  // Weighted as in Graph::dijkstra, including the wait at u in time mode.
+  int legWeight(const SourceTree& t, int u, const Route& route, int v) const {
+    if (findCheapest) return route.cost + graph->ports[v].cost;
+    const Route* prev = arrivalLeg(t, u);
+    return prev ? route.arrStamp - prev->arrStamp : route.travelTime;
+  }
+
+  bool canDepart(const SourceTree& t, int u, const Route& route) const {
+    if (u == t.srcIdx || t.parent[u] == -1) return true;
+    return graph->canConnect(t.lastRoute[u], route);
+  }
+
+  bool isConsistent(const SourceTree& t, int v) const {
+    int p = t.parent[v];
+    if (p == -1) return true;
+    if (t.dist[p] == INF || !canDepart(t, p, t.lastRoute[v])) return false;
+    return t.dist[v] == t.dist[p] + legWeight(t, p, t.lastRoute[v], v);
+  }
+
+  void relaxFrom(SourceTree& t, MinQueue& pq) {
+    while (!pq.empty()) {
+      int d = pq.top().first;
+      int u = pq.top().second;
+      pq.pop();
+      if (d != t.dist[u]) continue;
+
+      const vector<int>& order = graph->departureOrder[u];
+      for (size_t k = graph->firstConnection(u, arrivalLeg(t, u));
+           k < order.size(); k++) {
+        const Route& route = graph->routes[u][order[k]];
+        int v = route.destIdx;
+        if (v == -1 || v == t.srcIdx) continue;
+        if (!canDepart(t, u, route)) continue;
+
+        int newDist = d + legWeight(t, u, route, v);
+        if (newDist < t.dist[v]) {
+          t.dist[v] = newDist;
+          t.parent[v] = u;
+          t.lastRoute[v] = route;
+          pq.push({newDist, v});
+        }
+      }
+    }
   }
-  void setPosition(const sf::Vector2f& pos) {
-    shape.setPosition(pos);
-    FloatRect bounds = text.getLocalBounds();
-    text.setPosition(
-        pos.x + (shape.getSize().x - bounds.width) / 2.0f,
-        pos.y + (shape.getSize().y - bounds.height) / 2.0f - bounds.top);
+
+  vector<int> collectStale(const SourceTree& t) const {
+    vector<int> stale;
+    for (int v = 0; v < t.dist.size(); v++) {
+      if (v != t.srcIdx && !isConsistent(t, v)) stale.push_back(v);
+    }
+    return stale;
   }
-  void setText(const string& newText) {
-    text.setString(newText);
-    FloatRect textBounds = text.getLocalBounds();
-    text.setOrigin(textBounds.left + textBounds.width / 2.0f,
-                   textBounds.top + textBounds.height / 2.0f);
 
-    Vector2f shapePos = shape.getPosition();
-    Vector2f shapeSize = shape.getSize();
-    text.setPosition(shapePos.x + shapeSize.x / 2.0f,
-                     shapePos.y + shapeSize.y / 2.0f);
+  void repair(SourceTree& t, vector<int> seeds) {
+    int n = t.dist.size();
+    while (!seeds.empty()) {
+      vector<vector<int>> children(n);
+      for (int v = 0; v < n; v++) {
+        if (t.parent[v] != -1) children[t.parent[v]].push_back(v);
+      }
+
+      vector<bool> affected(n, false);
+      vector<int> stack = seeds;
+      while (!stack.empty()) {
+        int v = stack.back();
+        stack.pop_back();
+        if (affected[v] || v == t.srcIdx) continue;
+        affected[v] = true;
+        for (int c : children[v]) stack.push_back(c);
+      }
+
+      for (int v = 0; v < n; v++) {
+        if (affected[v]) {
+          t.dist[v] = INF;
+          t.parent[v] = -1;
+        }
+      }
+
+      for (int x = 0; x < n; x++) {
+        if (affected[x] || t.dist[x] == INF) continue;
+        const vector<int>& order = graph->departureOrder[x];
+        for (size_t k = graph->firstConnection(x, arrivalLeg(t, x));
+             k < order.size(); k++) {
+          const Route& route = graph->routes[x][order[k]];
+          int v = route.destIdx;
+          if (v == -1 || !affected[v] || !canDepart(t, x, route)) continue;
+          int newDist = t.dist[x] + legWeight(t, x, route, v);
+          if (newDist < t.dist[v]) {
+            t.dist[v] = newDist;
+            t.parent[v] = x;
+            t.lastRoute[v] = route;
+          }
+        }
+      }
+
+      MinQueue pq;
+      for (int v = 0; v < n; v++) {
+        if (affected[v] && t.dist[v] != INF) pq.push({t.dist[v], v});
+      }
+      relaxFrom(t, pq);
+      seeds = collectStale(t);
+    }
   }
 
-  void draw(RenderWindow& window) {
-    window.draw(shape);
-    window.draw(text);
+  void computeFromScratch(SourceTree& t) {
+    int n = graph->ports.size();
+    t.dist.assign(n, INF);
+    t.parent.assign(n, -1);
+    t.lastRoute.assign(n, Route{});
+    t.dist[t.srcIdx] = 0;
+
+    MinQueue pq;
+    pq.push({0, t.srcIdx});
+    relaxFrom(t, pq);
   }
 
-  bool isMouseOver(RenderWindow& window) {
-    Vector2i mousePos = Mouse::getPosition(window);
-    FloatRect bounds = shape.getGlobalBounds();
-    return bounds.contains(static_cast<Vector2f>(mousePos));
+  void addLeg(SourceTree& t, int u, const Route& route) {
+    int v = route.destIdx;
+    if (u == -1 || v == -1 || v == t.srcIdx) return;
+    if (t.dist[u] == INF || !canDepart(t, u, route)) return;
+    int newDist = t.dist[u] + legWeight(t, u, route, v);
+    if (newDist >= t.dist[v]) return;
+
+    t.dist[v] = newDist;
+    t.parent[v] = u;
+    t.lastRoute[v] = route;
+    MinQueue pq;
+    pq.push({newDist, v});
+    relaxFrom(t, pq);
+    repair(t, collectStale(t));
   }
 
-  void update(RenderWindow& window) {
-    if (isMouseOver(window)) {
-      if (Mouse::isButtonPressed(Mouse::Left)) {
-        shape.setFillColor(clickColor);
-      } else {
-        shape.setFillColor(hoverColor);
+  void applyChange(SourceTree& t, const GraphChange& change) {
+    if (change.type == GraphChange::PORT_ADDED) {
+      t.dist.resize(graph->ports.size(), INF);
+      t.parent.resize(graph->ports.size(), -1);
+      t.lastRoute.resize(graph->ports.size());
+      // addPort re-targets legs that named the port before it existed and
+      // logs only the port, so those legs are added here.
+      for (int edgeId : graph->incoming[change.srcIdx]) {
+        const Route* route = graph->edgeRoute(edgeId);
+        if (route) addLeg(t, graph->edgeTable.srcId[edgeId], *route);
       }
-    } else {
-      shape.setFillColor(normalColor);
+      return;
+    }
+
+    if (change.type == GraphChange::ROUTE_ADDED) {
+      addLeg(t, change.srcIdx, change.route);
+    } else if (change.type == GraphChange::ROUTE_REMOVED) {
+      int u = change.srcIdx;
+      int v = change.destIdx;
+      if (u == -1 || v == -1 || v == t.srcIdx) return;
+      if (t.parent[v] != u || !isSameRoute(t.lastRoute[v], change.route)) {
+        return;
+      }
+      repair(t, {v});
     }
   }
 
-  bool isClicked(RenderWindow& window, Event& event) {
-    if (event.type == Event::MouseButtonReleased &&
-        event.mouseButton.button == Mouse::Left) {
-      return isMouseOver(window);
+  SourceTree* findTree(int srcIdx) {
+    for (auto& t : trees) {
+      if (t.srcIdx == srcIdx) return &t;
     }
-    return false;
+    return nullptr;
   }
-};
-class SubgraphMenu {
+
  public:
-  vector<Button*> buttons;
-  Text titleText;
-  bool isVisible;
-  Font* font;
-  float windowWidth;
-  float windowHeight;
-  Texture* oceanTexture;
-  Sprite oceanBackground;
-  vector<string> selectedOptions;
-  enum SubgraphMode { COMPANY_MODE, WEATHER_MODE };
-  SubgraphMode currentMode;
-  SubgraphMenu(Font& f, float winWidth, float winHeight, Texture& oceanTex)
-      : font(&f),
-        isVisible(false),
-        windowWidth(winWidth),
-        windowHeight(winHeight),
-        oceanTexture(&oceanTex),
-        currentMode(COMPANY_MODE) {
-    titleText.setFont(f);
-    titleText.setCharacterSize(48);
-    titleText.setFillColor(Color::White);
-    titleText.setOutlineThickness(2);
-    titleText.setOutlineColor(Color::Black);
-    oceanBackground.setTexture(*oceanTexture);
-    Vector2u textureSize = oceanTexture->getSize();
-    float scaleX = (float)winWidth / textureSize.x;
-    float scaleY = (float)winHeight / textureSize.y;
-    oceanBackground.setScale(scaleX, scaleY);
+  DynamicShortestPaths(Graph& g, bool cheapest)
+      : graph(&g), findCheapest(cheapest), syncedChange(g.getChangeCount()) {}
+
+  void addSource(int srcIdx) {
+    if (srcIdx < 0 || srcIdx >= graph->ports.size() || findTree(srcIdx)) {
+      return;
+    }
+    sync();
+    SourceTree t;
+    t.srcIdx = srcIdx;
+    computeFromScratch(t);
+    trees.push_back(t);
   }
 
-  ~SubgraphMenu() { clearButtons(); }
+  void removeSource(int srcIdx) {
+    for (auto it = trees.begin(); it != trees.end(); ++it) {
+      if (it->srcIdx == srcIdx) {
+        trees.erase(it);
+        return;
+      }
+    }
+  }
 
-  void clearButtons() {
-    for (auto btn : buttons) {
-      delete btn;
+  int sync() {
+    int applied = 0;
+    while (syncedChange < graph->getChangeCount()) {
+      const GraphChange& change = graph->changeLog[syncedChange++];
+      for (auto& t : trees) {
+        applyChange(t, change);
+      }
+      applied++;
     }
-    buttons.clear();
+    return applied;
   }
 
-  void createMainMenu() {
-    clearButtons();
-    titleText.setString("Generate Subgraph");
-    selectedOptions.clear();
+  ShortestRouteResult query(int srcIdx) {
+    sync();
+    addSource(srcIdx);
+    SourceTree* t = findTree(srcIdx);
+    if (!t) {
+      return {vector<int>(graph->ports.size(), INF),
+              vector<int>(graph->ports.size(), -1), -1, false, {}};
+    }
+    return {t->dist, t->parent, t->srcIdx, true, t->lastRoute};
+  }
 
-    float buttonWidth = 400;
-    float buttonHeight = 70;
-    float centerX = (windowWidth - buttonWidth) / 2;
-    float startY = windowHeight * 0.2f;
-    float spacing = buttonHeight + 15;
-
-    buttons.push_back(new Button(Vector2f(centerX, startY),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Based on Company", *font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Based on Weather Conditions", *font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 4),
-                                 Vector2f(buttonWidth, buttonHeight), "Back",
-                                 *font));
-  }
-
-  void createCompanyMenu(const vector<string>& companies) {
-    clearButtons();
-    titleText.setString("Select Companies");
-    currentMode = COMPANY_MODE;
+  size_t sourceCount() const { return trees.size(); }
+};
 
-    float buttonWidth = 250;
-    float buttonHeight = 60;
-    float startX = 100;
-    float startY = windowHeight * 0.15f;
-    float spacingX = buttonWidth + 30;
-    float spacingY = buttonHeight + 20;
+struct CargoPlan {
+  vector<BookedRoute> bookings;
+  vector<int> unmetVolume;
+  long long totalCost;
+  int iterations;
+  float solveMs;
+};
 
-    int cols = 4;
-    int col = 0;
-    int row = 0;
+// Allocates bulk cargo over a time-expanded copy of the schedule: one node
+// per (port, event time), wait arcs along each port's timeline and one
+// capacitated arc per leg. Demands are routed earliest-ready first with
+// successive shortest paths; capacity used by one demand is not reopened.
+class CargoFlowPlanner {
+  struct Arc {
+    int to;
+    int rev;
+    int cap;
+    int cost;
+    int legSrc;
+    int legIdx;
+    bool forward;
+  };
 
-    for (const string& company : companies) {
-      float x = startX + (col * spacingX);
-      float y = startY + (row * spacingY);
+  Graph* graph;
+  int defaultCapacity;
+  vector<vector<int>> legCapacity;
+  vector<vector<Arc>> adj;
+  vector<int> nodePort;
+  vector<int> nodeTime;
+  vector<vector<int>> timeline;
+  vector<int> sinkNode;
+  bool built;
+
+  void addArc(int u, int v, int cap, int cost, int legSrc, int legIdx) {
+    adj[u].push_back({v, (int)adj[v].size(), cap, cost, legSrc, legIdx, true});
+    adj[v].push_back({u, (int)adj[u].size() - 1, 0, -cost, -1, -1, false});
+  }
+
+  int nodeAt(int port, int time) const {
+    const vector<int>& nodes = timeline[port];
+    int lo = 0, hi = nodes.size();
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (nodeTime[nodes[mid]] < time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo < nodes.size() ? nodes[lo] : -1;
+  }
 
-      Button* btn = new Button(
-          Vector2f(x, y), Vector2f(buttonWidth, buttonHeight), company, *font);
-      for (const string& selected : selectedOptions) {
-        if (selected == company) {
-          btn->shape.setFillColor(Color(0, 150, 0));
-          break;
-        }
+  void build() {
+    int n = graph->ports.size();
+    vector<vector<int>> times(n);
+    for (int u = 0; u < n; u++) {
+      for (const Route& route : graph->routes[u]) {
+        int v = route.destIdx;
+        if (v == -1) continue;
+        times[u].push_back(route.depStamp);
+        times[v].push_back(route.arrStamp +
+                           max(1, graph->ports[v].minConnectionTime));
       }
-      buttons.push_back(btn);
+    }
 
-      col++;
-      if (col >= cols) {
-        col = 0;
-        row++;
+    adj.clear();
+    nodePort.clear();
+    nodeTime.clear();
+    timeline.assign(n, vector<int>());
+    sinkNode.assign(n, -1);
+    for (int p = 0; p < n; p++) {
+      sort(times[p].begin(), times[p].end());
+      times[p].erase(unique(times[p].begin(), times[p].end()), times[p].end());
+      for (int t : times[p]) {
+        timeline[p].push_back(nodePort.size());
+        nodePort.push_back(p);
+        nodeTime.push_back(t);
       }
     }
-    float actionY = startY + ((row + 1) * spacingY) + 40;
-    float centerX = (windowWidth - 250) / 2;
+    for (int p = 0; p < n; p++) {
+      sinkNode[p] = nodePort.size();
+      nodePort.push_back(p);
+      nodeTime.push_back(INF);
+    }
+    adj.assign(nodePort.size(), vector<Arc>());
 
-    buttons.push_back(new Button(Vector2f(centerX - 270, actionY),
-                                 Vector2f(250, 60), "Select All", *font));
-    buttons.push_back(new Button(Vector2f(centerX, actionY), Vector2f(250, 60),
-                                 "Clear All", *font));
-    buttons.push_back(new Button(Vector2f(centerX + 270, actionY),
-                                 Vector2f(250, 60), "Done", *font));
+    for (int p = 0; p < n; p++) {
+      for (size_t i = 0; i < timeline[p].size(); i++) {
+        if (i + 1 < timeline[p].size()) {
+          addArc(timeline[p][i], timeline[p][i + 1], INF, 0, -1, -1);
+        }
+        addArc(timeline[p][i], sinkNode[p], INF, 0, -1, -1);
+      }
+    }
+    for (int u = 0; u < n; u++) {
+      for (int r = 0; r < graph->routes[u].size(); r++) {
+        const Route& route = graph->routes[u][r];
+        int v = route.destIdx;
+        if (v == -1) continue;
+        int from = nodeAt(u, route.depStamp);
+        int to = nodeAt(
+            v, route.arrStamp + max(1, graph->ports[v].minConnectionTime));
+        addArc(from, to, getLegCapacity(u, r),
+               route.cost + graph->ports[v].cost, u, r);
+      }
+    }
+    built = true;
+  }
+
+  bool shortestPath(int source, int sink, vector<long long>& potential,
+                    vector<int>& prevNode, vector<int>& prevArc) {
+    int n = adj.size();
+    vector<long long> dist(n, LLONG_MAX);
+    prevNode.assign(n, -1);
+    prevArc.assign(n, -1);
+    priority_queue<pair<long long, int>, vector<pair<long long, int>>,
+                   greater<pair<long long, int>>>
+        pq;
+    dist[source] = 0;
+    pq.push({0, source});
+    while (!pq.empty()) {
+      auto [d, u] = pq.top();
+      pq.pop();
+      if (d > dist[u]) continue;
+      if (u == sink) break;
+      for (int i = 0; i < adj[u].size(); i++) {
+        const Arc& arc = adj[u][i];
+        if (arc.cap <= 0) continue;
+        long long nd = d + arc.cost + potential[u] - potential[arc.to];
+        if (nd < dist[arc.to]) {
+          dist[arc.to] = nd;
+          prevNode[arc.to] = u;
+          prevArc[arc.to] = i;
+          pq.push({nd, arc.to});
+        }
+      }
+    }
+    if (dist[sink] == LLONG_MAX) return false;
+    // The search stops at the sink; capping unsettled nodes at its distance
+    // keeps every reduced cost non-negative for the next search.
+    for (int v = 0; v < n; v++) {
+      potential[v] += min(dist[v], dist[sink]);
+    }
+    return true;
   }
 
-  void createWeatherMenu(const vector<string>& weatherConditions) {
-    clearButtons();
-    titleText.setString("Select Weather to AVOID");
-    currentMode = WEATHER_MODE;
+ public:
+  CargoFlowPlanner(Graph& g, int capacity = 100)
+      : graph(&g), defaultCapacity(capacity), built(false) {}
 
-    float buttonWidth = 250;
-    float buttonHeight = 60;
-    float startX = 100;
-    float startY = windowHeight * 0.15f;
-    float spacingX = buttonWidth + 30;
-    float spacingY = buttonHeight + 20;
+  int getLegCapacity(int srcIdx, int routeIdx) const {
+    if (srcIdx < legCapacity.size() && routeIdx < legCapacity[srcIdx].size() &&
+        legCapacity[srcIdx][routeIdx] >= 0) {
+      return legCapacity[srcIdx][routeIdx];
+    }
+    return defaultCapacity;
+  }
 
-    int cols = 3;
-    int col = 0;
-    int row = 0;
+  void setLegCapacity(int srcIdx, int routeIdx, int capacity) {
+    if (legCapacity.size() <= srcIdx) legCapacity.resize(srcIdx + 1);
+    if (legCapacity[srcIdx].size() <= routeIdx) {
+      legCapacity[srcIdx].resize(routeIdx + 1, -1);
+    }
+    legCapacity[srcIdx][routeIdx] = capacity;
+    built = false;
+  }
 
-    vector<string> weatherDisplayNames = {
-        "Cyclone", "Fog", "Heavy Rain", "High Wind", "Snow", "Storm", "Clear"};
+  CargoPlan plan(const vector<CargoDemand>& demands) {
+    Clock solveClock;
+    CargoPlan result = {{}, vector<int>(demands.size(), 0), 0, 0, 0.0f};
+    build();
 
-    for (size_t i = 0; i < weatherConditions.size(); i++) {
-      float x = startX + (col * spacingX);
-      float y = startY + (row * spacingY);
+    vector<int> order(demands.size());
+    vector<int> readyStamp(demands.size());
+    for (size_t i = 0; i < demands.size(); i++) {
+      order[i] = i;
+      readyStamp[i] = toTimestamp(demands[i].readyDate, "00:00");
+    }
+    stable_sort(order.begin(), order.end(),
+                [&](int a, int b) { return readyStamp[a] < readyStamp[b]; });
 
-      string displayName = (i < weatherDisplayNames.size())
-                               ? weatherDisplayNames[i]
-                               : weatherConditions[i];
-      Button* btn =
-          new Button(Vector2f(x, y), Vector2f(buttonWidth, buttonHeight),
-                     displayName, *font);
-      for (const string& selected : selectedOptions) {
-        if (selected == weatherConditions[i]) {
-          btn->shape.setFillColor(Color(150, 0, 0));
-          break;
+    int n = graph->ports.size();
+    vector<long long> potential(adj.size(), 0);
+    vector<int> prevNode, prevArc;
+    vector<pair<int, int>> touched;
+
+    for (int d : order) {
+      const CargoDemand& demand = demands[d];
+      result.unmetVolume[d] = demand.volume;
+      if (demand.originIdx < 0 || demand.originIdx >= n ||
+          demand.destIdx < 0 || demand.destIdx >= n ||
+          demand.originIdx == demand.destIdx || demand.volume <= 0) {
+        continue;
+      }
+      int source = nodeAt(demand.originIdx, readyStamp[d]);
+      int sink = sinkNode[demand.destIdx];
+      if (source == -1) continue;
+
+      fill(potential.begin(), potential.end(), 0);
+      touched.clear();
+      int remaining = demand.volume;
+      while (remaining > 0 &&
+             shortestPath(source, sink, potential, prevNode, prevArc)) {
+        int push = remaining;
+        for (int v = sink; v != source; v = prevNode[v]) {
+          push = min(push, adj[prevNode[v]][prevArc[v]].cap);
+        }
+        for (int v = sink; v != source; v = prevNode[v]) {
+          Arc& arc = adj[prevNode[v]][prevArc[v]];
+          arc.cap -= push;
+          adj[v][arc.rev].cap += push;
+          if (arc.forward) touched.push_back({prevNode[v], prevArc[v]});
+        }
+        remaining -= push;
+        result.iterations++;
+      }
+      result.unmetVolume[d] = remaining;
+
+      // The reverse capacities now hold this demand's flow; peel it into
+      // paths, then close them so later demands cannot cancel it.
+      int routed = demand.volume - remaining;
+      while (routed > 0) {
+        vector<int> path = {demand.originIdx};
+        vector<Route> legs;
+        vector<pair<int, int>> used;
+        int push = routed;
+        int u = source;
+        while (u != sink) {
+          int next = -1;
+          for (int i = 0; i < adj[u].size(); i++) {
+            const Arc& arc = adj[u][i];
+            if (arc.forward && adj[arc.to][arc.rev].cap > 0) {
+              next = i;
+              break;
+            }
+          }
+          if (next == -1) break;
+          const Arc& arc = adj[u][next];
+          push = min(push, adj[arc.to][arc.rev].cap);
+          used.push_back({u, next});
+          if (arc.legSrc >= 0) {
+            legs.push_back(graph->routes[arc.legSrc][arc.legIdx]);
+            path.push_back(nodePort[arc.to]);
+          }
+          u = arc.to;
         }
+        if (u != sink || legs.empty()) break;
+        for (const auto& step : used) {
+          Arc& arc = adj[step.first][step.second];
+          adj[arc.to][arc.rev].cap -= push;
+        }
+        ItineraryHandle cr = make_shared<const CompleteRoute>(
+            graph->makeCompleteRoute(path, legs, nullptr));
+        BookedRoute booking(cr, graph->ports[demand.originIdx].name,
+                            graph->ports[demand.destIdx].name,
+                            legs.front().date, demand.customerName);
+        booking.volume = push;
+        result.totalCost += (long long)cr->totalCost * push;
+        result.bookings.push_back(booking);
+        routed -= push;
       }
-      buttons.push_back(btn);
-
-      col++;
-      if (col >= cols) {
-        col = 0;
-        row++;
+      for (const auto& step : touched) {
+        Arc& arc = adj[step.first][step.second];
+        adj[arc.to][arc.rev].cap = 0;
       }
     }
 
-    float actionY = startY + ((row + 1) * spacingY) + 40;
-    float centerX = (windowWidth - 250) / 2;
+    result.solveMs = solveClock.getElapsedTime().asMicroseconds() / 1000.0f;
+    return result;
+  }
+};
 
-    buttons.push_back(new Button(Vector2f(centerX - 270, actionY),
-                                 Vector2f(250, 60), "Select All", *font));
-    buttons.push_back(new Button(Vector2f(centerX, actionY), Vector2f(250, 60),
-                                 "Clear All", *font));
-    buttons.push_back(new Button(Vector2f(centerX + 270, actionY),
-                                 Vector2f(250, 60), "Done", *font));
+// Route legs bucketed by departure day, each shard with its own per-port
+// adjacency sorted by departure. Date-scoped searches only load the days
+// they need; shards beyond the resident limit are written to disk and
+// reloaded on demand.
+class RouteShardStore {
+  struct RouteShard {
+    vector<vector<Route>> legs;
+    vector<int> departures;
+    bool resident = true;
+    bool dirty = true;
+    unsigned lastUsed = 0;
+  };
+
+  Graph* graph;
+  map<int, RouteShard> shards;
+  size_t syncedChange;
+  unsigned useCounter;
+  // Shards used after this tick belong to the running query.
+  unsigned queryStart;
+  int residentLimit;
+  int horizonDays;
+  string spillPrefix;
+
+  string shardFile(int day) const {
+    return spillPrefix + to_string(day) + ".txt";
   }
 
-  void toggleOption(const string& option) {
-    auto it = find(selectedOptions.begin(), selectedOptions.end(), option);
-    if (it == selectedOptions.end()) {
-      selectedOptions.push_back(option);
-    } else {
-      selectedOptions.erase(it);
+  void fitPorts(RouteShard& shard) {
+    if (shard.departures.size() < graph->ports.size()) {
+      shard.departures.resize(graph->ports.size(), 0);
+    }
+    if (shard.resident && shard.legs.size() < graph->ports.size()) {
+      shard.legs.resize(graph->ports.size());
     }
   }
 
-  void selectAll(const vector<string>& allOptions) {
-    selectedOptions = allOptions;
+  void load(int day, RouteShard& shard) {
+    shard.lastUsed = ++useCounter;
+    if (shard.resident) return;
+    shard.resident = true;
+    shard.legs.assign(graph->ports.size(), vector<Route>());
+    ifstream file(shardFile(day));
+    if (!file) {
+      cout << "Error opening route shard for " << daysToDate(day) << endl;
+      return;
+    }
+    string line;
+    while (getline(file, line)) {
+      stringstream ss(line);
+      string origin, company;
+      Route r;
+      if (!(ss >> origin >> r.destination >> r.date >> r.depTime >> r.arrTime >>
+            r.cost >> r.edgeId)) {
+        continue;
+      }
+      getline(ss, company);
+      if (!company.empty() && company[0] == ' ') company.erase(0, 1);
+      r.company = company;
+      r.travelTime = graph->calculateTravelTime(r.depTime, r.arrTime);
+      r.destIdx = graph->getPortIndex(r.destination);
+      r.companyId = graph->registerCompany(r.company);
+      decodeRouteTimes(r);
+      int srcIdx = graph->getPortIndex(origin);
+      if (srcIdx != -1) shard.legs[srcIdx].push_back(r);
+    }
+    file.close();
+    shard.dirty = false;
   }
 
-  void clearAll() { selectedOptions.clear(); }
-
-  void show() {
-    isVisible = true;
-    createMainMenu();
+  void spill(int day, RouteShard& shard) {
+    if (shard.dirty) {
+      ofstream file(shardFile(day));
+      if (!file) {
+        cout << "Error writing route shard for " << daysToDate(day) << endl;
+        return;
+      }
+      for (int src = 0; src < shard.legs.size(); src++) {
+        for (const Route& r : shard.legs[src]) {
+          file << graph->ports[src].name << " " << r.destination << " "
+               << r.date << " " << r.depTime << " " << r.arrTime << " "
+               << r.cost << " " << r.edgeId << " " << r.company << "\n";
+        }
+      }
+      file.close();
+      shard.dirty = false;
+    }
+    vector<vector<Route>>().swap(shard.legs);
+    shard.resident = false;
   }
 
-  void hide() {
-    isVisible = false;
-    clearButtons();
+  // Spills the least recently used resident shard not used after
+  // pinnedAfter. False if every resident shard is newer.
+  bool spillColdest(unsigned pinnedAfter) {
+    auto coldest = shards.end();
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+      if (it->second.resident && it->second.lastUsed <= pinnedAfter &&
+          (coldest == shards.end() ||
+           it->second.lastUsed < coldest->second.lastUsed)) {
+        coldest = it;
+      }
+    }
+    if (coldest == shards.end()) return false;
+    spill(coldest->first, coldest->second);
+    return true;
   }
 
-  bool visible() const { return isVisible; }
+  // Frees a slot for one more shard, keeping those the running query has
+  // used since queryStart.
+  void makeRoom() {
+    while (residentCount() >= residentLimit) {
+      if (!spillColdest(queryStart)) return;
+    }
+  }
+
+  RouteShard& touch(map<int, RouteShard>::iterator it) {
+    if (!it->second.resident) makeRoom();
+    load(it->first, it->second);
+    fitPorts(it->second);
+    return it->second;
+  }
+
+  void insert(int srcIdx, const Route& route) {
+    int day = route.depStamp / (24 * 60);
+    RouteShard& shard = shards[day];
+    load(day, shard);
+    fitPorts(shard);
+    vector<Route>& bucket = shard.legs[srcIdx];
+    auto pos = upper_bound(bucket.begin(), bucket.end(), route.depStamp,
+                           [](int stamp, const Route& r) {
+                             return stamp < r.depStamp;
+                           });
+    bucket.insert(pos, route);
+    shard.departures[srcIdx]++;
+    shard.dirty = true;
+  }
+
+  void erase(int srcIdx, const Route& route) {
+    int day = route.depStamp / (24 * 60);
+    auto it = shards.find(day);
+    if (it == shards.end()) return;
+    vector<Route>& bucket = touch(it).legs[srcIdx];
+    for (size_t i = 0; i < bucket.size(); i++) {
+      if (bucket[i].edgeId == route.edgeId) {
+        bucket.erase(bucket.begin() + i);
+        it->second.departures[srcIdx]--;
+        it->second.dirty = true;
+        return;
+      }
+    }
+  }
 
-  void update(RenderWindow& window) {
-    if (isVisible) {
-      for (auto btn : buttons) {
-        btn->update(window);
+  // Calls visit for every leg out of portIdx that can follow prev: the first
+  // leg must leave on firstDay, later ones on or before lastDay. Shards are
+  // loaded as the days are reached.
+  template <typename Visit>
+  void forEachDeparture(int portIdx, const Route* prev, int firstDay,
+                        int lastDay, const SearchConstraints* constraints,
+                        Visit visit) {
+    int earliest = 0;
+    int fromDay = firstDay, toDay = firstDay;
+    if (prev) {
+      earliest = prev->arrStamp + 1;
+      fromDay = max(firstDay, earliest / (24 * 60));
+      toDay = lastDay;
+    }
+    for (auto it = shards.lower_bound(fromDay);
+         it != shards.end() && it->first <= toDay; ++it) {
+      if (portIdx >= it->second.departures.size() ||
+          it->second.departures[portIdx] == 0) {
+        continue;
+      }
+      const vector<Route>& bucket = touch(it).legs[portIdx];
+      auto start = lower_bound(bucket.begin(), bucket.end(), earliest,
+                               [](const Route& r, int stamp) {
+                                 return r.depStamp < stamp;
+                               });
+      for (auto leg = start; leg != bucket.end(); ++leg) {
+        if (leg->destIdx == -1) continue;
+        if (constraints && !constraints->allowsLeg(*leg)) continue;
+        if (prev && !graph->canConnect(*prev, *leg)) continue;
+        visit(*leg);
       }
     }
   }
 
-  void draw(RenderWindow& window) {
-    if (isVisible) {
-      window.draw(oceanBackground);
-      RectangleShape overlay(Vector2f(windowWidth, windowHeight));
-      overlay.setFillColor(Color(0, 0, 0, 100));
-      window.draw(overlay);
+  void dfs(int currentIdx, int destIdx, int firstDay, int lastDay,
+           vector<int>& path, vector<Route>& legs, ItineraryArena& results,
+           int maxLegs, const SearchConstraints* constraints) {
+    if (currentIdx == destIdx && !legs.empty()) {
+      results.add(graph->scoreItinerary(path, legs, constraints), legs);
+      return;
+    }
+    if (legs.size() >= maxLegs) return;
+
+    // Copied: the recursion below may reallocate legs.
+    Route prev = legs.empty() ? Route{} : legs.back();
+    forEachDeparture(
+        currentIdx, legs.empty() ? nullptr : &prev, firstDay, lastDay,
+        constraints, [&](const Route& route) {
+          int nextIdx = route.destIdx;
+          if (find(path.begin(), path.end(), nextIdx) != path.end()) return;
+          path.push_back(nextIdx);
+          legs.push_back(route);
+          dfs(nextIdx, destIdx, firstDay, lastDay, path, legs, results,
+              maxLegs, constraints);
+          legs.pop_back();
+          path.pop_back();
+        });
+  }
+
+  // Graph::paretoRouteSearch over the shards of one departure window.
+  void paretoSearch(int originIdx, int destIdx, int firstDay, int lastDay,
+                    int maxLegs, ItineraryArena& results,
+                    const SearchConstraints* constraints) {
+    struct Label {
+      int port;
+      int arrStamp;
+      int firstDep;
+      int cost;
+      int legs;
+      int parent;
+      const Route* route;
+      bool dominated;
+    };
+    auto dominates = [](const Label& a, const Label& b) {
+      return a.arrStamp <= b.arrStamp && a.cost <= b.cost &&
+             a.legs <= b.legs && a.firstDep >= b.firstDep;
+    };
 
-      FloatRect bounds = titleText.getLocalBounds();
-      titleText.setOrigin(bounds.left + bounds.width / 2, bounds.top);
-      titleText.setPosition(windowWidth / 2, 40);
-      window.draw(titleText);
+    int n = graph->ports.size();
+    vector<Label> labels;
+    vector<vector<int>> alive(n);
+    priority_queue<pair<int, int>, vector<pair<int, int>>,
+                   greater<pair<int, int>>>
+        open;
+    labels.push_back({originIdx, -INF, INF, 0, 0, -1, nullptr, false});
+    open.push({-INF, 0});
+
+    while (!open.empty()) {
+      int id = open.top().second;
+      open.pop();
+      if (labels[id].dominated || labels[id].legs >= maxLegs) continue;
+      Label cur = labels[id];
+
+      forEachDeparture(
+          cur.port, cur.route, firstDay, lastDay, constraints,
+          [&](const Route& route) {
+            int v = route.destIdx;
+            for (int l = id; l != -1; l = labels[l].parent) {
+              if (labels[l].port == v) return;
+            }
 
-      if (!selectedOptions.empty()) {
-        Text selectionText;
-        selectionText.setFont(*font);
-        selectionText.setCharacterSize(24);
-        selectionText.setFillColor(Color::White);
+            int legCost = route.cost + graph->ports[v].cost;
+            if (constraints) legCost = constraints->weighLeg(legCost, v);
+            Label next = {v,
+                          route.arrStamp,
+                          cur.route ? cur.firstDep : route.depStamp,
+                          cur.cost + legCost,
+                          cur.legs + 1,
+                          id,
+                          &route,
+                          false};
+            for (int other : alive[v]) {
+              if (dominates(labels[other], next)) return;
+            }
 
-        string info = "Selected: ";
-        for (size_t i = 0; i < selectedOptions.size(); i++) {
-          info += selectedOptions[i];
-          if (i < selectedOptions.size() - 1) info += ", ";
-        }
-        selectionText.setString(info);
-        selectionText.setPosition(20, 100);
-        window.draw(selectionText);
+            vector<int> kept;
+            for (int other : alive[v]) {
+              if (dominates(next, labels[other])) {
+                labels[other].dominated = true;
+              } else {
+                kept.push_back(other);
+              }
+            }
+            int nextId = labels.size();
+            labels.push_back(next);
+            kept.push_back(nextId);
+            alive[v].swap(kept);
+            if (v != destIdx) open.push({next.arrStamp, nextId});
+          });
+    }
+
+    for (int id : alive[destIdx]) {
+      vector<int> path;
+      vector<Route> legs;
+      for (int l = id; l != -1; l = labels[l].parent) {
+        path.push_back(labels[l].port);
+        if (labels[l].route) legs.push_back(*labels[l].route);
       }
+      reverse(path.begin(), path.end());
+      reverse(legs.begin(), legs.end());
+      results.add(graph->scoreItinerary(path, legs, constraints), legs);
+    }
+  }
 
-      for (auto btn : buttons) {
-        btn->draw(window);
+ public:
+  // Later legs may leave up to horizon days after the first one. The
+  // horizon is capped so one query's shards always fit in maxResident.
+  RouteShardStore(Graph& g, int horizon = 7, int maxResident = 32,
+                  const string& prefix = "RouteShard_")
+      : graph(&g),
+        syncedChange(0),
+        useCounter(0),
+        queryStart(0),
+        residentLimit(max(1, maxResident)),
+        horizonDays(max(0, min(horizon, max(1, maxResident) - 1))),
+        spillPrefix(prefix) {
+    sync();
+  }
+
+  // Bulk changes may load any number of shards; the limit is restored once
+  // they are applied.
+  void sync() {
+    const vector<GraphChange>& log = graph->changeLog;
+    if (syncedChange == log.size()) return;
+    for (; syncedChange < log.size(); syncedChange++) {
+      const GraphChange& change = log[syncedChange];
+      if (change.type == GraphChange::ROUTE_ADDED) {
+        insert(change.srcIdx, change.route);
+      } else if (change.type == GraphChange::ROUTE_REMOVED) {
+        erase(change.srcIdx, change.route);
+      } else if (change.type == GraphChange::PORT_ADDED) {
+        const string& name = graph->ports[change.srcIdx].name;
+        for (auto& entry : shards) {
+          for (vector<Route>& bucket : entry.second.legs) {
+            for (Route& route : bucket) {
+              if (route.destIdx == -1 && route.destination == name) {
+                route.destIdx = change.srcIdx;
+              }
+            }
+          }
+        }
+      }
+    }
+    trim();
+  }
+
+  void trim() {
+    while (residentCount() > residentLimit) {
+      if (!spillColdest(useCounter)) return;
+    }
+  }
+
+  void evictBefore(const string& date) {
+    int day = toTimestamp(date, "00:00") / (24 * 60);
+    for (auto it = shards.begin(); it != shards.end() && it->first < day;
+         ++it) {
+      if (it->second.resident) spill(it->first, it->second);
+    }
+  }
+
+  // Days on which searchFromDate finds at least one itinerary, from one
+  // connection scan over the shards. Each candidate day keeps the earliest
+  // arrival per port and leg budget; arriving earlier never rules out a
+  // connection, and cutting a loop out of a path only saves legs, so this
+  // matches the search without enumerating anything.
+  vector<string> departureDates(
+      int originIdx, int destIdx,
+      const SearchOptions& options = SearchOptions()) {
+    sync();
+    vector<string> dates;
+    int n = graph->ports.size();
+    if (originIdx < 0 || originIdx >= n || destIdx < 0 || destIdx >= n ||
+        originIdx == destIdx) {
+      return dates;
+    }
+    const SearchConstraints* constraints = options.constraints;
+    if (constraints && !constraints->allowsPort(originIdx)) return dates;
+    int maxLegs = max(0, options.maxLayovers) + 1;
+
+    // arrivals[day][k * n + v]: earliest arrival at v within k legs on an
+    // itinerary whose first leg left on day.
+    map<int, vector<int>> arrivals;
+    set<int> reached;
+    vector<pair<int, const Route*>> legs;
+    for (auto it = shards.begin(); it != shards.end(); ++it) {
+      int day = it->first;
+      while (!arrivals.empty() &&
+             arrivals.begin()->first + horizonDays < day) {
+        arrivals.erase(arrivals.begin());
+      }
+      queryStart = useCounter;
+      RouteShard& shard = touch(it);
+      if (shard.departures[originIdx] > 0) {
+        arrivals[day].assign(n * maxLegs, INF);
+      }
+      if (arrivals.empty()) continue;
+
+      legs.clear();
+      for (int u = 0; u < shard.legs.size(); u++) {
+        if (u == destIdx) continue;
+        for (const Route& route : shard.legs[u]) legs.push_back({u, &route});
+      }
+      stable_sort(legs.begin(), legs.end(),
+                  [](const pair<int, const Route*>& a,
+                     const pair<int, const Route*>& b) {
+                    return a.second->depStamp < b.second->depStamp;
+                  });
+
+      for (const auto& entry : legs) {
+        int u = entry.first;
+        const Route& route = *entry.second;
+        int v = route.destIdx;
+        if (v == -1 || v == originIdx) continue;
+        if (constraints && !constraints->allowsLeg(route)) continue;
+        int wait = max(1, graph->ports[u].minConnectionTime);
+        for (auto& start : arrivals) {
+          if (reached.count(start.first)) continue;
+          vector<int>& arrival = start.second;
+          int used = 0;
+          if (u == originIdx) {
+            if (start.first != day) continue;
+            used = 1;
+          } else {
+            for (int k = 1; k < maxLegs && !used; k++) {
+              if (arrival[k * n + u] <= route.depStamp - wait) used = k + 1;
+            }
+            if (!used) continue;
+          }
+          if (v == destIdx) {
+            reached.insert(start.first);
+            continue;
+          }
+          for (int k = used; k < maxLegs; k++) {
+            int& best = arrival[k * n + v];
+            best = min(best, route.arrStamp);
+          }
+        }
       }
     }
+    for (int day : reached) dates.push_back(daysToDate(day));
+    trim();
+    return dates;
   }
 
-  int checkClick(RenderWindow& window, Event& event,
-                 const vector<string>& options) {
-    if (!isVisible) return -1;
+  // Itineraries whose first leg leaves on date, with later legs taken from
+  // at most horizonDays of following shards. Like Graph::searchRoutes it
+  // falls back to a Pareto search when enumerating would explode.
+  void searchFromDate(int originIdx, int destIdx, const string& date,
+                      ItineraryArena& results,
+                      const SearchOptions& options = SearchOptions()) {
+    sync();
+    int n = graph->ports.size();
+    int stamp = toTimestamp(date, "00:00");
+    if (stamp == 0 || originIdx < 0 || originIdx >= n || destIdx < 0 ||
+        destIdx >= n || originIdx == destIdx) {
+      return;
+    }
+    const SearchConstraints* constraints = options.constraints;
+    if (constraints && !constraints->allowsPort(originIdx)) return;
 
-    for (int i = 0; i < buttons.size(); i++) {
-      if (buttons[i]->isClicked(window, event)) {
-        string buttonText = buttons[i]->text.getString();
+    int firstDay = stamp / (24 * 60);
+    int lastDay = firstDay + horizonDays;
+    int maxLegs = max(0, options.maxLayovers) + 1;
+    queryStart = useCounter;
+    if (graph->selectStrategy(originIdx, options) == SearchOptions::PARETO) {
+      paretoSearch(originIdx, destIdx, firstDay, lastDay, maxLegs, results,
+                   constraints);
+    } else {
+      vector<int> path = {originIdx};
+      vector<Route> legs;
+      dfs(originIdx, destIdx, firstDay, lastDay, path, legs, results,
+          maxLegs, constraints);
+    }
+    trim();
+  }
 
-        if (!options.empty() && i < options.size()) {
-          toggleOption(options[i]);
-          return i;
-        }
+  size_t shardCount() const { return shards.size(); }
 
-        if (buttonText == "Select All") {
-          return -2;
+  size_t residentCount() const {
+    size_t count = 0;
+    for (const auto& entry : shards) count += entry.second.resident;
+    return count;
+  }
+};
+
+// Membership bitsets for the subgraph views, built once from the edge table
+// and port weather masks so a selection is just an OR over the chosen rows.
+class SubgraphIndex {
+ public:
+  struct Selection {
+    vector<uint64_t> ports;
+    vector<uint64_t> edges;
+  };
+
+  // Indexed by company id or weather id.
+  vector<vector<uint64_t>> companyEdges;
+  vector<vector<uint64_t>> companyPorts;
+  vector<vector<uint64_t>> weatherPorts;
+  vector<vector<uint64_t>> weatherEdges;
+
+  void build(const Graph& g) {
+    graph = &g;
+    builtChange = g.getChangeCount();
+    const EdgeTable& table = g.edgeTable;
+    size_t portWords = (g.ports.size() + 63) / 64;
+    size_t edgeWords = table.words();
+
+    companyEdges.assign(g.companyNames.size(), vector<uint64_t>(edgeWords));
+    companyPorts.assign(g.companyNames.size(), vector<uint64_t>(portWords));
+    weatherPorts.assign(g.weatherNames.size(), vector<uint64_t>(portWords));
+    weatherEdges.assign(g.weatherNames.size(), vector<uint64_t>(edgeWords));
+
+    for (int p = 0; p < g.ports.size(); p++) {
+      for (unsigned m = g.ports[p].weatherMask; m; m &= m - 1) {
+        setBit(weatherPorts[__builtin_ctz(m)], p);
+      }
+    }
+
+    for (size_t w = 0; w < table.alive.size(); w++) {
+      for (uint64_t live = table.alive[w]; live; live &= live - 1) {
+        int e = w * 64 + __builtin_ctzll(live);
+        int src = table.srcId[e];
+        int dst = table.dstId[e];
+        int company = table.companyId[e];
+        setBit(companyEdges[company], e);
+        setBit(companyPorts[company], src);
+        if (dst == -1) continue;
+        setBit(companyPorts[company], dst);
+
+        unsigned weather = g.ports[src].weatherMask | g.ports[dst].weatherMask;
+        for (; weather; weather &= weather - 1) {
+          setBit(weatherEdges[__builtin_ctz(weather)], e);
         }
-        if (buttonText == "Clear All") {
-          return -3;
+      }
+    }
+  }
+
+  void refresh(const Graph& g) {
+    if (graph != &g || builtChange != g.getChangeCount()) build(g);
+  }
+
+  // Ports and edges used by any of the given companies.
+  Selection selectCompanies(const vector<string>& companies) const {
+    Selection sel = emptySelection();
+    for (const string& company : companies) {
+      int id = graph->getCompanyId(company);
+      if (id == -1 || id >= companyEdges.size()) continue;
+      orInto(sel.ports, companyPorts[id]);
+      orInto(sel.edges, companyEdges[id]);
+    }
+    return sel;
+  }
+
+  // Ports free of every given condition, and edges with neither end hit.
+  Selection selectAvoidingWeather(const vector<string>& conditions) const {
+    Selection banned = emptySelection();
+    for (const string& weather : conditions) {
+      int id = graph->getWeatherId(weather);
+      if (id == -1 || id >= weatherPorts.size()) continue;
+      orInto(banned.ports, weatherPorts[id]);
+      orInto(banned.edges, weatherEdges[id]);
+    }
+
+    Selection sel = emptySelection();
+    for (int p = 0; p < graph->ports.size(); p++) setBit(sel.ports, p);
+    for (size_t w = 0; w < sel.ports.size(); w++) {
+      sel.ports[w] &= ~banned.ports[w];
+    }
+    for (size_t w = 0; w < sel.edges.size(); w++) {
+      sel.edges[w] = graph->edgeTable.alive[w] & ~banned.edges[w];
+    }
+    return sel;
+  }
+
+ private:
+  const Graph* graph = nullptr;
+  size_t builtChange = 0;
+
+  static void setBit(vector<uint64_t>& bits, int idx) {
+    bits[idx / 64] |= uint64_t(1) << (idx % 64);
+  }
+
+  static void orInto(vector<uint64_t>& dst, const vector<uint64_t>& src) {
+    for (size_t w = 0; w < dst.size(); w++) dst[w] |= src[w];
+  }
+
+  Selection emptySelection() const {
+    Selection sel;
+    sel.ports.assign((graph->ports.size() + 63) / 64, 0);
+    sel.edges.assign(graph->edgeTable.words(), 0);
+    return sel;
+  }
+};
+
+class Button {
+ public:
+  RectangleShape shape;
+  Text text;
+  Color normalColor;
+  Color hoverColor;
+  Color clickColor;
+  Button(Vector2f position, Vector2f size, string buttonText, Font& font) {
+    shape.setSize(size);
+    shape.setPosition(position);
+
+    normalColor = Color(70, 130, 180);
+    hoverColor = Color(100, 160, 210);
+    clickColor = Color(50, 100, 150);
+    shape.setFillColor(normalColor);
+    shape.setOutlineThickness(2);
+    shape.setOutlineColor(Color::White);
+
+    text.setFont(font);
+    text.setString(buttonText);
+    text.setCharacterSize(24);
+    text.setFillColor(Color::White);
+
+    FloatRect textBounds = text.getLocalBounds();
+    text.setOrigin(textBounds.left + textBounds.width / 2.0f,
+                   textBounds.top + textBounds.height / 2.0f);
+    text.setPosition(position.x + size.x / 2.0f, position.y + size.y / 2.0f);
+  }
+  void setPosition(const sf::Vector2f& pos) {
+    shape.setPosition(pos);
+    FloatRect bounds = text.getLocalBounds();
+    text.setPosition(
+        pos.x + (shape.getSize().x - bounds.width) / 2.0f,
+        pos.y + (shape.getSize().y - bounds.height) / 2.0f - bounds.top);
+  }
+  void setText(const string& newText) {
+    text.setString(newText);
+    FloatRect textBounds = text.getLocalBounds();
+    text.setOrigin(textBounds.left + textBounds.width / 2.0f,
+                   textBounds.top + textBounds.height / 2.0f);
+
+    Vector2f shapePos = shape.getPosition();
+    Vector2f shapeSize = shape.getSize();
+    text.setPosition(shapePos.x + shapeSize.x / 2.0f,
+                     shapePos.y + shapeSize.y / 2.0f);
+  }
+
+  void draw(RenderWindow& window) {
+    window.draw(shape);
+    window.draw(text);
+  }
+
+  bool isMouseOver(RenderWindow& window) {
+    Vector2i mousePos = Mouse::getPosition(window);
+    FloatRect bounds = shape.getGlobalBounds();
+    return bounds.contains(static_cast<Vector2f>(mousePos));
+  }
+
+  void update(RenderWindow& window) {
+    if (isMouseOver(window)) {
+      if (Mouse::isButtonPressed(Mouse::Left)) {
+        shape.setFillColor(clickColor);
+      } else {
+        shape.setFillColor(hoverColor);
+      }
+    } else {
+      shape.setFillColor(normalColor);
+    }
+  }
+
+  bool isClicked(RenderWindow& window, Event& event) {
+    if (event.type == Event::MouseButtonReleased &&
+        event.mouseButton.button == Mouse::Left) {
+      return isMouseOver(window);
+    }
+    return false;
+  }
+};
+class SubgraphMenu {
+ public:
+  vector<Button*> buttons;
+  Text titleText;
+  bool isVisible;
+  Font* font;
+  float windowWidth;
+  float windowHeight;
+  Texture* oceanTexture;
+  Sprite oceanBackground;
+  vector<string> selectedOptions;
+  enum SubgraphMode { COMPANY_MODE, WEATHER_MODE };
+  SubgraphMode currentMode;
+  SubgraphMenu(Font& f, float winWidth, float winHeight, Texture& oceanTex)
+      : font(&f),
+        isVisible(false),
+        windowWidth(winWidth),
+        windowHeight(winHeight),
+        oceanTexture(&oceanTex),
+        currentMode(COMPANY_MODE) {
+    titleText.setFont(f);
+    titleText.setCharacterSize(48);
+    titleText.setFillColor(Color::White);
+    titleText.setOutlineThickness(2);
+    titleText.setOutlineColor(Color::Black);
+    oceanBackground.setTexture(*oceanTexture);
+    Vector2u textureSize = oceanTexture->getSize();
+    float scaleX = (float)winWidth / textureSize.x;
+    float scaleY = (float)winHeight / textureSize.y;
+    oceanBackground.setScale(scaleX, scaleY);
+  }
+
+  ~SubgraphMenu() { clearButtons(); }
+
+  void clearButtons() {
+    for (auto btn : buttons) {
+      delete btn;
+    }
+    buttons.clear();
+  }
+
+  void createMainMenu() {
+    clearButtons();
+    titleText.setString("Generate Subgraph");
+    selectedOptions.clear();
+
+    float buttonWidth = 400;
+    float buttonHeight = 70;
+    float centerX = (windowWidth - buttonWidth) / 2;
+    float startY = windowHeight * 0.2f;
+    float spacing = buttonHeight + 15;
+
+    buttons.push_back(new Button(Vector2f(centerX, startY),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Based on Company", *font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Based on Weather Conditions", *font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 4),
+                                 Vector2f(buttonWidth, buttonHeight), "Back",
+                                 *font));
+  }
+
+  void createCompanyMenu(const vector<string>& companies) {
+    clearButtons();
+    titleText.setString("Select Companies");
+    currentMode = COMPANY_MODE;
+
+    float buttonWidth = 250;
+    float buttonHeight = 60;
+    float startX = 100;
+    float startY = windowHeight * 0.15f;
+    float spacingX = buttonWidth + 30;
+    float spacingY = buttonHeight + 20;
+
+    int cols = 4;
+    int col = 0;
+    int row = 0;
+
+    for (const string& company : companies) {
+      float x = startX + (col * spacingX);
+      float y = startY + (row * spacingY);
+
+      Button* btn = new Button(
+          Vector2f(x, y), Vector2f(buttonWidth, buttonHeight), company, *font);
+      for (const string& selected : selectedOptions) {
+        if (selected == company) {
+          btn->shape.setFillColor(Color(0, 150, 0));
+          break;
         }
-        if (buttonText == "Done") {
-          return -4;
+      }
+      buttons.push_back(btn);
+
+      col++;
+      if (col >= cols) {
+        col = 0;
+        row++;
+      }
+    }
+    float actionY = startY + ((row + 1) * spacingY) + 40;
+    float centerX = (windowWidth - 250) / 2;
+
+    buttons.push_back(new Button(Vector2f(centerX - 270, actionY),
+                                 Vector2f(250, 60), "Select All", *font));
+    buttons.push_back(new Button(Vector2f(centerX, actionY), Vector2f(250, 60),
+                                 "Clear All", *font));
+    buttons.push_back(new Button(Vector2f(centerX + 270, actionY),
+                                 Vector2f(250, 60), "Done", *font));
+  }
+
+  void createWeatherMenu(const vector<string>& weatherConditions) {
+    clearButtons();
+    titleText.setString("Select Weather to AVOID");
+    currentMode = WEATHER_MODE;
+
+    float buttonWidth = 250;
+    float buttonHeight = 60;
+    float startX = 100;
+    float startY = windowHeight * 0.15f;
+    float spacingX = buttonWidth + 30;
+    float spacingY = buttonHeight + 20;
+
+    int cols = 3;
+    int col = 0;
+    int row = 0;
+
+    vector<string> weatherDisplayNames = {
+        "Cyclone", "Fog", "Heavy Rain", "High Wind", "Snow", "Storm", "Clear"};
+
+    for (size_t i = 0; i < weatherConditions.size(); i++) {
+      float x = startX + (col * spacingX);
+      float y = startY + (row * spacingY);
+
+      string displayName = (i < weatherDisplayNames.size())
+                               ? weatherDisplayNames[i]
+                               : weatherConditions[i];
+      Button* btn =
+          new Button(Vector2f(x, y), Vector2f(buttonWidth, buttonHeight),
+                     displayName, *font);
+      for (const string& selected : selectedOptions) {
+        if (selected == weatherConditions[i]) {
+          btn->shape.setFillColor(Color(150, 0, 0));
+          break;
         }
+      }
+      buttons.push_back(btn);
+
+      col++;
+      if (col >= cols) {
+        col = 0;
+        row++;
+      }
+    }
+
+    float actionY = startY + ((row + 1) * spacingY) + 40;
+    float centerX = (windowWidth - 250) / 2;
+
+    buttons.push_back(new Button(Vector2f(centerX - 270, actionY),
+                                 Vector2f(250, 60), "Select All", *font));
+    buttons.push_back(new Button(Vector2f(centerX, actionY), Vector2f(250, 60),
+                                 "Clear All", *font));
+    buttons.push_back(new Button(Vector2f(centerX + 270, actionY),
+                                 Vector2f(250, 60), "Done", *font));
+  }
+
+  void toggleOption(const string& option) {
+    auto it = find(selectedOptions.begin(), selectedOptions.end(), option);
+    if (it == selectedOptions.end()) {
+      selectedOptions.push_back(option);
+    } else {
+      selectedOptions.erase(it);
+    }
+  }
+
+  void selectAll(const vector<string>& allOptions) {
+    selectedOptions = allOptions;
+  }
+
+  void clearAll() { selectedOptions.clear(); }
+
+  void show() {
+    isVisible = true;
+    createMainMenu();
+  }
+
+  void hide() {
+    isVisible = false;
+    clearButtons();
+  }
+
+  bool visible() const { return isVisible; }
+
+  void update(RenderWindow& window) {
+    if (isVisible) {
+      for (auto btn : buttons) {
+        btn->update(window);
+      }
+    }
+  }
+
+  void draw(RenderWindow& window) {
+    if (isVisible) {
+      window.draw(oceanBackground);
+      RectangleShape overlay(Vector2f(windowWidth, windowHeight));
+      overlay.setFillColor(Color(0, 0, 0, 100));
+      window.draw(overlay);
+
+      FloatRect bounds = titleText.getLocalBounds();
+      titleText.setOrigin(bounds.left + bounds.width / 2, bounds.top);
+      titleText.setPosition(windowWidth / 2, 40);
+      window.draw(titleText);
+
+      if (!selectedOptions.empty()) {
+        Text selectionText;
+        selectionText.setFont(*font);
+        selectionText.setCharacterSize(24);
+        selectionText.setFillColor(Color::White);
+
+        string info = "Selected: ";
+        for (size_t i = 0; i < selectedOptions.size(); i++) {
+          info += selectedOptions[i];
+          if (i < selectedOptions.size() - 1) info += ", ";
+        }
+        selectionText.setString(info);
+        selectionText.setPosition(20, 100);
+        window.draw(selectionText);
+      }
+
+      for (auto btn : buttons) {
+        btn->draw(window);
+      }
+    }
+  }
+
+  int checkClick(RenderWindow& window, Event& event,
+                 const vector<string>& options) {
+    if (!isVisible) return -1;
+
+    for (int i = 0; i < buttons.size(); i++) {
+      if (buttons[i]->isClicked(window, event)) {
+        string buttonText = buttons[i]->text.getString();
+
+        if (!options.empty() && i < options.size()) {
+          toggleOption(options[i]);
+          return i;
+        }
+
+        if (buttonText == "Select All") {
+          return -2;
+        }
+        if (buttonText == "Clear All") {
+          return -3;
+        }
+        if (buttonText == "Done") {
+          return -4;
+        }
+
+        if (buttonText == "Based on Company") {
+          return 0;
+        }
+        if (buttonText == "Based on Weather Conditions") {
+          return 1;
+        }
+        if (buttonText == "Back") {
+          return 3;
+        }
+
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  bool isOptionSelected(const string& option) const {
+    return find(selectedOptions.begin(), selectedOptions.end(), option) !=
+           selectedOptions.end();
+  }
+
+  vector<string> getSelectedOptions() const { return selectedOptions; }
+  SubgraphMode getCurrentMode() const { return currentMode; }
+};
+class InfoWindow {
+ private:
+  RectangleShape background;
+  RectangleShape titleBar;
+  Text titleText;
+  vector<Text> contentLines;
+  Button* closeButton;
+  bool isVisible;
+  Font* font;
+  float scrollOffset;
+  float maxScrollOffset;
+  float windowWidth;
+  float windowHeight;
+
+ public:
+  InfoWindow(Font& f, float winWidth, float winHeight)
+      : font(&f),
+        isVisible(false),
+        closeButton(nullptr),
+        scrollOffset(0),
+        maxScrollOffset(0),
+        windowWidth(winWidth),
+        windowHeight(winHeight) {
+    float infoWidth = windowWidth * 0.5f;
+    float infoHeight = windowHeight * 0.7f;
+    float infoX = (windowWidth - infoWidth) / 2;
+    float infoY = (windowHeight - infoHeight) / 2;
+
+    background.setSize(Vector2f(infoWidth, infoHeight));
+    background.setPosition(infoX, infoY);
+    background.setFillColor(Color(240, 240, 240));
+    background.setOutlineThickness(3);
+    background.setOutlineColor(Color(50, 50, 50));
+
+    titleBar.setSize(Vector2f(infoWidth, 50));
+    titleBar.setPosition(infoX, infoY);
+    titleBar.setFillColor(Color(70, 130, 180));
+
+    titleText.setFont(f);
+    titleText.setCharacterSize(24);
+    titleText.setFillColor(Color::White);
+    titleText.setPosition(infoX + 10, infoY + 13);
+
+    closeButton = new Button(Vector2f(infoX + infoWidth - 45, infoY + 5),
+                             Vector2f(40, 40), "X", f);
+  }
+
+  ~InfoWindow() { delete closeButton; }
+
+  void show(const string& portName, const vector<string>& info) {
+    isVisible = true;
+    scrollOffset = 0;
+    titleText.setString(portName + " - Information");
+
+    contentLines.clear();
+    float infoWidth = windowWidth * 0.5f;
+    float infoHeight = windowHeight * 0.7f;
+    float infoX = (windowWidth - infoWidth) / 2;
+    float infoY = (windowHeight - infoHeight) / 2;
+    float yPos = infoY + 70;
+
+    for (const string& line : info) {
+      Text text;
+      text.setFont(*font);
+      text.setString(line);
+      text.setCharacterSize(18);
+      text.setFillColor(Color::Black);
+      text.setPosition(infoX + 15, yPos);
+      contentLines.push_back(text);
+      yPos += 28;
+    }
+    float contentHeight = contentLines.size() * 28;
+    float visibleHeight = infoHeight - 80;
+    maxScrollOffset = max(0.0f, contentHeight - visibleHeight);
+  }
+
+  void hide() {
+    isVisible = false;
+    contentLines.clear();
+    scrollOffset = 0;
+    maxScrollOffset = 0;
+  }
+
+  bool checkClose(RenderWindow& window, Event& event) {
+    if (isVisible && closeButton->isClicked(window, event)) {
+      hide();
+      return true;
+    }
+    return false;
+  }
+
+  void scroll(float delta) {
+    if (!isVisible) return;
+
+    scrollOffset -= delta * 30.0f;
+    if (scrollOffset < 0) scrollOffset = 0;
+    if (scrollOffset > maxScrollOffset) scrollOffset = maxScrollOffset;
+  }
+
+  void update(RenderWindow& window) {
+    if (isVisible) {
+      closeButton->update(window);
+    }
+  }
+
+  void draw(RenderWindow& window) {
+    if (!isVisible) return;
+
+    float infoWidth = windowWidth * 0.5f;
+    float infoHeight = windowHeight * 0.7f;
+    float infoX = (windowWidth - infoWidth) / 2;
+    float infoY = (windowHeight - infoHeight) / 2;
+
+    background.setSize(Vector2f(infoWidth, infoHeight));
+    background.setPosition(infoX, infoY);
+
+    titleBar.setSize(Vector2f(infoWidth, 50));
+    titleBar.setPosition(infoX, infoY);
+
+    titleText.setPosition(infoX + 10, infoY + 13);
+
+    window.draw(background);
+    window.draw(titleBar);
+    window.draw(titleText);
+    closeButton->draw(window);
+
+    float visibleTop = infoY + 60;
+    float visibleBottom = infoY + infoHeight - 20;
+
+    for (auto& line : contentLines) {
+      Vector2f orig = line.getPosition();
+      float newY = orig.y - scrollOffset;
+
+      if (newY >= visibleTop && newY <= visibleBottom) {
+        line.setPosition(orig.x, newY);
+        window.draw(line);
+        line.setPosition(orig);
+      }
+    }
+
+    if (maxScrollOffset > 0) {
+      float trackX = infoX + infoWidth - 16;
+      float trackY = infoY + 60;
+      float trackH = infoHeight - 80;
+
+      RectangleShape track(Vector2f(8, trackH));
+      track.setPosition(trackX, trackY);
+      track.setFillColor(Color(200, 200, 200));
+      track.setOutlineColor(Color(120, 120, 120));
+      track.setOutlineThickness(1);
+      window.draw(track);
+
+      float ratio = trackH / (trackH + maxScrollOffset);
+      float thumbH = max(35.0f, trackH * ratio);
+
+      float thumbY =
+          trackY + (scrollOffset * (trackH - thumbH) / maxScrollOffset);
+
+      RectangleShape thumb(Vector2f(8, thumbH));
+      thumb.setPosition(trackX, thumbY);
+      thumb.setFillColor(Color(100, 100, 100));
+      window.draw(thumb);
+    }
+  }
+
+  bool visible() const { return isVisible; }
+  void handleResize(float newWidth, float newHeight) {
+    windowWidth = newWidth;
+    windowHeight = newHeight;
+    float width = windowWidth * 0.45f;
+    float height = windowHeight * 0.70f;
+    float x = (windowWidth - width) / 2;
+    float y = (windowHeight - height) / 2;
+
+    background.setSize(Vector2f(width, height));
+    background.setPosition(x, y);
+    titleBar.setSize(Vector2f(width, 50));
+    titleBar.setPosition(x, y);
+    titleText.setPosition(x + 10, y + 13);
+
+    if (closeButton) {
+      closeButton->setPosition(Vector2f(x + width - 45, y + 5));
+    }
+  }
+  bool isMouseOverWindow(RenderWindow& window) const {
+    if (!isVisible) return false;
+    Vector2i mousePos = Mouse::getPosition(window);
+    float infoWidth = windowWidth * 0.5f;
+    float infoHeight = windowHeight * 0.7f;
+    float infoX = (windowWidth - infoWidth) / 2;
+    float infoY = (windowHeight - infoHeight) / 2;
+    FloatRect bounds(infoX, infoY, infoWidth, infoHeight);
+    return bounds.contains(static_cast<Vector2f>(mousePos));
+  }
+};
+class Location {
+ public:
+  CircleShape pin;
+  Text label;
+  string name;
+  Vector2f position;
+  Color normalColor;
+  Color hoverColor;
+
+  Location(string portName, Vector2f pos, Font& font) {
+    name = portName;
+    position = pos;
+
+    normalColor = Color(220, 50, 50);
+    hoverColor = Color(255, 100, 100);
+
+    label.setFont(font);
+    label.setString(portName);
+    label.setCharacterSize(20);
+    label.setOutlineThickness(2);
+    label.setOutlineColor(Color::Black);
+
+    FloatRect textBounds = label.getLocalBounds();
+    label.setOrigin(textBounds.left + textBounds.width / 2,
+                    textBounds.top + textBounds.height);
+    resetAppearance();
+    moveTo(pos);
+  }
+
+  void moveTo(Vector2f pos) {
+    position = pos;
+    pin.setPosition(pos);
+    label.setPosition(pos.x, pos.y - 30);
+  }
+
+  void resetAppearance() {
+    pin.setRadius(18);
+    pin.setOrigin(18, 18);
+    pin.setFillColor(normalColor);
+    pin.setOutlineThickness(3);
+    pin.setOutlineColor(Color::White);
+    label.setFillColor(Color::White);
+  }
+
+  bool isMouseOver(RenderWindow& window) {
+    Vector2f mousePos = window.mapPixelToCoords(Mouse::getPosition(window));
+    FloatRect bounds = pin.getGlobalBounds();
+    return bounds.contains(mousePos);
+  }
+
+  bool isClicked(RenderWindow& window, Event& event) {
+    if (event.type == Event::MouseButtonReleased &&
+        event.mouseButton.button == Mouse::Left) {
+      return isMouseOver(window);
+    }
+    return false;
+  }
+
+  bool update(RenderWindow& window) {
+    bool hovered = isMouseOver(window);
+    setHovered(hovered);
+    return hovered;
+  }
+
+  void setHovered(bool hovered) {
+    if (hovered) {
+      pin.setFillColor(hoverColor);
+      pin.setRadius(22);
+      pin.setOrigin(22, 22);
+    } else {
+      pin.setFillColor(normalColor);
+      pin.setRadius(18);
+      pin.setOrigin(18, 18);
+    }
+  }
+
+  void draw(RenderTarget& window) {
+    window.draw(pin);
+    window.draw(label);
+  }
+  bool isAllowed() const {
+    Color color = pin.getFillColor();
+    return (color.r > 200 && color.g > 200 && color.b < 100);
+  }
+};
+
+class NavigationMenu {
+ private:
+  vector<Button*> buttons;
+  bool isVisible;
+  Text titleText;
+  float windowWidth;
+  float windowHeight;
+
+ public:
+  NavigationMenu(Font& font, float winWidth, float winHeight)
+      : isVisible(false), windowWidth(winWidth), windowHeight(winHeight) {
+    titleText.setFont(font);
+    titleText.setString("Route Navigation System");
+    titleText.setCharacterSize(48);
+    titleText.setFillColor(Color::White);
+    titleText.setOutlineThickness(2);
+    titleText.setOutlineColor(Color::Black);
+
+    FloatRect textBounds = titleText.getLocalBounds();
+    titleText.setOrigin(textBounds.left + textBounds.width / 2.0f,
+                        textBounds.top + textBounds.height / 2.0f);
+    titleText.setPosition(windowWidth / 2, windowHeight * 0.08f);
+
+    float buttonWidth = 400;
+    float buttonHeight = 70;
+    float centerX = (windowWidth - buttonWidth) / 2;
+    float startY = windowHeight * 0.18f;
+    float spacing = buttonHeight + 15;
+
+    buttons.push_back(new Button(Vector2f(centerX, startY),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Search for Routes", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Book Cargo Routes", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 2),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Display Ports Info", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 3),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Shortest Route", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 4),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Cheapest Route", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 5),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Generate Subgraphs", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 6),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Process Layovers", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 7),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Track Multi-Leg Journeys", font));
+    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 8.5f),
+                                 Vector2f(buttonWidth, buttonHeight),
+                                 "Back to Main Menu", font));
+  }
 
-        if (buttonText == "Based on Company") {
-          return 0;
-        }
-        if (buttonText == "Based on Weather Conditions") {
-          return 1;
-        }
-        if (buttonText == "Back") {
-          return 3;
-        }
+  ~NavigationMenu() {
+    for (auto btn : buttons) {
+      delete btn;
+    }
+  }
+
+  void show() { isVisible = true; }
 
+  void hide() { isVisible = false; }
+
+  bool visible() const { return isVisible; }
+
+  void update(RenderWindow& window) {
+    if (isVisible) {
+      for (auto btn : buttons) {
+        btn->update(window);
+      }
+    }
+  }
+
+  void draw(RenderWindow& window) {
+    if (isVisible) {
+      window.draw(titleText);
+      for (auto btn : buttons) {
+        btn->draw(window);
+      }
+    }
+  }
+
+  int checkClick(RenderWindow& window, Event& event) {
+    if (!isVisible) return -1;
+
+    for (int i = 0; i < buttons.size(); i++) {
+      if (buttons[i]->isClicked(window, event)) {
         return i;
       }
     }
     return -1;
   }
+  void handleResize(float newWidth, float newHeight) {
+    windowWidth = newWidth;
+    windowHeight = newHeight;
 
-  bool isOptionSelected(const string& option) const {
-    return find(selectedOptions.begin(), selectedOptions.end(), option) !=
-           selectedOptions.end();
-  }
+    FloatRect textBounds = titleText.getLocalBounds();
+    titleText.setOrigin(textBounds.left + textBounds.width / 2.0f,
+                        textBounds.top + textBounds.height / 2.0f);
+    titleText.setPosition(windowWidth / 2, windowHeight * 0.08f);
 
-  vector<string> getSelectedOptions() const { return selectedOptions; }
-  SubgraphMode getCurrentMode() const { return currentMode; }
+    float buttonWidth = 400;
+    float buttonHeight = 70;
+    float centerX = (windowWidth - buttonWidth) / 2;
+    float startY = windowHeight * 0.18f;
+    float spacing = buttonHeight + 15;
+
+    for (int i = 0; i < buttons.size(); i++) {
+      float yPos = startY + (i * spacing);
+      if (i == buttons.size() - 1) {
+        yPos = startY + (8.5f * spacing);
+      }
+      buttons[i]->setPosition(Vector2f(centerX, yPos));
+    }
+  }
 };
-class InfoWindow {
+
+class RouteTooltip {
  private:
   RectangleShape background;
-  RectangleShape titleBar;
-  Text titleText;
-  vector<Text> contentLines;
-  Button* closeButton;
+  vector<Text> lines;
+  Font* font;
   bool isVisible;
+
+ public:
+  RouteTooltip(Font& f) : font(&f), isVisible(false) {
+    background.setFillColor(Color(40, 40, 40, 230));
+    background.setOutlineThickness(2);
+    background.setOutlineColor(Color(255, 165, 0));
+  }
+
+  void show(Vector2f mousePos, const vector<string>& details) {
+    isVisible = true;
+    lines.clear();
+
+    float maxWidth = 0;
+    float yOffset = 5;
+
+    for (const string& detail : details) {
+      Text text;
+      text.setFont(*font);
+      text.setString(detail);
+      text.setCharacterSize(14);
+      text.setFillColor(Color::White);
+
+      FloatRect bounds = text.getLocalBounds();
+      if (bounds.width > maxWidth) maxWidth = bounds.width;
+
+      text.setPosition(mousePos.x + 15, mousePos.y + yOffset);
+      lines.push_back(text);
+      yOffset += 18;
+    }
+
+    background.setSize(Vector2f(maxWidth + 20, yOffset + 5));
+    background.setPosition(mousePos.x + 10, mousePos.y);
+  }
+
+  void hide() {
+    isVisible = false;
+    lines.clear();
+  }
+
+  void draw(RenderWindow& window) {
+    if (isVisible) {
+      window.draw(background);
+      for (auto& line : lines) {
+        window.draw(line);
+      }
+    }
+  }
+
+  bool visible() const { return isVisible; }
+};
+class FilterSidebar {
+ private:
+  RectangleShape background;
+  RectangleShape header;
+  Text headerText;
+  vector<Button*> filterButtons;
   Font* font;
-  float scrollOffset;
-  float maxScrollOffset;
+  bool isVisible;
+  bool isExpanded;
+  float sidebarWidth;
+  float sidebarHeight;
   float windowWidth;
   float windowHeight;
 
+  Button* toggleButton;
+
+  Text companiesHeader;
+  Text portsHeader;
+  Text timeHeader;
+
+  vector<Text> selectionTexts;
+
  public:
-  InfoWindow(Font& f, float winWidth, float winHeight)
+  FilterSidebar(Font& f, float winWidth, float winHeight)
       : font(&f),
         isVisible(false),
-        closeButton(nullptr),
-        scrollOffset(0),
-        maxScrollOffset(0),
+        isExpanded(true),
         windowWidth(winWidth),
         windowHeight(winHeight) {
-    float infoWidth = windowWidth * 0.5f;
-    float infoHeight = windowHeight * 0.7f;
-    float infoX = (windowWidth - infoWidth) / 2;
-    float infoY = (windowHeight - infoHeight) / 2;
+    sidebarWidth = 280;
+    sidebarHeight = winHeight;
 
-    background.setSize(Vector2f(infoWidth, infoHeight));
-    background.setPosition(infoX, infoY);
-    background.setFillColor(Color(240, 240, 240));
+    background.setSize(Vector2f(sidebarWidth, sidebarHeight));
+    background.setPosition(0, 0);
+    background.setFillColor(Color(40, 40, 40, 230));
     background.setOutlineThickness(3);
-    background.setOutlineColor(Color(50, 50, 50));
+    background.setOutlineColor(Color(100, 100, 100));
 
-    titleBar.setSize(Vector2f(infoWidth, 50));
-    titleBar.setPosition(infoX, infoY);
-    titleBar.setFillColor(Color(70, 130, 180));
+    header.setSize(Vector2f(sidebarWidth, 60));
+    header.setPosition(0, 0);
+    header.setFillColor(Color(70, 130, 180));
 
-    titleText.setFont(f);
-    titleText.setCharacterSize(24);
-    titleText.setFillColor(Color::White);
-    titleText.setPosition(infoX + 10, infoY + 13);
+    headerText.setFont(f);
+    headerText.setString("Filter Options");
+    headerText.setCharacterSize(24);
+    headerText.setFillColor(Color::White);
+    headerText.setPosition(15, 18);
 
-    closeButton = new Button(Vector2f(infoX + infoWidth - 45, infoY + 5),
-                             Vector2f(40, 40), "X", f);
+    toggleButton =
+        new Button(Vector2f(sidebarWidth - 50, 10), Vector2f(40, 40), "<", f);
+
+    setupButtons();
   }
 
-  ~InfoWindow() { delete closeButton; }
+  ~FilterSidebar() {
+    delete toggleButton;
+    for (auto btn : filterButtons) {
+      delete btn;
+    }
+  }
 
-  void show(const string& portName, const vector<string>& info) {
-    isVisible = true;
-    scrollOffset = 0;
-    titleText.setString(portName + " - Information");
+  void setupButtons() {
+    for (auto btn : filterButtons) {
+      delete btn;
+    }
+    filterButtons.clear();
 
-    contentLines.clear();
-    float infoWidth = windowWidth * 0.5f;
-    float infoHeight = windowHeight * 0.7f;
-    float infoX = (windowWidth - infoWidth) / 2;
-    float infoY = (windowHeight - infoHeight) / 2;
-    float yPos = infoY + 70;
+    float buttonWidth = windowWidth * 0.6f;
+    float buttonHeight = windowHeight * 0.1f;
+    float startX = background.getPosition().x + windowWidth * 0.05f;
+    float startY = background.getPosition().y + windowHeight * 0.15f;
+    float spacing = buttonHeight * 0.3f;
 
-    for (const string& line : info) {
-      Text text;
-      text.setFont(*font);
-      text.setString(line);
-      text.setCharacterSize(18);
-      text.setFillColor(Color::Black);
-      text.setPosition(infoX + 15, yPos);
-      contentLines.push_back(text);
-      yPos += 28;
-    }
-    float contentHeight = contentLines.size() * 28;
-    float visibleHeight = infoHeight - 80;
-    maxScrollOffset = max(0.0f, contentHeight - visibleHeight);
-  }
+    filterButtons.push_back(new Button(Vector2f(startX, startY),
+                                       Vector2f(buttonWidth, buttonHeight),
+                                       "Select Companies", *font));
+
+    filterButtons.push_back(
+        new Button(Vector2f(startX, startY + (buttonHeight + spacing)),
+                   Vector2f(buttonWidth, buttonHeight), "Avoid Ports", *font));
+
+    filterButtons.push_back(new Button(
+        Vector2f(startX, startY + 2 * (buttonHeight + spacing)),
+        Vector2f(buttonWidth, buttonHeight), "Max Voyage Time", *font));
 
-  void hide() {
-    isVisible = false;
-    contentLines.clear();
-    scrollOffset = 0;
-    maxScrollOffset = 0;
+    filterButtons.push_back(new Button(
+        Vector2f(startX, startY + 3 * (buttonHeight + spacing) + 20),
+        Vector2f(buttonWidth, buttonHeight), "Apply Filters", *font));
+
+    filterButtons.push_back(new Button(
+        Vector2f(startX, startY + 4 * (buttonHeight + spacing) + 20),
+        Vector2f(buttonWidth, buttonHeight), "Clear Filters", *font));
   }
 
-  bool checkClose(RenderWindow& window, Event& event) {
-    if (isVisible && closeButton->isClicked(window, event)) {
-      hide();
-      return true;
+  void show() { isVisible = true; }
+
+  void hide() { isVisible = false; }
+
+  bool visible() const { return isVisible; }
+
+  void toggleExpand() {
+    isExpanded = !isExpanded;
+    if (isExpanded) {
+      toggleButton->setText("<");
+    } else {
+      toggleButton->setText(">");
     }
-    return false;
   }
 
-  void scroll(float delta) {
+  void update(RenderWindow& window) {
     if (!isVisible) return;
 
-    scrollOffset -= delta * 30.0f;
-    if (scrollOffset < 0) scrollOffset = 0;
-    if (scrollOffset > maxScrollOffset) scrollOffset = maxScrollOffset;
-  }
+    toggleButton->update(window);
 
-  void update(RenderWindow& window) {
-    if (isVisible) {
-      closeButton->update(window);
+    if (isExpanded) {
+      for (auto btn : filterButtons) {
+        btn->update(window);
+      }
     }
   }
 
-  void draw(RenderWindow& window) {
+  void draw(RenderWindow& window, const UserPreferences& prefs) {
     if (!isVisible) return;
 
-    float infoWidth = windowWidth * 0.5f;
-    float infoHeight = windowHeight * 0.7f;
-    float infoX = (windowWidth - infoWidth) / 2;
-    float infoY = (windowHeight - infoHeight) / 2;
-
-    background.setSize(Vector2f(infoWidth, infoHeight));
-    background.setPosition(infoX, infoY);
+    if (isExpanded) {
+      window.draw(background);
+      window.draw(header);
+      window.draw(headerText);
 
-    titleBar.setSize(Vector2f(infoWidth, 50));
-    titleBar.setPosition(infoX, infoY);
+      float textY = 250;
 
-    titleText.setPosition(infoX + 10, infoY + 13);
+      Text companiesLabel;
+      companiesLabel.setFont(*font);
+      companiesLabel.setString("Selected Companies:");
+      companiesLabel.setCharacterSize(16);
+      companiesLabel.setFillColor(Color::White);
+      companiesLabel.setPosition(15, textY);
+      window.draw(companiesLabel);
+      textY += 25;
 
-    window.draw(background);
-    window.draw(titleBar);
-    window.draw(titleText);
-    closeButton->draw(window);
+      if (prefs.hasCompanyFilter && !prefs.preferredCompanies.empty()) {
+        for (const string& company : prefs.preferredCompanies) {
+          Text companyText;
+          companyText.setFont(*font);
+          companyText.setString("- " + company);
+          companyText.setCharacterSize(14);
+          companyText.setFillColor(Color(150, 255, 150));
+          companyText.setPosition(20, textY);
+          window.draw(companyText);
+          textY += 20;
+        }
+      } else {
+        Text noneText;
+        noneText.setFont(*font);
+        noneText.setString("  None");
+        noneText.setCharacterSize(14);
+        noneText.setFillColor(Color(200, 200, 200));
+        noneText.setPosition(20, textY);
+        window.draw(noneText);
+        textY += 20;
+      }
 
-    float visibleTop = infoY + 60;
-    float visibleBottom = infoY + infoHeight - 20;
+      textY += 15;
 
-    for (auto& line : contentLines) {
-      Vector2f orig = line.getPosition();
-      float newY = orig.y - scrollOffset;
+      Text portsLabel;
+      portsLabel.setFont(*font);
+      portsLabel.setString("Avoided Ports:");
+      portsLabel.setCharacterSize(16);
+      portsLabel.setFillColor(Color::White);
+      portsLabel.setPosition(15, textY);
+      window.draw(portsLabel);
+      textY += 25;
 
-      if (newY >= visibleTop && newY <= visibleBottom) {
-        line.setPosition(orig.x, newY);
-        window.draw(line);
-        line.setPosition(orig);
+      if (prefs.hasPortFilter && !prefs.avoidPorts.empty()) {
+        for (const string& port : prefs.avoidPorts) {
+          Text portText;
+          portText.setFont(*font);
+          portText.setString("- " + port);
+          portText.setCharacterSize(14);
+          portText.setFillColor(Color(255, 150, 150));
+          portText.setPosition(20, textY);
+          window.draw(portText);
+          textY += 20;
+        }
+      } else {
+        Text noneText;
+        noneText.setFont(*font);
+        noneText.setString("  None");
+        noneText.setCharacterSize(14);
+        noneText.setFillColor(Color(200, 200, 200));
+        noneText.setPosition(20, textY);
+        window.draw(noneText);
+        textY += 20;
       }
-    }
 
-    if (maxScrollOffset > 0) {
-      float trackX = infoX + infoWidth - 16;
-      float trackY = infoY + 60;
-      float trackH = infoHeight - 80;
+      textY += 15;
 
-      RectangleShape track(Vector2f(8, trackH));
-      track.setPosition(trackX, trackY);
-      track.setFillColor(Color(200, 200, 200));
-      track.setOutlineColor(Color(120, 120, 120));
-      track.setOutlineThickness(1);
-      window.draw(track);
+      Text timeLabel;
+      timeLabel.setFont(*font);
+      timeLabel.setString("Max Voyage Time:");
+      timeLabel.setCharacterSize(16);
+      timeLabel.setFillColor(Color::White);
+      timeLabel.setPosition(15, textY);
+      window.draw(timeLabel);
+      textY += 25;
 
-      float ratio = trackH / (trackH + maxScrollOffset);
-      float thumbH = max(35.0f, trackH * ratio);
+      Text timeText;
+      timeText.setFont(*font);
+      if (prefs.hasTimeFilter) {
+        int hours = prefs.maxVoyageTime / 60;
+        timeText.setString("  " + to_string(hours) + " hours");
+        timeText.setFillColor(Color(150, 200, 255));
+      } else {
+        timeText.setString("  No limit");
+        timeText.setFillColor(Color(200, 200, 200));
+      }
+      timeText.setCharacterSize(14);
+      timeText.setPosition(20, textY);
+      window.draw(timeText);
 
-      float thumbY =
-          trackY + (scrollOffset * (trackH - thumbH) / maxScrollOffset);
+      for (auto btn : filterButtons) {
+        btn->draw(window);
+      }
+    } else {
+      RectangleShape collapsedBar(Vector2f(50, sidebarHeight));
+      collapsedBar.setPosition(0, 0);
+      collapsedBar.setFillColor(Color(40, 40, 40, 230));
+      collapsedBar.setOutlineThickness(3);
+      collapsedBar.setOutlineColor(Color(100, 100, 100));
+      window.draw(collapsedBar);
 
-      RectangleShape thumb(Vector2f(8, thumbH));
-      thumb.setPosition(trackX, thumbY);
-      thumb.setFillColor(Color(100, 100, 100));
-      window.draw(thumb);
+      Text verticalText;
+      verticalText.setFont(*font);
+      verticalText.setString("FILTERS");
+      verticalText.setCharacterSize(18);
+      verticalText.setFillColor(Color::White);
+      verticalText.setRotation(90);
+      verticalText.setPosition(30, 100);
+      window.draw(verticalText);
     }
+
+    toggleButton->draw(window);
   }
 
-  bool visible() const { return isVisible; }
-  void handleResize(float newWidth, float newHeight) {
-    windowWidth = newWidth;
-    windowHeight = newHeight;
-    float width = windowWidth * 0.45f;
-    float height = windowHeight * 0.70f;
-    float x = (windowWidth - width) / 2;
-    float y = (windowHeight - height) / 2;
+  int checkClick(RenderWindow& window, Event& event) {
+    if (!isVisible) return -1;
 
-    background.setSize(Vector2f(width, height));
-    background.setPosition(x, y);
-    titleBar.setSize(Vector2f(width, 50));
-    titleBar.setPosition(x, y);
-    titleText.setPosition(x + 10, y + 13);
+    if (toggleButton->isClicked(window, event)) {
+      toggleExpand();
+      return -2;
+    }
 
-    if (closeButton) {
-      closeButton->setPosition(Vector2f(x + width - 45, y + 5));
+    if (!isExpanded) return -1;
+
+    for (int i = 0; i < filterButtons.size(); i++) {
+      if (filterButtons[i]->isClicked(window, event)) {
+        return i;
+      }
     }
+
+    return -1;
   }
-  bool isMouseOverWindow(RenderWindow& window) const {
+
+  bool isMouseOverSidebar(RenderWindow& window) const {
     if (!isVisible) return false;
+
     Vector2i mousePos = Mouse::getPosition(window);
-    float infoWidth = windowWidth * 0.5f;
-    float infoHeight = windowHeight * 0.7f;
-    float infoX = (windowWidth - infoWidth) / 2;
-    float infoY = (windowHeight - infoHeight) / 2;
-    FloatRect bounds(infoX, infoY, infoWidth, infoHeight);
-    return bounds.contains(static_cast<Vector2f>(mousePos));
+    float width = isExpanded ? sidebarWidth : 50;
+
+    return (mousePos.x >= 0 && mousePos.x <= width && mousePos.y >= 0 &&
+            mousePos.y <= sidebarHeight);
+  }
+};
+class RouteEdge {
+ public:
+  Vector2f start;
+  Vector2f end;
+  Route routeInfo;
+  string sourceName;
+  RectangleShape line;
+  Color normalColor;
+  Color hoverColor;
+  bool isHovered;
+
+  RouteEdge(Vector2f s, Vector2f e, const Route& r, const string& src)
+      : start(s), end(e), routeInfo(r), sourceName(src), isHovered(false) {
+    setEndpoints(s, e);
+    resetAppearance();
+  }
+
+  void setEndpoints(Vector2f s, Vector2f e) {
+    start = s;
+    end = e;
+    Vector2f direction = end - start;
+    float length = sqrt(direction.x * direction.x + direction.y * direction.y);
+    float angle = atan2(direction.y, direction.x) * 180 / 3.14159f;
+    line.setSize(Vector2f(length, line.getSize().y));
+    line.setPosition(start);
+    line.setRotation(angle);
   }
-};
-class Location {
- public:
-  CircleShape pin;
-  Text label;
-  string name;
-  Vector2f position;
-  Color normalColor;
-  Color hoverColor;
 
-  Location(string portName, Vector2f pos, Font& font) {
-    name = portName;
-    position = pos;
+  void resetAppearance() {
+    normalColor = Color(255, 50, 50, 255);
+    hoverColor = Color(255, 165, 0, 255);
+    line.setSize(Vector2f(line.getSize().x, 2.5));
+    line.setFillColor(normalColor);
+    line.setOutlineThickness(0);
+    isHovered = false;
+  }
 
-    pin.setRadius(18);
-    pin.setOrigin(18, 18);
-    pin.setPosition(pos);
+  bool isMouseOver(RenderWindow& window) {
+    Vector2f mousePosF = window.mapPixelToCoords(Mouse::getPosition(window));
+    Vector2f dir = end - start;
+    float lineLength = sqrt(dir.x * dir.x + dir.y * dir.y);
 
-    normalColor = Color(220, 50, 50);
-    hoverColor = Color(255, 100, 100);
-    pin.setFillColor(normalColor);
-    pin.setOutlineThickness(3);
-    pin.setOutlineColor(Color::White);
+    if (lineLength == 0) return false;
+    Vector2f toMouse = mousePosF - start;
+    float t =
+        (toMouse.x * dir.x + toMouse.y * dir.y) / (lineLength * lineLength);
+    t = max(0.0f, min(1.0f, t));
 
-    label.setFont(font);
-    label.setString(portName);
-    label.setCharacterSize(20);
-    label.setFillColor(Color::White);
-    label.setOutlineThickness(2);
-    label.setOutlineColor(Color::Black);
+    Vector2f projection = start + dir * t;
+    Vector2f diff = mousePosF - projection;
+    float distance = sqrt(diff.x * diff.x + diff.y * diff.y);
 
-    FloatRect textBounds = label.getLocalBounds();
-    label.setOrigin(textBounds.left + textBounds.width / 2,
-                    textBounds.top + textBounds.height);
-    label.setPosition(pos.x, pos.y - 30);
+    return distance < 15.0f;
   }
 
-  bool isMouseOver(RenderWindow& window) {
-    Vector2i mousePos = Mouse::getPosition(window);
-    FloatRect bounds = pin.getGlobalBounds();
-    return bounds.contains(static_cast<Vector2f>(mousePos));
-  }
+  void update(RenderWindow& window) { isHovered = isMouseOver(window); }
 
   bool isClicked(RenderWindow& window, Event& event) {
     if (event.type == Event::MouseButtonReleased &&
@@ -1477,659 +4245,1549 @@ class Location {
     }
     return false;
   }
-
-  void update(RenderWindow& window) {
-    if (isMouseOver(window)) {
-      pin.setFillColor(hoverColor);
-      pin.setRadius(22);
-      pin.setOrigin(22, 22);
+  bool isAllowed() const { return line.getFillColor().a > 150; }
+  void setSelected(bool selected) {
+    if (selected) {
+      line.setFillColor(hoverColor);
     } else {
-      pin.setFillColor(normalColor);
-      pin.setRadius(18);
-      pin.setOrigin(18, 18);
+      line.setFillColor(normalColor);
     }
   }
 
-  void draw(RenderWindow& window) {
-    window.draw(pin);
-    window.draw(label);
-  }
-  bool isAllowed() const {
-    Color color = pin.getFillColor();
-    return (color.r > 200 && color.g > 200 && color.b < 100);
+  void draw(RenderTarget& target) { target.draw(line); }
+
+  vector<string> getRouteDetails() {
+    vector<string> details;
+    details.push_back("Route: " + sourceName + " -> " + routeInfo.destination);
+    details.push_back("Date: " + routeInfo.date);
+    details.push_back("Departure: " + routeInfo.depTime);
+    details.push_back("Arrival: " + routeInfo.arrTime);
+    details.push_back("Cost: $" + to_string(routeInfo.cost));
+    details.push_back("Company: " + routeInfo.company);
+    return details;
   }
 };
-class NavigationMenu {
- private:
-  vector<Button*> buttons;
-  bool isVisible;
-  Text titleText;
-  float windowWidth;
-  float windowHeight;
 
+// Every map edge as one quad in a single vertex array, so the network is one
+// draw call. RouteEdge::line stays the source of truth: sync() copies each
+// line's colour and only recomputes corners for lines that moved.
+class EdgeBatch {
  public:
-  NavigationMenu(Font& font, float winWidth, float winHeight)
-      : isVisible(false), windowWidth(winWidth), windowHeight(winHeight) {
-    titleText.setFont(font);
-    titleText.setString("Route Navigation System");
-    titleText.setCharacterSize(48);
-    titleText.setFillColor(Color::White);
-    titleText.setOutlineThickness(2);
-    titleText.setOutlineColor(Color::Black);
-
-    FloatRect textBounds = titleText.getLocalBounds();
-    titleText.setOrigin(textBounds.left + textBounds.width / 2.0f,
-                        textBounds.top + textBounds.height / 2.0f);
-    titleText.setPosition(windowWidth / 2, windowHeight * 0.08f);
-
-    float buttonWidth = 400;
-    float buttonHeight = 70;
-    float centerX = (windowWidth - buttonWidth) / 2;
-    float startY = windowHeight * 0.18f;
-    float spacing = buttonHeight + 15;
-
-    buttons.push_back(new Button(Vector2f(centerX, startY),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Search for Routes", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Book Cargo Routes", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 2),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Display Ports Info", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 3),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Shortest Route", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 4),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Cheapest Route", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 5),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Generate Subgraphs", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 6),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Process Layovers", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 7),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Track Multi-Leg Journeys", font));
-    buttons.push_back(new Button(Vector2f(centerX, startY + spacing * 8.5f),
-                                 Vector2f(buttonWidth, buttonHeight),
-                                 "Back to Main Menu", font));
-  }
-
-  ~NavigationMenu() {
-    for (auto btn : buttons) {
-      delete btn;
-    }
-  }
-
-  void show() { isVisible = true; }
-
-  void hide() { isVisible = false; }
-
-  bool visible() const { return isVisible; }
-
-  void update(RenderWindow& window) {
-    if (isVisible) {
-      for (auto btn : buttons) {
-        btn->update(window);
-      }
-    }
-  }
+  EdgeBatch() : vertices(Quads) {}
 
-  void draw(RenderWindow& window) {
-    if (isVisible) {
-      window.draw(titleText);
-      for (auto btn : buttons) {
-        btn->draw(window);
-      }
+  void sync(const vector<RouteEdge>& edges) {
+    if (placed.size() != edges.size()) {
+      vertices.resize(edges.size() * 4);
+      placed.assign(edges.size(), Placement());
     }
-  }
-
-  int checkClick(RenderWindow& window, Event& event) {
-    if (!isVisible) return -1;
-
-    for (int i = 0; i < buttons.size(); i++) {
-      if (buttons[i]->isClicked(window, event)) {
-        return i;
+    for (size_t i = 0; i < edges.size(); i++) {
+      const RectangleShape& line = edges[i].line;
+      Placement now = {line.getPosition(), line.getSize(), line.getRotation()};
+      if (!(now == placed[i])) {
+        placeQuad(i, now);
+        placed[i] = now;
       }
+      setColor(i, line.getFillColor());
     }
-    return -1;
   }
-  void handleResize(float newWidth, float newHeight) {
-    windowWidth = newWidth;
-    windowHeight = newHeight;
-
-    FloatRect textBounds = titleText.getLocalBounds();
-    titleText.setOrigin(textBounds.left + textBounds.width / 2.0f,
-                        textBounds.top + textBounds.height / 2.0f);
-    titleText.setPosition(windowWidth / 2, windowHeight * 0.08f);
-
-    float buttonWidth = 400;
-    float buttonHeight = 70;
-    float centerX = (windowWidth - buttonWidth) / 2;
-    float startY = windowHeight * 0.18f;
-    float spacing = buttonHeight + 15;
 
-    for (int i = 0; i < buttons.size(); i++) {
-      float yPos = startY + (i * spacing);
-      if (i == buttons.size() - 1) {
-        yPos = startY + (8.5f * spacing);
-      }
-      buttons[i]->setPosition(Vector2f(centerX, yPos));
-    }
+  void setColor(size_t i, const Color& color) {
+    for (size_t k = 0; k < 4; k++) vertices[i * 4 + k].color = color;
   }
-};
-
-class RouteTooltip {
- private:
-  RectangleShape background;
-  vector<Text> lines;
-  Font* font;
-  bool isVisible;
 
- public:
-  RouteTooltip(Font& f) : font(&f), isVisible(false) {
-    background.setFillColor(Color(40, 40, 40, 230));
-    background.setOutlineThickness(2);
-    background.setOutlineColor(Color(255, 165, 0));
+  void fill(const Color& color) {
+    for (size_t i = 0; i < placed.size(); i++) setColor(i, color);
   }
 
-  void show(Vector2f mousePos, const vector<string>& details) {
-    isVisible = true;
-    lines.clear();
-
-    float maxWidth = 0;
-    float yOffset = 5;
-
-    for (const string& detail : details) {
-      Text text;
-      text.setFont(*font);
-      text.setString(detail);
-      text.setCharacterSize(14);
-      text.setFillColor(Color::White);
-
-      FloatRect bounds = text.getLocalBounds();
-      if (bounds.width > maxWidth) maxWidth = bounds.width;
+  size_t size() const { return placed.size(); }
 
-      text.setPosition(mousePos.x + 15, mousePos.y + yOffset);
-      lines.push_back(text);
-      yOffset += 18;
-    }
+  const Color& colorOf(size_t i) const { return vertices[i * 4].color; }
 
-    background.setSize(Vector2f(maxWidth + 20, yOffset + 5));
-    background.setPosition(mousePos.x + 10, mousePos.y);
+  pair<Vector2f, Vector2f> segment(size_t i) const {
+    float radians = placed[i].rotation * 3.14159f / 180;
+    Vector2f along(cos(radians), sin(radians));
+    return {placed[i].position,
+            placed[i].position + along * placed[i].size.x};
   }
 
-  void hide() {
-    isVisible = false;
-    lines.clear();
+  void draw(RenderTarget& target) const {
+    if (!placed.empty()) target.draw(vertices);
   }
 
-  void draw(RenderWindow& window) {
-    if (isVisible) {
-      window.draw(background);
-      for (auto& line : lines) {
-        window.draw(line);
+  // Draws only the listed edges, still as a single call.
+  void drawSubset(RenderTarget& target, const vector<int>& ids) {
+    subset.setPrimitiveType(Quads);
+    subset.resize(ids.size() * 4);
+    for (size_t k = 0; k < ids.size(); k++) {
+      for (size_t v = 0; v < 4; v++) {
+        subset[k * 4 + v] = vertices[ids[k] * 4 + v];
       }
     }
+    if (!ids.empty()) target.draw(subset);
   }
 
-  bool visible() const { return isVisible; }
-};
-class FilterSidebar {
  private:
-  RectangleShape background;
-  RectangleShape header;
-  Text headerText;
-  vector<Button*> filterButtons;
-  Font* font;
-  bool isVisible;
-  bool isExpanded;
-  float sidebarWidth;
-  float sidebarHeight;
-  float windowWidth;
-  float windowHeight;
+  struct Placement {
+    Vector2f position = Vector2f(-1, -1);
+    Vector2f size;
+    float rotation = 0;
+    bool operator==(const Placement& o) const {
+      return position == o.position && size == o.size &&
+             rotation == o.rotation;
+    }
+  };
+
+  VertexArray vertices;
+  VertexArray subset;
+  vector<Placement> placed;
+
+  void placeQuad(size_t i, const Placement& p) {
+    float radians = p.rotation * 3.14159f / 180;
+    Vector2f along(cos(radians), sin(radians));
+    Vector2f across(-along.y, along.x);
+    Vector2f length = along * p.size.x;
+    Vector2f width = across * p.size.y;
+    vertices[i * 4].position = p.position;
+    vertices[i * 4 + 1].position = p.position + length;
+    vertices[i * 4 + 2].position = p.position + length + width;
+    vertices[i * 4 + 3].position = p.position + width;
+  }
+};
 
-  Button* toggleButton;
+// Pan/zoom over the map. World coordinates are the unzoomed screen layout
+// produced by loadMapView, so zoom 1 shows the whole map; the mouse wheel
+// zooms around the cursor, right-drag pans and Home resets.
+class MapCamera {
+ public:
+  MapCamera() : zoomLevel(1.0f), dragging(false), changes(0) {}
+
+  void resize(float width, float height) {
+    screenSize = Vector2f(width, height);
+    screen.reset(FloatRect(0, 0, width, height));
+    if (changes == 0) center = screenSize / 2.0f;
+    clampCenter();
+    changes++;
+  }
+
+  void reset() {
+    zoomLevel = 1.0f;
+    center = screenSize / 2.0f;
+    changes++;
+  }
+
+  View worldView() const { return View(center, screenSize * zoomLevel); }
+  const View& screenView() const { return screen; }
+
+  FloatRect visibleArea() const {
+    Vector2f size = screenSize * zoomLevel;
+    return FloatRect(center - size / 2.0f, size);
+  }
+
+  float zoom() const { return zoomLevel; }
+  int revision() const { return changes; }
+
+  Vector2f toWorld(Vector2i pixel) const {
+    return center +
+           (static_cast<Vector2f>(pixel) - screenSize / 2.0f) * zoomLevel;
+  }
+
+  void zoomAt(Vector2i pixel, float factor) {
+    Vector2f before = toWorld(pixel);
+    zoomLevel = max(MIN_ZOOM, min(1.0f, zoomLevel * factor));
+    center += before - toWorld(pixel);
+    clampCenter();
+    changes++;
+  }
+
+  // Handles dragging and Home; wheel zoom is left to the caller, which knows
+  // whether a scrollable window is under the cursor.
+  bool handleEvent(const Event& event) {
+    if (event.type == Event::MouseButtonPressed &&
+        event.mouseButton.button == Mouse::Right) {
+      dragging = true;
+      dragFrom = Vector2i(event.mouseButton.x, event.mouseButton.y);
+    } else if (event.type == Event::MouseButtonReleased &&
+               event.mouseButton.button == Mouse::Right) {
+      dragging = false;
+    } else if (event.type == Event::MouseMoved && dragging) {
+      Vector2i now(event.mouseMove.x, event.mouseMove.y);
+      center -= static_cast<Vector2f>(now - dragFrom) * zoomLevel;
+      dragFrom = now;
+      clampCenter();
+      changes++;
+      return true;
+    } else if (event.type == Event::KeyPressed &&
+               event.key.code == Keyboard::Home) {
+      reset();
+      return true;
+    }
+    return false;
+  }
 
-  Text companiesHeader;
-  Text portsHeader;
-  Text timeHeader;
+ private:
+  static constexpr float MIN_ZOOM = 0.05f;
 
-  vector<Text> selectionTexts;
+  Vector2f screenSize;
+  Vector2f center;
+  float zoomLevel;
+  View screen;
+  bool dragging;
+  Vector2i dragFrom;
+  int changes;
+
+  void clampCenter() {
+    center.x = max(0.0f, min(screenSize.x, center.x));
+    center.y = max(0.0f, min(screenSize.y, center.y));
+  }
+};
 
+// The map sprite, edge network and port pins for the current screen, drawn
+// once into an off-screen texture and blitted every frame. The picture is
+// redrawn when the key changes (state, window size, hovered pin, filters,
+// map contents, camera) or after invalidate(); overlays are drawn on top
+// per frame.
+class MapLayer {
  public:
-  FilterSidebar(Font& f, float winWidth, float winHeight)
-      : font(&f),
-        isVisible(false),
-        isExpanded(true),
-        windowWidth(winWidth),
-        windowHeight(winHeight) {
-    sidebarWidth = 280;
-    sidebarHeight = winHeight;
+  struct Key {
+    int state = -1;
+    Vector2u size;
+    int hoveredLocation = -1;
+    size_t preferences = 0;
+    size_t edgeCount = 0;
+    size_t locationCount = 0;
+    int camera = 0;
+    bool operator==(const Key& o) const {
+      return state == o.state && size == o.size &&
+             hoveredLocation == o.hoveredLocation &&
+             preferences == o.preferences && edgeCount == o.edgeCount &&
+             locationCount == o.locationCount && camera == o.camera;
+    }
+  };
 
-    background.setSize(Vector2f(sidebarWidth, sidebarHeight));
-    background.setPosition(0, 0);
-    background.setFillColor(Color(40, 40, 40, 230));
-    background.setOutlineThickness(3);
-    background.setOutlineColor(Color(100, 100, 100));
+  MapLayer() : valid(false), offscreen(true), redraws(0) {}
 
-    header.setSize(Vector2f(sidebarWidth, 60));
-    header.setPosition(0, 0);
-    header.setFillColor(Color(70, 130, 180));
+  void invalidate() { valid = false; }
 
-    headerText.setFont(f);
-    headerText.setString("Filter Options");
-    headerText.setCharacterSize(24);
-    headerText.setFillColor(Color::White);
-    headerText.setPosition(15, 18);
+  // Returns where to draw the static content this frame, or nullptr when the
+  // cached texture is still current. Falls back to the window itself if the
+  // off-screen texture cannot be created.
+  RenderTarget* begin(const Key& now, RenderWindow& window) {
+    if (!offscreen) return &window;
+    if (valid && now == key) return nullptr;
+    if (texture.getSize() != now.size) {
+      if (!texture.create(now.size.x, now.size.y)) {
+        cout << "Could not create the map layer texture, drawing directly"
+             << endl;
+        offscreen = false;
+        return &window;
+      }
+      sprite.setTexture(texture.getTexture(), true);
+    }
+    key = now;
+    texture.clear(Color::Transparent);
+    return &texture;
+  }
 
-    toggleButton =
-        new Button(Vector2f(sidebarWidth - 50, 10), Vector2f(40, 40), "<", f);
+  void end() {
+    if (!offscreen) return;
+    texture.display();
+    valid = true;
+    redraws++;
+  }
 
-    setupButtons();
+  void draw(RenderWindow& window) const {
+    if (offscreen) window.draw(sprite);
   }
 
-  ~FilterSidebar() {
-    delete toggleButton;
-    for (auto btn : filterButtons) {
-      delete btn;
+  int redrawCount() const { return redraws; }
+
+ private:
+  RenderTexture texture;
+  Sprite sprite;
+  Key key;
+  bool valid;
+  bool offscreen;
+  int redraws;
+};
+
+// Uniform grid over the map's pins and edge segments. Each cell lists, in
+// index order, every pin or edge that could be under a mouse position inside
+// it, so hover and click tests only look at a handful of candidates. Rebuilt
+// by loadMapView and whenever the map's edges or pins are added or removed.
+// Also answers area queries for culling and groups edges that join the same
+// pair of pins.
+class MapHitIndex {
+ public:
+  MapHitIndex() : cellSize(48), cols(0), rows(0) {}
+
+  void build(const vector<Location>& locations,
+             const vector<RouteEdge>& edges) {
+    hoveredPins.clear();
+    hoveredEdges.clear();
+    builtLocations = locations.size();
+    builtEdges = edges.size();
+    groupPairs(edges);
+    if (locations.empty() && edges.empty()) {
+      cols = rows = 0;
+      return;
     }
-  }
 
-  void setupButtons() {
-    for (auto btn : filterButtons) {
-      delete btn;
+    Vector2f low(1e9f, 1e9f), high(-1e9f, -1e9f);
+    auto extend = [&](Vector2f p) {
+      low.x = min(low.x, p.x);
+      low.y = min(low.y, p.y);
+      high.x = max(high.x, p.x);
+      high.y = max(high.y, p.y);
+    };
+    for (const auto& location : locations) extend(location.position);
+    for (const auto& edge : edges) {
+      extend(edge.start);
+      extend(edge.end);
     }
-    filterButtons.clear();
+    origin = low - Vector2f(PIN_REACH, PIN_REACH);
+    cols = (int)((high.x - origin.x + PIN_REACH) / cellSize) + 1;
+    rows = (int)((high.y - origin.y + PIN_REACH) / cellSize) + 1;
 
-    float buttonWidth = windowWidth * 0.6f;
-    float buttonHeight = windowHeight * 0.1f;
-    float startX = background.getPosition().x + windowWidth * 0.05f;
-    float startY = background.getPosition().y + windowHeight * 0.15f;
-    float spacing = buttonHeight * 0.3f;
+    vector<pair<int, int>> pinCells, edgeCells;
+    for (int i = 0; i < locations.size(); i++) {
+      Vector2f p = locations[i].position;
+      forCellsIn(p.x - PIN_REACH, p.y - PIN_REACH, p.x + PIN_REACH,
+                 p.y + PIN_REACH, [&](int cell) {
+                   pinCells.push_back(make_pair(cell, i));
+                 });
+    }
 
-    filterButtons.push_back(new Button(Vector2f(startX, startY),
-                                       Vector2f(buttonWidth, buttonHeight),
-                                       "Select Companies", *font));
+    float halfDiagonal = cellSize * 0.7072f;
+    for (int i = 0; i < edges.size(); i++) {
+      Vector2f a = edges[i].start, b = edges[i].end;
+      forCellsIn(min(a.x, b.x) - EDGE_REACH, min(a.y, b.y) - EDGE_REACH,
+                 max(a.x, b.x) + EDGE_REACH, max(a.y, b.y) + EDGE_REACH,
+                 [&](int cell) {
+                   Vector2f center(
+                       origin.x + (cell % cols + 0.5f) * cellSize,
+                       origin.y + (cell / cols + 0.5f) * cellSize);
+                   if (segmentDistance(center, a, b) <=
+                       halfDiagonal + EDGE_REACH) {
+                     edgeCells.push_back(make_pair(cell, i));
+                   }
+                 });
+    }
+    toBuckets(pinCells, pinStart, pinItems);
+    toBuckets(edgeCells, edgeStart, edgeItems);
+  }
 
-    filterButtons.push_back(
-        new Button(Vector2f(startX, startY + (buttonHeight + spacing)),
-                   Vector2f(buttonWidth, buttonHeight), "Avoid Ports", *font));
+  bool isCurrent(const vector<Location>& locations,
+                 const vector<RouteEdge>& edges) const {
+    return builtLocations == locations.size() && builtEdges == edges.size();
+  }
 
-    filterButtons.push_back(new Button(
-        Vector2f(startX, startY + 2 * (buttonHeight + spacing)),
-        Vector2f(buttonWidth, buttonHeight), "Max Voyage Time", *font));
+  vector<int> locationsAt(RenderWindow& window) const {
+    return lookup(mousePosition(window), pinStart, pinItems);
+  }
 
-    filterButtons.push_back(new Button(
-        Vector2f(startX, startY + 3 * (buttonHeight + spacing) + 20),
-        Vector2f(buttonWidth, buttonHeight), "Apply Filters", *font));
+  vector<int> edgesAt(RenderWindow& window) const {
+    return lookup(mousePosition(window), edgeStart, edgeItems);
+  }
 
-    filterButtons.push_back(new Button(
-        Vector2f(startX, startY + 4 * (buttonHeight + spacing) + 20),
-        Vector2f(buttonWidth, buttonHeight), "Clear Filters", *font));
+  vector<int> locationsIn(const FloatRect& area) const {
+    return collect(area, pinStart, pinItems, builtLocations);
   }
 
-  void show() { isVisible = true; }
+  vector<int> edgesIn(const FloatRect& area) const {
+    return collect(area, edgeStart, edgeItems, builtEdges);
+  }
 
-  void hide() { isVisible = false; }
+  // Legs drawn between the same two pins, in either direction.
+  struct PairSummary {
+    int legs;
+    int minCost, maxCost;
+    int minTime, maxTime;
+  };
 
-  bool visible() const { return isVisible; }
+  // Parallel legs between the same two pins share a group id.
+  int groupOf(int edge) const { return edgeGroup[edge]; }
+  int groupCount() const { return groups; }
+  const PairSummary& pairOf(int edge) const {
+    return pairSummaries[edgeGroup[edge]];
+  }
 
-  void toggleExpand() {
-    isExpanded = !isExpanded;
-    if (isExpanded) {
-      toggleButton->setText("<");
-    } else {
-      toggleButton->setText(">");
-    }
+  int hoveredEdge() const {
+    return hoveredEdges.empty() ? -1 : hoveredEdges.back();
   }
 
-  void update(RenderWindow& window) {
-    if (!isVisible) return;
+  // Same result as calling Location::update on every pin, but only the pins
+  // near the mouse and the ones hovered last frame are touched.
+  int updateLocationHover(vector<Location>& locations, RenderWindow& window) {
+    vector<int> now;
+    for (int i : locationsAt(window)) {
+      if (i < locations.size() && locations[i].isMouseOver(window)) {
+        now.push_back(i);
+      }
+    }
+    for (int i : hoveredPins) {
+      if (i < locations.size() && find(now.begin(), now.end(), i) == now.end())
+        locations[i].setHovered(false);
+    }
+    for (int i : now) locations[i].setHovered(true);
+    hoveredPins = now;
+    return now.empty() ? -1 : now.back();
+  }
 
-    toggleButton->update(window);
+  void updateEdgeHover(vector<RouteEdge>& edges, RenderWindow& window) {
+    for (int i : hoveredEdges) {
+      if (i < edges.size()) edges[i].isHovered = false;
+    }
+    hoveredEdges.clear();
+    for (int i : edgesAt(window)) {
+      if (i < edges.size() && edges[i].isMouseOver(window)) {
+        edges[i].isHovered = true;
+        hoveredEdges.push_back(i);
+      }
+    }
+  }
 
-    if (isExpanded) {
-      for (auto btn : filterButtons) {
-        btn->update(window);
+ private:
+  // Hovered pins grow to radius 22 plus a 3px outline; edges are picked
+  // within 15px of the segment.
+  static constexpr float PIN_REACH = 26.0f;
+  static constexpr float EDGE_REACH = 15.0f;
+
+  float cellSize;
+  int cols, rows;
+  Vector2f origin;
+  size_t builtLocations = 0, builtEdges = 0;
+  vector<int> pinStart, pinItems;
+  vector<int> edgeStart, edgeItems;
+  vector<int> hoveredPins, hoveredEdges;
+  vector<int> edgeGroup;
+  vector<PairSummary> pairSummaries;
+  int groups = 0;
+
+  void groupPairs(const vector<RouteEdge>& edges) {
+    map<pair<pair<float, float>, pair<float, float>>, int> ids;
+    edgeGroup.assign(edges.size(), 0);
+    pairSummaries.clear();
+    for (int i = 0; i < edges.size(); i++) {
+      auto a = make_pair(edges[i].start.x, edges[i].start.y);
+      auto b = make_pair(edges[i].end.x, edges[i].end.y);
+      auto found = ids.emplace(make_pair(min(a, b), max(a, b)), ids.size());
+      edgeGroup[i] = found.first->second;
+
+      const Route& leg = edges[i].routeInfo;
+      if (found.second) {
+        pairSummaries.push_back({0, leg.cost, leg.cost, leg.travelTime,
+                                 leg.travelTime});
+      }
+      PairSummary& summary = pairSummaries[edgeGroup[i]];
+      summary.legs++;
+      summary.minCost = min(summary.minCost, leg.cost);
+      summary.maxCost = max(summary.maxCost, leg.cost);
+      summary.minTime = min(summary.minTime, leg.travelTime);
+      summary.maxTime = max(summary.maxTime, leg.travelTime);
+    }
+    groups = ids.size();
+  }
+
+  vector<int> collect(const FloatRect& area, const vector<int>& start,
+                      const vector<int>& items, size_t count) const {
+    vector<int> found;
+    if (cols == 0) return found;
+    float x1 = area.left + area.width, y1 = area.top + area.height;
+    if (area.left <= origin.x && area.top <= origin.y &&
+        x1 >= origin.x + cols * cellSize && y1 >= origin.y + rows * cellSize) {
+      found.resize(count);
+      for (size_t i = 0; i < count; i++) found[i] = i;
+      return found;
+    }
+    vector<char> seen(count, 0);
+    forCellsIn(area.left, area.top, x1, y1, [&](int cell) {
+      for (int k = start[cell]; k < start[cell + 1]; k++) {
+        if (!seen[items[k]]) {
+          seen[items[k]] = 1;
+          found.push_back(items[k]);
+        }
       }
+    });
+    sort(found.begin(), found.end());
+    return found;
+  }
+
+  static Vector2f mousePosition(RenderWindow& window) {
+    return window.mapPixelToCoords(Mouse::getPosition(window));
+  }
+
+  static float segmentDistance(Vector2f p, Vector2f a, Vector2f b) {
+    Vector2f dir = b - a;
+    float lengthSq = dir.x * dir.x + dir.y * dir.y;
+    float t = 0;
+    if (lengthSq > 0) {
+      t = ((p.x - a.x) * dir.x + (p.y - a.y) * dir.y) / lengthSq;
+      t = max(0.0f, min(1.0f, t));
     }
+    Vector2f diff = p - (a + dir * t);
+    return sqrt(diff.x * diff.x + diff.y * diff.y);
   }
 
-  void draw(RenderWindow& window, const UserPreferences& prefs) {
-    if (!isVisible) return;
+  template <typename Visit>
+  void forCellsIn(float x0, float y0, float x1, float y1, Visit visit) const {
+    int c0 = max(0, (int)((x0 - origin.x) / cellSize));
+    int r0 = max(0, (int)((y0 - origin.y) / cellSize));
+    int c1 = min(cols - 1, (int)((x1 - origin.x) / cellSize));
+    int r1 = min(rows - 1, (int)((y1 - origin.y) / cellSize));
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) visit(r * cols + c);
+    }
+  }
 
-    if (isExpanded) {
-      window.draw(background);
-      window.draw(header);
-      window.draw(headerText);
+  void toBuckets(const vector<pair<int, int>>& cells, vector<int>& start,
+                 vector<int>& items) const {
+    start.assign(cols * rows + 1, 0);
+    for (const auto& entry : cells) start[entry.first + 1]++;
+    for (int c = 0; c < cols * rows; c++) start[c + 1] += start[c];
+    items.resize(cells.size());
+    vector<int> fill(start.begin(), start.end() - 1);
+    for (const auto& entry : cells) items[fill[entry.first]++] = entry.second;
+  }
 
-      float textY = 250;
+  vector<int> lookup(Vector2f p, const vector<int>& start,
+                     const vector<int>& items) const {
+    if (cols == 0 || p.x < origin.x || p.y < origin.y) return {};
+    int c = (int)((p.x - origin.x) / cellSize);
+    int r = (int)((p.y - origin.y) / cellSize);
+    if (c >= cols || r >= rows) return {};
+    int cell = r * cols + c;
+    return vector<int>(items.begin() + start[cell],
+                       items.begin() + start[cell + 1]);
+  }
+};
 
-      Text companiesLabel;
-      companiesLabel.setFont(*font);
-      companiesLabel.setString("Selected Companies:");
-      companiesLabel.setCharacterSize(16);
-      companiesLabel.setFillColor(Color::White);
-      companiesLabel.setPosition(15, textY);
-      window.draw(companiesLabel);
-      textY += 25;
+size_t preferencesKey(const UserPreferences& prefs) {
+  size_t h = prefs.hasCompanyFilter | prefs.hasPortFilter << 1 |
+             prefs.hasTimeFilter << 2 | prefs.hasWeatherFilter << 3;
+  h = h * 31 + prefs.maxVoyageTime;
+  for (const string& company : prefs.preferredCompanies) {
+    h = h * 31 + hash<string>()(company);
+  }
+  for (const string& port : prefs.avoidPorts) {
+    h = h * 37 + hash<string>()(port);
+  }
+  return h;
+}
 
-      if (prefs.hasCompanyFilter && !prefs.preferredCompanies.empty()) {
-        for (const string& company : prefs.preferredCompanies) {
-          Text companyText;
-          companyText.setFont(*font);
-          companyText.setString("- " + company);
-          companyText.setCharacterSize(14);
-          companyText.setFillColor(Color(150, 255, 150));
-          companyText.setPosition(20, textY);
-          window.draw(companyText);
-          textY += 20;
-        }
-      } else {
-        Text noneText;
-        noneText.setFont(*font);
-        noneText.setString("  None");
-        noneText.setCharacterSize(14);
-        noneText.setFillColor(Color(200, 200, 200));
-        noneText.setPosition(20, textY);
-        window.draw(noneText);
-        textY += 20;
-      }
+// Which map edges and pins pass the current filter preferences. Evaluated
+// with the compiled constraints and the edge table only when the
+// preferences, the graph or the map change, so redraws just paint colours.
+class MapFilterView {
+ public:
+  MapFilterView()
+      : active(false),
+        dirty(true),
+        key(0),
+        graphChange(0),
+        edgesSeen(0),
+        locationsSeen(0) {}
+
+  bool active;
+  vector<char> edgeAllowed;
+  vector<char> portAvoided;
+
+  void markDirty() { dirty = true; }
+
+  // Returns true when the verdicts were recomputed.
+  bool refresh(const Graph& g, const UserPreferences& prefs,
+               const vector<Location>& locations,
+               const vector<RouteEdge>& edges) {
+    size_t nowKey = preferencesKey(prefs);
+    if (!dirty && key == nowKey && graphChange == g.getChangeCount() &&
+        edgesSeen == edges.size() && locationsSeen == locations.size()) {
+      return false;
+    }
+    dirty = false;
+    key = nowKey;
+    graphChange = g.getChangeCount();
+    edgesSeen = edges.size();
+    locationsSeen = locations.size();
 
-      textY += 15;
+    active = prefs.filtersActive();
+    SearchConstraints constraints = g.compileConstraints(prefs);
+    vector<uint64_t> allowed = g.edgeTable.filter(constraints);
 
-      Text portsLabel;
-      portsLabel.setFont(*font);
-      portsLabel.setString("Avoided Ports:");
-      portsLabel.setCharacterSize(16);
-      portsLabel.setFillColor(Color::White);
-      portsLabel.setPosition(15, textY);
-      window.draw(portsLabel);
-      textY += 25;
+    edgeAllowed.assign(edges.size(), 0);
+    for (int i = 0; i < edges.size(); i++) {
+      int id = edges[i].routeInfo.edgeId;
+      edgeAllowed[i] = id >= 0 && id < g.edgeTable.count &&
+                       EdgeTable::test(allowed, id);
+    }
+    portAvoided.assign(locations.size(), 0);
+    for (int i = 0; i < locations.size(); i++) {
+      portAvoided[i] =
+          !constraints.allowsPort(g.getPortIndex(locations[i].name));
+    }
+    return true;
+  }
 
-      if (prefs.hasPortFilter && !prefs.avoidPorts.empty()) {
-        for (const string& port : prefs.avoidPorts) {
-          Text portText;
-          portText.setFont(*font);
-          portText.setString("- " + port);
-          portText.setCharacterSize(14);
-          portText.setFillColor(Color(255, 150, 150));
-          portText.setPosition(20, textY);
-          window.draw(portText);
-          textY += 20;
-        }
+  void paintEdges(EdgeBatch& batch, const Color& allowedColor,
+                  const Color& blockedColor) const {
+    for (size_t i = 0; i < edgeAllowed.size() && i < batch.size(); i++) {
+      batch.setColor(i, edgeAllowed[i] ? allowedColor : blockedColor);
+    }
+  }
+
+  void paintPins(vector<Location>& locations,
+                 const Color& allowedColor) const {
+    for (size_t i = 0; i < portAvoided.size() && i < locations.size(); i++) {
+      if (portAvoided[i]) {
+        locations[i].pin.setFillColor(Color(150, 150, 150));
+        locations[i].label.setFillColor(Color(150, 150, 150));
       } else {
-        Text noneText;
-        noneText.setFont(*font);
-        noneText.setString("  None");
-        noneText.setCharacterSize(14);
-        noneText.setFillColor(Color(200, 200, 200));
-        noneText.setPosition(20, textY);
-        window.draw(noneText);
-        textY += 20;
+        locations[i].pin.setFillColor(allowedColor);
+        locations[i].label.setFillColor(Color::White);
       }
+    }
+  }
 
-      textY += 15;
+ private:
+  bool dirty;
+  size_t key;
+  size_t graphChange;
+  size_t edgesSeen;
+  size_t locationsSeen;
+};
 
-      Text timeLabel;
-      timeLabel.setFont(*font);
-      timeLabel.setString("Max Voyage Time:");
-      timeLabel.setCharacterSize(16);
-      timeLabel.setFillColor(Color::White);
-      timeLabel.setPosition(15, textY);
-      window.draw(timeLabel);
-      textY += 25;
+// Draws the map sprite, edges and pins seen through the camera. Only what
+// the hit index finds in the visible area is drawn, parallel legs collapse
+// to one line per port pair, and crowded views shed detail: labels go
+// first, then nearby pins merge into numbered clusters. Zooming in brings
+// the detail back because fewer items are visible. With bundling on, each
+// pair is drawn as a curve routed through the centroids of the regions its
+// ports share, so routes between the same parts of the world run together.
+class MapNetworkRenderer {
+ public:
+  MapNetworkRenderer(Font& f) : bundled(false), curves(Lines) {
+    clusterShape.setFillColor(Color(220, 50, 50));
+    clusterShape.setOutlineThickness(3);
+    clusterShape.setOutlineColor(Color::White);
+    clusterText.setFont(f);
+    clusterText.setCharacterSize(16);
+    clusterText.setFillColor(Color::White);
+    clusterText.setOutlineThickness(2);
+    clusterText.setOutlineColor(Color::Black);
+  }
+
+  void draw(RenderTarget& target, const Sprite& mapSprite, EdgeBatch& batch,
+            vector<Location>& locations, const MapCamera& camera,
+            const MapHitIndex& hits) {
+    target.setView(camera.worldView());
+    target.draw(mapSprite);
+
+    FloatRect area = camera.visibleArea();
+    vector<int> visibleEdges =
+        strongestPerPair(hits.edgesIn(area), batch, hits);
+    if (bundled) {
+      drawBundles(target, visibleEdges, batch, locations);
+    } else if (visibleEdges.size() == batch.size()) {
+      batch.draw(target);
+    } else {
+      batch.drawSubset(target, visibleEdges);
+    }
 
-      Text timeText;
-      timeText.setFont(*font);
-      if (prefs.hasTimeFilter) {
-        int hours = prefs.maxVoyageTime / 60;
-        timeText.setString("  " + to_string(hours) + " hours");
-        timeText.setFillColor(Color(150, 200, 255));
-      } else {
-        timeText.setString("  No limit");
-        timeText.setFillColor(Color(200, 200, 200));
+    vector<int> visiblePins = hits.locationsIn(area);
+    if (visiblePins.size() > CLUSTER_PINS) {
+      drawClusters(target, locations, visiblePins, camera.zoom());
+    } else {
+      bool labels = visiblePins.size() <= LABELLED_PINS;
+      for (int i : visiblePins) {
+        if (labels) {
+          locations[i].draw(target);
+        } else {
+          target.draw(locations[i].pin);
+        }
       }
-      timeText.setCharacterSize(14);
-      timeText.setPosition(20, textY);
-      window.draw(timeText);
+    }
+    target.setView(camera.screenView());
+  }
 
-      for (auto btn : filterButtons) {
-        btn->draw(window);
-      }
-    } else {
-      RectangleShape collapsedBar(Vector2f(50, sidebarHeight));
-      collapsedBar.setPosition(0, 0);
-      collapsedBar.setFillColor(Color(40, 40, 40, 230));
-      collapsedBar.setOutlineThickness(3);
-      collapsedBar.setOutlineColor(Color(100, 100, 100));
-      window.draw(collapsedBar);
+  // Only the base network is bundled. Route overlays and MapHitIndex keep
+  // the straight segments.
+  void toggleBundling() { bundled = !bundled; }
+  bool bundling() const { return bundled; }
 
-      Text verticalText;
-      verticalText.setFont(*font);
-      verticalText.setString("FILTERS");
-      verticalText.setCharacterSize(18);
-      verticalText.setFillColor(Color::White);
-      verticalText.setRotation(90);
-      verticalText.setPosition(30, 100);
-      window.draw(verticalText);
+ private:
+  static const size_t LABELLED_PINS = 120;
+  static const size_t CLUSTER_PINS = 400;
+  static constexpr float CLUSTER_CELL = 64.0f;
+  // Region sizes of the two bundling levels, in world pixels, and how far
+  // curves are pulled back towards the straight line.
+  static constexpr float BUNDLE_CELLS[2] = {240.0f, 720.0f};
+  static constexpr float BUNDLE_STRAIGHTEN = 0.15f;
+  static const int CURVE_SEGMENTS = 12;
+
+  bool bundled;
+  CircleShape clusterShape;
+  Text clusterText;
+  vector<int> bestInGroup;
+  VertexArray curves;
+
+  // One edge per port pair, preferring the most opaque (filter-allowed) leg
+  // and, between equals, the later one that used to be drawn on top.
+  vector<int> strongestPerPair(const vector<int>& edges,
+                               const EdgeBatch& batch,
+                               const MapHitIndex& hits) {
+    bestInGroup.assign(hits.groupCount(), -1);
+    vector<int> kept;
+    for (int e : edges) {
+      int& best = bestInGroup[hits.groupOf(e)];
+      if (best == -1) {
+        best = kept.size();
+        kept.push_back(e);
+      } else if (batch.colorOf(e).a >= batch.colorOf(kept[best]).a) {
+        kept[best] = e;
+      }
+    }
+    sort(kept.begin(), kept.end());
+    return kept;
+  }
+
+  static pair<int, int> regionOf(Vector2f p, float cell) {
+    return {(int)floor(p.x / cell), (int)floor(p.y / cell)};
+  }
+
+  // Curves follow src -> its regions -> dst's regions -> dst, skipping the
+  // levels both ends share, and are drawn as one batch of line segments.
+  // Regions are cells of a two-level grid and the curve is the Bezier of
+  // that control polygon.
+  void drawBundles(RenderTarget& target, const vector<int>& edges,
+                   const EdgeBatch& batch,
+                   const vector<Location>& locations) {
+    map<pair<int, int>, pair<Vector2f, int>> regions[2];
+    for (const Location& location : locations) {
+      for (int level = 0; level < 2; level++) {
+        auto& region = regions[level][regionOf(location.position,
+                                               BUNDLE_CELLS[level])];
+        region.first += location.position;
+        region.second++;
+      }
+    }
+    auto centroid = [&](int level, Vector2f p) {
+      const auto& region = regions[level][regionOf(p, BUNDLE_CELLS[level])];
+      return region.second ? region.first / (float)region.second : p;
+    };
+
+    curves.resize(edges.size() * CURVE_SEGMENTS * 2);
+    size_t v = 0;
+    vector<Vector2f> controls, work;
+    for (int e : edges) {
+      pair<Vector2f, Vector2f> ends = batch.segment(e);
+      Vector2f a = ends.first, b = ends.second;
+      // The coarse regions nest the fine ones, so once a level is shared
+      // every coarser level is too.
+      int apart = 0;
+      while (apart < 2 && regionOf(a, BUNDLE_CELLS[apart]) !=
+                              regionOf(b, BUNDLE_CELLS[apart])) {
+        apart++;
+      }
+      controls.assign(1, a);
+      for (int level = 0; level < apart; level++) {
+        controls.push_back(centroid(level, a));
+      }
+      for (int level = apart - 1; level >= 0; level--) {
+        controls.push_back(centroid(level, b));
+      }
+      controls.push_back(b);
+      for (size_t i = 1; i + 1 < controls.size(); i++) {
+        float t = (float)i / (controls.size() - 1);
+        Vector2f straight = a + (b - a) * t;
+        controls[i] += (straight - controls[i]) * BUNDLE_STRAIGHTEN;
+      }
+
+      Color color = batch.colorOf(e);
+      Vector2f previous = a;
+      for (int k = 1; k <= CURVE_SEGMENTS; k++) {
+        float t = (float)k / CURVE_SEGMENTS;
+        work = controls;
+        for (size_t n = work.size() - 1; n > 0; n--) {
+          for (size_t i = 0; i < n; i++) {
+            work[i] += (work[i + 1] - work[i]) * t;
+          }
+        }
+        curves[v++] = Vertex(previous, color);
+        curves[v++] = Vertex(work[0], color);
+        previous = work[0];
+      }
     }
+    if (v > 0) target.draw(curves);
+  }
 
-    toggleButton->draw(window);
+  void drawClusters(RenderTarget& target, vector<Location>& locations,
+                    const vector<int>& pins, float zoom) {
+    struct Cluster {
+      Vector2f sum;
+      int count;
+      int first;
+    };
+    float cell = CLUSTER_CELL * zoom;
+    map<pair<int, int>, Cluster> clusters;
+    for (int i : pins) {
+      Vector2f p = locations[i].position;
+      auto key = make_pair((int)floor(p.x / cell), (int)floor(p.y / cell));
+      auto found = clusters.emplace(key, Cluster{Vector2f(0, 0), 0, i});
+      found.first->second.sum += p;
+      found.first->second.count++;
+    }
+    for (const auto& entry : clusters) {
+      const Cluster& c = entry.second;
+      if (c.count == 1) {
+        target.draw(locations[c.first].pin);
+        continue;
+      }
+      float radius = (18 + min(12, c.count)) * zoom;
+      Vector2f at = c.sum / (float)c.count;
+      clusterShape.setRadius(radius);
+      clusterShape.setOrigin(radius, radius);
+      clusterShape.setOutlineThickness(3 * zoom);
+      clusterShape.setPosition(at);
+      target.draw(clusterShape);
+
+      clusterText.setString(to_string(c.count));
+      clusterText.setScale(zoom, zoom);
+      FloatRect bounds = clusterText.getLocalBounds();
+      clusterText.setOrigin(bounds.left + bounds.width / 2,
+                            bounds.top + bounds.height / 2);
+      clusterText.setPosition(at);
+      target.draw(clusterText);
+    }
   }
+};
 
-  int checkClick(RenderWindow& window, Event& event) {
-    if (!isVisible) return -1;
+// Port positions as fractions of map.png. Ports with latitude/longitude are
+// projected (equirectangular, calibrated to the map artwork) once when they
+// first appear and kept, so a resize only rescales them. The layout also
+// remembers which graph the current pins and edges were built from, letting
+// loadMapView move and recolour them instead of recreating them. Ports
+// without coordinates get positions from ForceLayout once it has some.
+class MapLayout {
+ public:
+  MapLayout() : builtChange(0), builtPorts(0), builtEdges(0), built(false) {}
 
-    if (toggleButton->isClicked(window, event)) {
-      toggleExpand();
-      return -2;
+  void refresh(const Graph& graph) {
+    for (size_t i = normalized.size(); i < graph.ports.size(); i++) {
+      const Port& port = graph.ports[i];
+      normalized.push_back(project(port.latitude, port.longitude));
+      known.push_back(port.hasCoordinates);
+      generated.push_back(false);
     }
+  }
 
-    if (!isExpanded) return -1;
+  bool hasPosition(int port) const {
+    return port < (int)known.size() && (known[port] || generated[port]);
+  }
 
-    for (int i = 0; i < filterButtons.size(); i++) {
-      if (filterButtons[i]->isClicked(window, event)) {
-        return i;
-      }
+  bool isPinned(int port) const {
+    return port < (int)known.size() && known[port];
+  }
+
+  Vector2f normalizedPosition(int port) const { return normalized[port]; }
+
+  void setGenerated(int port, Vector2f pos) {
+    if (port >= (int)known.size() || known[port]) return;
+    normalized[port] = pos;
+    generated[port] = true;
+  }
+
+  // Moves the pins of generated ports, and the edges touching them, to the
+  // current generated positions without resetting their appearance.
+  void placeGenerated(const Graph& graph, vector<Location>& locations,
+                      vector<RouteEdge>& edges, Vector2u windowSize) const {
+    size_t count = min(locations.size(), generated.size());
+    for (size_t i = 0; i < count; i++) {
+      if (generated[i]) locations[i].moveTo(position(i, windowSize));
+    }
+    for (RouteEdge& edge : edges) {
+      int edgeId = edge.routeInfo.edgeId;
+      int dst = edge.routeInfo.destIdx;
+      if (edgeId < 0 || edgeId >= (int)graph.edgeTable.srcId.size()) continue;
+      int src = graph.edgeTable.srcId[edgeId];
+      if (src >= (int)count || dst < 0 || dst >= (int)count) continue;
+      if (!generated[src] && !generated[dst]) continue;
+      edge.setEndpoints(locations[src].position, locations[dst].position);
     }
+  }
 
-    return -1;
+  Vector2f position(int port, Vector2u windowSize) const {
+    return Vector2f(normalized[port].x * windowSize.x,
+                    normalized[port].y * windowSize.y);
   }
 
-  bool isMouseOverSidebar(RenderWindow& window) const {
-    if (!isVisible) return false;
+  static Vector2f project(float latitude, float longitude) {
+    float x = MAP_WEST + (longitude + 180) / 360 * (MAP_EAST - MAP_WEST);
+    float y = MAP_NORTH + (NORTH_LATITUDE - latitude) /
+                              (NORTH_LATITUDE - SOUTH_LATITUDE) *
+                              (MAP_SOUTH - MAP_NORTH);
+    return Vector2f(x, y);
+  }
 
-    Vector2i mousePos = Mouse::getPosition(window);
-    float width = isExpanded ? sidebarWidth : 50;
+  bool builtFrom(const Graph& graph, const vector<Location>& locations,
+                 const vector<RouteEdge>& edges) const {
+    return built && builtChange == graph.getChangeCount() &&
+           builtPorts == graph.ports.size() &&
+           locations.size() == builtPorts && edges.size() == builtEdges &&
+           edgeEnds.size() == builtEdges;
+  }
 
-    return (mousePos.x >= 0 && mousePos.x <= width && mousePos.y >= 0 &&
-            mousePos.y <= sidebarHeight);
+  void markBuilt(const Graph& graph, Vector2u windowSize) {
+    built = true;
+    builtChange = graph.getChangeCount();
+    builtPorts = graph.ports.size();
+    builtEdges = edgeEnds.size();
+    builtSize = windowSize;
   }
+
+  Vector2u builtWindowSize() const { return builtSize; }
+
+  vector<pair<int, int>> edgeEnds;
+
+ private:
+  // Where longitude -180/180 and latitude 83N/56S fall on map.png.
+  static constexpr float MAP_WEST = 0.026f;
+  static constexpr float MAP_EAST = 0.918f;
+  static constexpr float MAP_NORTH = 0.139f;
+  static constexpr float MAP_SOUTH = 0.861f;
+  static constexpr float NORTH_LATITUDE = 83;
+  static constexpr float SOUTH_LATITUDE = -56;
+
+  vector<Vector2f> normalized;
+  vector<char> known;
+  vector<char> generated;
+  size_t builtChange;
+  size_t builtPorts;
+  size_t builtEdges;
+  Vector2u builtSize;
+  bool built;
 };
-class RouteEdge {
- public:
-  Vector2f start;
-  Vector2f end;
-  Route routeInfo;
-  string sourceName;
-  RectangleShape line;
-  Color normalColor;
-  Color hoverColor;
-  bool isHovered;
 
-  RouteEdge(Vector2f s, Vector2f e, const Route& r, const string& src)
-      : start(s), end(e), routeInfo(r), sourceName(src), isHovered(false) {
-    Vector2f direction = end - start;
-    float length = sqrt(direction.x * direction.x + direction.y * direction.y);
-    float angle = atan2(direction.y, direction.x) * 180 / 3.14159f;
-    line.setSize(Vector2f(length, 2.5));
-    line.setPosition(start);
-    line.setRotation(angle);
+// Barnes-Hut force-directed placement for ports that have no coordinates,
+// solved on a background thread in MapLayout's normalised map space. Ports
+// with coordinates are pinned and only push the free ports around; links
+// pull connected ports together. Force evaluation is split across worker
+// threads each iteration, and intermediate positions are published a few
+// times a second for the main loop to pick up through poll().
+class ForceLayout {
+ public:
+  struct Problem {
+    vector<Vector2f> positions;
+    vector<char> pinned;
+    vector<pair<int, int>> links;
+    bool warm = false;
+  };
 
-    int costLevel = min(routeInfo.cost / 100, 255);
-    normalColor = Color(255, 50, 50, 255);
-    hoverColor = Color(255, 165, 0, 255);
-    line.setFillColor(normalColor);
+  ForceLayout()
+      : running(false), cancelled(false), published(0), consumed(0),
+        iterations(0), seconds(0) {}
+  ~ForceLayout() { stop(); }
+
+  static Problem fromGraph(const Graph& graph, MapLayout& layout) {
+    layout.refresh(graph);
+    Problem problem;
+    int n = graph.ports.size();
+    problem.positions.resize(n);
+    problem.pinned.resize(n);
+    problem.warm = true;
+    for (int i = 0; i < n; i++) {
+      problem.pinned[i] = layout.isPinned(i);
+      if (layout.hasPosition(i)) {
+        problem.positions[i] = layout.normalizedPosition(i);
+      } else {
+        problem.warm = false;
+      }
+    }
+    set<pair<int, int>> seen;
+    for (int i = 0; i < n; i++) {
+      for (const Route& route : graph.routes[i]) {
+        int j = route.destIdx;
+        if (j < 0 || j == i) continue;
+        if (seen.insert({min(i, j), max(i, j)}).second) {
+          problem.links.push_back({i, j});
+        }
+      }
+    }
+    mt19937 rng(n);
+    uniform_real_distribution<float> jitter(-0.02f, 0.02f);
+    uniform_real_distribution<float> anywhere(0.15f, 0.85f);
+    vector<vector<int>> pinnedNeighbours(n);
+    for (const pair<int, int>& link : problem.links) {
+      if (problem.pinned[link.second]) {
+        pinnedNeighbours[link.first].push_back(link.second);
+      }
+      if (problem.pinned[link.first]) {
+        pinnedNeighbours[link.second].push_back(link.first);
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      if (layout.hasPosition(i)) continue;
+      Vector2f start(anywhere(rng), anywhere(rng));
+      if (!pinnedNeighbours[i].empty()) {
+        start = Vector2f(0, 0);
+        for (int j : pinnedNeighbours[i]) start += problem.positions[j];
+        start /= (float)pinnedNeighbours[i].size();
+      }
+      problem.positions[i] = start + Vector2f(jitter(rng), jitter(rng));
+    }
+    return problem;
   }
 
-  bool isMouseOver(RenderWindow& window) {
-    Vector2i mousePos = Mouse::getPosition(window);
-    Vector2f mousePosF = static_cast<Vector2f>(mousePos);
-    Vector2f dir = end - start;
-    float lineLength = sqrt(dir.x * dir.x + dir.y * dir.y);
+  // Starts (or restarts) the solver. Returns false when no port is free to
+  // move.
+  bool start(Problem problem) {
+    stop();
+    freePorts.clear();
+    for (size_t i = 0; i < problem.pinned.size(); i++) {
+      if (!problem.pinned[i]) freePorts.push_back(i);
+    }
+    if (freePorts.empty()) return false;
+    snapshot = problem.positions;
+    published = 0;
+    consumed = 0;
+    running = true;
+    worker = thread(&ForceLayout::run, this, move(problem));
+    return true;
+  }
 
-    if (lineLength == 0) return false;
-    Vector2f toMouse = mousePosF - start;
-    float t =
-        (toMouse.x * dir.x + toMouse.y * dir.y) / (lineLength * lineLength);
-    t = max(0.0f, min(1.0f, t));
+  bool start(const Graph& graph, MapLayout& layout) {
+    return start(fromGraph(graph, layout));
+  }
 
-    Vector2f projection = start + dir * t;
-    Vector2f diff = mousePosF - projection;
-    float distance = sqrt(diff.x * diff.x + diff.y * diff.y);
+  void stop() {
+    cancelled = true;
+    if (worker.joinable()) worker.join();
+    cancelled = false;
+  }
 
-    return distance < 15.0f;
+  void wait() {
+    if (worker.joinable()) worker.join();
   }
 
-  void update(RenderWindow& window) { isHovered = isMouseOver(window); }
+  bool isRunning() const { return running; }
 
-  bool isClicked(RenderWindow& window, Event& event) {
-    if (event.type == Event::MouseButtonReleased &&
-        event.mouseButton.button == Mouse::Left) {
-      return isMouseOver(window);
-    }
-    return false;
+  // Copies the newest published positions into the layout; returns whether
+  // anything changed since the last call.
+  bool poll(MapLayout& layout) {
+    unsigned latest = published;
+    if (latest == consumed) return false;
+    lock_guard<mutex> lock(snapshotMutex);
+    for (int i : freePorts) layout.setGenerated(i, snapshot[i]);
+    consumed = latest;
+    return true;
   }
-  bool isAllowed() const { return line.getFillColor().a > 150; }
-  void setSelected(bool selected) {
-    if (selected) {
-      line.setFillColor(hoverColor);
-    } else {
-      line.setFillColor(normalColor);
+
+  int lastIterations() const { return iterations; }
+  float lastSeconds() const { return seconds; }
+
+ private:
+  static constexpr float THETA = 1.0f;
+  static constexpr float MIN_DISTANCE = 1e-6f;
+  static constexpr int MAX_DEPTH = 24;
+  static constexpr int MAX_ITERATIONS = 500;
+  static constexpr int PARALLEL_THRESHOLD = 512;
+
+  // Reusable rendezvous for the solver and its helper threads; the last
+  // thread to arrive releases the others and starts the next round.
+  class Barrier {
+   public:
+    explicit Barrier(int count) : count(count), waiting(0), round(0) {}
+
+    void wait() {
+      unique_lock<mutex> lock(roundMutex);
+      unsigned arrivedIn = round;
+      if (++waiting == count) {
+        waiting = 0;
+        round++;
+        released.notify_all();
+        return;
+      }
+      released.wait(lock, [&] { return round != arrivedIn; });
     }
-  }
 
-  void draw(RenderWindow& window) { window.draw(line); }
+   private:
+    mutex roundMutex;
+    condition_variable released;
+    int count;
+    int waiting;
+    unsigned round;
+  };
 
-  vector<string> getRouteDetails() {
-    vector<string> details;
-    details.push_back("Route: " + sourceName + " -> " + routeInfo.destination);
-    details.push_back("Date: " + routeInfo.date);
-    details.push_back("Departure: " + routeInfo.depTime);
-    details.push_back("Arrival: " + routeInfo.arrTime);
-    details.push_back("Cost: $" + to_string(routeInfo.cost));
-    details.push_back("Company: " + routeInfo.company);
-    return details;
-  }
+  struct Cell {
+    float cx, cy, half;
+    float mass, sumX, sumY;
+    int child;
+    int body;
+  };
+
+  void buildTree(const vector<Vector2f>& pos) {
+    float minX = pos[0].x, maxX = pos[0].x, minY = pos[0].y, maxY = pos[0].y;
+    for (const Vector2f& p : pos) {
+      minX = min(minX, p.x);
+      maxX = max(maxX, p.x);
+      minY = min(minY, p.y);
+      maxY = max(maxY, p.y);
+    }
+    float half = max(maxX - minX, maxY - minY) / 2 + MIN_DISTANCE;
+    cells.clear();
+    cells.push_back(
+        {(minX + maxX) / 2, (minY + maxY) / 2, half, 0, 0, 0, -1, -1});
+    for (size_t b = 0; b < pos.size(); b++) insert(b, pos);
+  }
+
+  int quadrant(int c, const Vector2f& p) const {
+    return cells[c].child + (p.x >= cells[c].cx ? 1 : 0) +
+           (p.y >= cells[c].cy ? 2 : 0);
+  }
+
+  void insert(int b, const vector<Vector2f>& pos) {
+    int c = 0;
+    for (int depth = 0;; depth++) {
+      cells[c].mass += 1;
+      cells[c].sumX += pos[b].x;
+      cells[c].sumY += pos[b].y;
+      if (cells[c].child == -1) {
+        if (cells[c].mass == 1) {
+          cells[c].body = b;
+          return;
+        }
+        if (depth >= MAX_DEPTH) {
+          cells[c].body = -1;
+          return;
+        }
+        int old = cells[c].body;
+        cells[c].body = -1;
+        cells[c].child = cells.size();
+        float h = cells[c].half / 2;
+        for (int q = 0; q < 4; q++) {
+          float x = cells[c].cx + (q & 1 ? h : -h);
+          float y = cells[c].cy + (q & 2 ? h : -h);
+          cells.push_back({x, y, h, 0, 0, 0, -1, -1});
+        }
+        if (old >= 0) {
+          Cell& moved = cells[quadrant(c, pos[old])];
+          moved.mass = 1;
+          moved.sumX = pos[old].x;
+          moved.sumY = pos[old].y;
+          moved.body = old;
+        }
+      }
+      c = quadrant(c, pos[b]);
+    }
+  }
+
+  Vector2f repulsion(int b, const vector<Vector2f>& pos, float k2,
+                     vector<int>& stack) const {
+    Vector2f force(0, 0);
+    stack.assign(1, 0);
+    while (!stack.empty()) {
+      const Cell& cell = cells[stack.back()];
+      stack.pop_back();
+      if (cell.mass == 0 || cell.body == b) continue;
+      float dx = pos[b].x - cell.sumX / cell.mass;
+      float dy = pos[b].y - cell.sumY / cell.mass;
+      float d2 = max(dx * dx + dy * dy, MIN_DISTANCE);
+      float size = cell.half * 2;
+      if (cell.child == -1 || size * size < THETA * THETA * d2) {
+        float mass = cell.mass;
+        // An over-deep leaf holding b must not count b itself.
+        if (cell.child == -1 && cell.body == -1 &&
+            fabs(pos[b].x - cell.cx) <= cell.half &&
+            fabs(pos[b].y - cell.cy) <= cell.half) {
+          mass -= 1;
+        }
+        force += Vector2f(dx, dy) * (k2 * mass / d2);
+      } else {
+        for (int q = 0; q < 4; q++) stack.push_back(cell.child + q);
+      }
+    }
+    return force;
+  }
+
+  void run(Problem problem) {
+    Clock clock;
+    vector<Vector2f>& pos = problem.positions;
+    int n = pos.size();
+    vector<vector<int>> adjacent(n);
+    for (const pair<int, int>& link : problem.links) {
+      adjacent[link.first].push_back(link.second);
+      adjacent[link.second].push_back(link.first);
+    }
+    float k = 0.6f / sqrt((float)n);
+    float k2 = k * k;
+    float temperature = problem.warm ? 0.01f : 0.1f;
+    vector<Vector2f> step(freePorts.size());
+
+    auto evaluate = [&](size_t from, size_t to) {
+      vector<int> stack;
+      for (size_t f = from; f < to; f++) {
+        int b = freePorts[f];
+        Vector2f force = repulsion(b, pos, k2, stack);
+        for (int j : adjacent[b]) {
+          Vector2f d = pos[j] - pos[b];
+          force += d * (sqrt(d.x * d.x + d.y * d.y) / k);
+        }
+        Vector2f centre = Vector2f(0.5f, 0.5f) - pos[b];
+        force += centre * (0.1f * sqrt(centre.x * centre.x +
+                                       centre.y * centre.y) / k);
+        step[f] = force;
+      }
+    };
+
+    int threads = freePorts.size() < PARALLEL_THRESHOLD
+                      ? 1
+                      : max(1u, min(8u, thread::hardware_concurrency()));
+    size_t chunk = (freePorts.size() + threads - 1) / threads;
+    auto evaluateSlice = [&](int t) {
+      size_t from = min(freePorts.size(), t * chunk);
+      evaluate(from, min(freePorts.size(), from + chunk));
+    };
+
+    // Helpers live for the whole solve. Each iteration they wait for the
+    // tree, evaluate their slice and meet the solver again before it moves
+    // the ports.
+    Barrier barrier(threads);
+    bool finished = false;
+    vector<thread> helpers;
+    for (int t = 1; t < threads; t++) {
+      helpers.push_back(thread([&, t] {
+        while (true) {
+          barrier.wait();
+          if (finished) return;
+          evaluateSlice(t);
+          barrier.wait();
+        }
+      }));
+    }
+
+    Clock sincePublish;
+    int iteration = 0;
+    for (; iteration < MAX_ITERATIONS && !cancelled; iteration++) {
+      buildTree(pos);
+      if (threads > 1) barrier.wait();
+      evaluateSlice(0);
+      if (threads > 1) barrier.wait();
+
+      float largest = 0;
+      for (size_t f = 0; f < freePorts.size(); f++) {
+        Vector2f& p = pos[freePorts[f]];
+        float length = sqrt(step[f].x * step[f].x + step[f].y * step[f].y);
+        if (length > 0) {
+          float move = min(length, temperature);
+          p += step[f] * (move / length);
+          largest = max(largest, move);
+        }
+        p.x = min(0.97f, max(0.03f, p.x));
+        p.y = min(0.95f, max(0.05f, p.y));
+      }
+      temperature *= 0.98f;
+      if (sincePublish.getElapsedTime().asMilliseconds() >= 50) {
+        publish(pos);
+        sincePublish.restart();
+      }
+      if (largest < 1e-4f) break;
+    }
+    finished = true;
+    if (threads > 1) barrier.wait();
+    for (thread& helper : helpers) helper.join();
+    publish(pos);
+    iterations = iteration;
+    seconds = clock.getElapsedTime().asSeconds();
+    running = false;
+  }
+
+  void publish(const vector<Vector2f>& pos) {
+    lock_guard<mutex> lock(snapshotMutex);
+    snapshot = pos;
+    published++;
+  }
+
+  vector<int> freePorts;
+  vector<Cell> cells;
+  vector<Vector2f> snapshot;
+  mutex snapshotMutex;
+  thread worker;
+  atomic<bool> running;
+  atomic<bool> cancelled;
+  atomic<unsigned> published;
+  unsigned consumed;
+  atomic<int> iterations;
+  atomic<float> seconds;
 };
 
 void loadMapView(Texture& backgroundTexture, Sprite& backgroundSprite,
                  vector<Location>& locations, vector<RouteEdge>& edges,
-                 RenderWindow& window, Font& font, Graph& graph) {
-  if (backgroundTexture.loadFromFile("map.png")) {
-    backgroundSprite.setTexture(backgroundTexture);
-    Vector2u textureSize = backgroundTexture.getSize();
-    Vector2u windowSize = window.getSize();
-
-    float scaleX = (float)windowSize.x / textureSize.x;
-    float scaleY = (float)windowSize.y / textureSize.y;
-
-    backgroundSprite.setScale(scaleX, scaleY);
-    locations.clear();
-    edges.clear();
-    int numPorts = graph.ports.size();
-
-    float screenWidth = windowSize.x;
-    float screenHeight = windowSize.y;
-    float margin = 80;
-
-    vector<pair<Vector2f, Vector2f>> safeZones = {
-        {Vector2f(margin, margin),
-         Vector2f(screenWidth * 0.25f, screenHeight * 0.25f)},
-        {Vector2f(screenWidth * 0.35f, margin),
-         Vector2f(screenWidth * 0.65f, screenHeight * 0.25f)},
-        {Vector2f(screenWidth * 0.75f, margin),
-         Vector2f(screenWidth - margin, screenHeight * 0.25f)},
-
-        {Vector2f(margin, screenHeight * 0.30f),
-         Vector2f(screenWidth * 0.25f, screenHeight * 0.50f)},
-        {Vector2f(screenWidth * 0.35f, screenHeight * 0.30f),
-         Vector2f(screenWidth * 0.65f, screenHeight * 0.50f)},
-        {Vector2f(screenWidth * 0.75f, screenHeight * 0.30f),
-         Vector2f(screenWidth - margin, screenHeight * 0.50f)},
-
-        {Vector2f(margin, screenHeight * 0.55f),
-         Vector2f(screenWidth * 0.25f, screenHeight * 0.75f)},
-        {Vector2f(screenWidth * 0.35f, screenHeight * 0.55f),
-         Vector2f(screenWidth * 0.65f, screenHeight * 0.75f)},
-        {Vector2f(screenWidth * 0.75f, screenHeight * 0.55f),
-         Vector2f(screenWidth - margin, screenHeight * 0.75f)},
-
-        {Vector2f(margin, screenHeight * 0.78f),
-         Vector2f(screenWidth * 0.30f, screenHeight - margin)},
-        {Vector2f(screenWidth * 0.35f, screenHeight * 0.78f),
-         Vector2f(screenWidth * 0.65f, screenHeight - margin)},
-        {Vector2f(screenWidth * 0.70f, screenHeight * 0.78f),
-         Vector2f(screenWidth - margin, screenHeight - margin)}};
-
-    int portsPerZone = (numPorts + safeZones.size() - 1) / safeZones.size();
+                 RenderWindow& window, Font& font, Graph& graph,
+                 MapHitIndex& hits, MapLayout& layout) {
+  if (backgroundTexture.getSize().x == 0 &&
+      !backgroundTexture.loadFromFile("map.png")) {
+    cout << "Error: Could not load map.png" << endl;
+    return;
+  }
+  backgroundSprite.setTexture(backgroundTexture);
+  Vector2u textureSize = backgroundTexture.getSize();
+  Vector2u windowSize = window.getSize();
 
-    for (int i = 0; i < numPorts; i++) {
-      int zoneIdx = i / portsPerZone;
-      if (zoneIdx >= safeZones.size()) zoneIdx = safeZones.size() - 1;
+  float scaleX = (float)windowSize.x / textureSize.x;
+  float scaleY = (float)windowSize.y / textureSize.y;
+
+  backgroundSprite.setScale(scaleX, scaleY);
+  layout.refresh(graph);
+  int numPorts = graph.ports.size();
+  vector<Vector2f> positions(numPorts);
+  for (int i = 0; i < numPorts; i++) {
+    if (layout.hasPosition(i)) positions[i] = layout.position(i, windowSize);
+  }
+
+  float screenWidth = windowSize.x;
+  float screenHeight = windowSize.y;
+  float margin = 80;
+
+  vector<pair<Vector2f, Vector2f>> safeZones = {
+      {Vector2f(margin, margin),
+       Vector2f(screenWidth * 0.25f, screenHeight * 0.25f)},
+      {Vector2f(screenWidth * 0.35f, margin),
+       Vector2f(screenWidth * 0.65f, screenHeight * 0.25f)},
+      {Vector2f(screenWidth * 0.75f, margin),
+       Vector2f(screenWidth - margin, screenHeight * 0.25f)},
+
+      {Vector2f(margin, screenHeight * 0.30f),
+       Vector2f(screenWidth * 0.25f, screenHeight * 0.50f)},
+      {Vector2f(screenWidth * 0.35f, screenHeight * 0.30f),
+       Vector2f(screenWidth * 0.65f, screenHeight * 0.50f)},
+      {Vector2f(screenWidth * 0.75f, screenHeight * 0.30f),
+       Vector2f(screenWidth - margin, screenHeight * 0.50f)},
+
+      {Vector2f(margin, screenHeight * 0.55f),
+       Vector2f(screenWidth * 0.25f, screenHeight * 0.75f)},
+      {Vector2f(screenWidth * 0.35f, screenHeight * 0.55f),
+       Vector2f(screenWidth * 0.65f, screenHeight * 0.75f)},
+      {Vector2f(screenWidth * 0.75f, screenHeight * 0.55f),
+       Vector2f(screenWidth - margin, screenHeight * 0.75f)},
+
+      {Vector2f(margin, screenHeight * 0.78f),
+       Vector2f(screenWidth * 0.30f, screenHeight - margin)},
+      {Vector2f(screenWidth * 0.35f, screenHeight * 0.78f),
+       Vector2f(screenWidth * 0.65f, screenHeight - margin)},
+      {Vector2f(screenWidth * 0.70f, screenHeight * 0.78f),
+       Vector2f(screenWidth - margin, screenHeight - margin)}};
+
+  int portsPerZone = (numPorts + safeZones.size() - 1) / safeZones.size();
+
+  for (int i = 0; i < numPorts; i++) {
+    if (layout.hasPosition(i)) continue;
+    int zoneIdx = i / portsPerZone;
+    if (zoneIdx >= safeZones.size()) zoneIdx = safeZones.size() - 1;
 
-      int portInZone = i % portsPerZone;
+    int portInZone = i % portsPerZone;
 
-      Vector2f zoneMin = safeZones[zoneIdx].first;
-      Vector2f zoneMax = safeZones[zoneIdx].second;
+    Vector2f zoneMin = safeZones[zoneIdx].first;
+    Vector2f zoneMax = safeZones[zoneIdx].second;
 
-      int cols = min(3, portsPerZone);
-      int col = portInZone % cols;
-      int row = portInZone / cols;
+    int cols = min(3, portsPerZone);
+    int col = portInZone % cols;
+    int row = portInZone / cols;
 
-      float zoneWidth = zoneMax.x - zoneMin.x;
-      float zoneHeight = zoneMax.y - zoneMin.y;
+    float zoneWidth = zoneMax.x - zoneMin.x;
+    float zoneHeight = zoneMax.y - zoneMin.y;
 
-      float x = zoneMin.x + (col * zoneWidth / max(1.0f, (float)(cols - 1)));
-      float y = zoneMin.y +
-                (row * zoneHeight /
-                 max(1.0f, (float)((portsPerZone + cols - 1) / cols - 1)));
+    float x = zoneMin.x + (col * zoneWidth / max(1.0f, (float)(cols - 1)));
+    float y = zoneMin.y +
+              (row * zoneHeight /
+               max(1.0f, (float)((portsPerZone + cols - 1) / cols - 1)));
 
-      if (portsPerZone > 1) {
-        x += (i % 5 - 2) * 15;
-        y += ((i * 3) % 5 - 2) * 15;
+    if (portsPerZone > 1) {
+      x += (i % 5 - 2) * 15;
+      y += ((i * 3) % 5 - 2) * 15;
+    }
+
+    if (x < zoneMin.x) x = zoneMin.x;
+    if (x > zoneMax.x) x = zoneMax.x;
+    if (y < zoneMin.y) y = zoneMin.y;
+    if (y > zoneMax.y) y = zoneMax.y;
+
+    positions[i] = Vector2f(x, y);
+  }
+
+  if (layout.builtFrom(graph, locations, edges)) {
+    bool moved = layout.builtWindowSize() != windowSize;
+    for (int i = 0; i < numPorts; i++) {
+      locations[i].resetAppearance();
+      if (moved) locations[i].moveTo(positions[i]);
+    }
+    for (size_t i = 0; i < edges.size(); i++) {
+      edges[i].resetAppearance();
+      if (moved) {
+        edges[i].setEndpoints(positions[layout.edgeEnds[i].first],
+                              positions[layout.edgeEnds[i].second]);
       }
+    }
+    if (moved || !hits.isCurrent(locations, edges)) {
+      hits.build(locations, edges);
+    }
+    layout.markBuilt(graph, windowSize);
+    return;
+  }
+
+  locations.clear();
+  edges.clear();
+  layout.edgeEnds.clear();
+  for (int i = 0; i < numPorts; i++) {
+    locations.push_back(Location(graph.ports[i].name, positions[i], font));
+  }
+  for (int i = 0; i < numPorts; i++) {
+    string sourceName = graph.ports[i].name;
+    for (const Route& route : graph.routes[i]) {
+      int j = route.destIdx;
+      if (j < 0 || j >= numPorts) continue;
+      edges.push_back(
+          RouteEdge(positions[i], positions[j], route, sourceName));
+      layout.edgeEnds.push_back({i, j});
+    }
+  }
+  hits.build(locations, edges);
+  layout.markBuilt(graph, windowSize);
+}
 
-      if (x < zoneMin.x) x = zoneMin.x;
-      if (x > zoneMax.x) x = zoneMax.x;
-      if (y < zoneMin.y) y = zoneMin.y;
-      if (y > zoneMax.y) y = zoneMax.y;
+// Position of each edge id in the map's edge list, or -1. The index is
+// rebuilt when the list was replaced behind its back (e.g. by loadMapView).
+class MapEdgeIndex {
+ public:
+  int find(const vector<RouteEdge>& edges, int edgeId) {
+    if (edgeId < 0) return -1;
+    int i = lookup(edgeId);
+    bool moved = i != -1 && (i >= edges.size() ||
+                             edges[i].routeInfo.edgeId != edgeId);
+    if (edges.size() != indexed || moved) {
+      rebuild(edges);
+      i = lookup(edgeId);
+    }
+    return i;
+  }
+
+  void push(vector<RouteEdge>& edges, const RouteEdge& edge) {
+    edges.push_back(edge);
+    place(edge.routeInfo.edgeId, edges.size() - 1);
+    indexed = edges.size();
+  }
 
-      locations.push_back(Location(graph.ports[i].name, Vector2f(x, y), font));
+  // Moves the last edge into the hole, so no other entry shifts.
+  void erase(vector<RouteEdge>& edges, int i) {
+    place(edges[i].routeInfo.edgeId, -1);
+    if (i + 1 < edges.size()) {
+      edges[i] = edges.back();
+      place(edges[i].routeInfo.edgeId, i);
     }
+    edges.pop_back();
+    indexed = edges.size();
+  }
 
-    for (int i = 0; i < graph.ports.size(); i++) {
-      string sourceName = graph.ports[i].name;
-      Vector2f sourcePos = locations[i].position;
+ private:
+  vector<int> slot;
+  size_t indexed = 0;
 
-      for (const Route& route : graph.routes[i]) {
-        for (int j = 0; j < graph.ports.size(); j++) {
-          if (graph.ports[j].name == route.destination) {
-            Vector2f destPos = locations[j].position;
-            edges.push_back(RouteEdge(sourcePos, destPos, route, sourceName));
-            break;
-          }
+  int lookup(int edgeId) const {
+    return edgeId < slot.size() ? slot[edgeId] : -1;
+  }
+
+  void place(int edgeId, int i) {
+    if (edgeId < 0) return;
+    if (edgeId >= slot.size()) slot.resize(edgeId + 1, -1);
+    slot[edgeId] = i;
+  }
+
+  void rebuild(const vector<RouteEdge>& edges) {
+    slot.assign(slot.size(), -1);
+    for (size_t i = 0; i < edges.size(); i++) {
+      place(edges[i].routeInfo.edgeId, i);
+    }
+    indexed = edges.size();
+  }
+};
+
+int syncMapWithGraph(const Graph& graph, size_t& syncedChange,
+                     vector<Location>& locations, vector<RouteEdge>& edges,
+                     MapEdgeIndex& edgeIndex, RenderWindow& window,
+                     Font& font) {
+  int touchedEdges = 0;
+  if (locations.empty()) {
+    syncedChange = graph.getChangeCount();
+    return 0;
+  }
+
+  while (syncedChange < graph.getChangeCount()) {
+    const GraphChange& change = graph.changeLog[syncedChange++];
+
+    if (change.type == GraphChange::PORT_ADDED) {
+      int newIdx = change.srcIdx;
+      if (newIdx >= locations.size()) {
+        Vector2u windowSize = window.getSize();
+        float x = 80 + fmod(newIdx * 137.0f,
+                            max(1.0f, (float)windowSize.x - 160));
+        float y = 80 + fmod(newIdx * 89.0f,
+                            max(1.0f, (float)windowSize.y - 160));
+        locations.push_back(
+            Location(graph.ports[newIdx].name, Vector2f(x, y), font));
+      }
+      // Legs that named the port before it existed now point at it.
+      for (int edgeId : graph.incoming[newIdx]) {
+        const Route* route = graph.edgeRoute(edgeId);
+        int src = graph.edgeTable.srcId[edgeId];
+        if (!route || src >= locations.size() ||
+            newIdx >= locations.size() ||
+            edgeIndex.find(edges, edgeId) != -1) {
+          continue;
         }
+        edgeIndex.push(edges,
+                       RouteEdge(locations[src].position,
+                                 locations[newIdx].position, *route,
+                                 graph.ports[src].name));
+        touchedEdges++;
       }
+      continue;
+    }
+
+    if (change.srcIdx == -1 || change.destIdx == -1 ||
+        change.srcIdx >= locations.size() ||
+        change.destIdx >= locations.size()) {
+      continue;
+    }
+
+    int existing = edgeIndex.find(edges, change.route.edgeId);
+    if (change.type == GraphChange::ROUTE_ADDED && existing == -1) {
+      edgeIndex.push(edges, RouteEdge(locations[change.srcIdx].position,
+                                      locations[change.destIdx].position,
+                                      change.route,
+                                      graph.ports[change.srcIdx].name));
+      touchedEdges++;
+    } else if (change.type == GraphChange::ROUTE_REMOVED && existing != -1) {
+      edgeIndex.erase(edges, existing);
+      touchedEdges++;
     }
-  } else {
-    cout << "Error: Could not load map.png" << endl;
   }
+  return touchedEdges;
+}
+vector<string> describeRoutePair(const RouteEdge& edge,
+                                 const MapHitIndex::PairSummary& pair) {
+  vector<string> info;
+  info.push_back(edge.sourceName + " - " + edge.routeInfo.destination);
+  info.push_back(to_string(pair.legs) +
+                 (pair.legs == 1 ? " sailing" : " sailings"));
+  string cost = "$" + to_string(pair.minCost);
+  if (pair.maxCost != pair.minCost) cost += " - $" + to_string(pair.maxCost);
+  info.push_back("Cost: " + cost);
+  string time = to_string(pair.minTime / 60) + "h " +
+                to_string(pair.minTime % 60) + "m";
+  if (pair.maxTime != pair.minTime) {
+    time += " - " + to_string(pair.maxTime / 60) + "h " +
+            to_string(pair.maxTime % 60) + "m";
+  }
+  info.push_back("Travel Time: " + time);
+  return info;
 }
+
 vector<string> getPortInfo(const Location& location, Graph& graph) {
   vector<string> info;
   int portIdx = -1;
@@ -2164,15 +5822,7 @@ vector<string> getPortInfo(const Location& location, Graph& graph) {
   info.push_back("");
 
   int outgoingRoutes = graph.routes[portIdx].size();
-  int incomingRoutes = 0;
-
-  for (int i = 0; i < graph.routes.size(); i++) {
-    for (const Route& route : graph.routes[i]) {
-      if (route.destination == graph.ports[portIdx].name) {
-        incomingRoutes++;
-      }
-    }
-  }
+  int incomingRoutes = graph.incomingCount(portIdx);
 
   info.push_back("Outgoing Routes: " + to_string(outgoingRoutes));
   info.push_back("Incoming Routes: " + to_string(incomingRoutes));
@@ -2459,9 +6109,12 @@ void customShipPreferences(const UserPreferences& prefs,
                            vector<Location>& locations,
                            vector<RouteEdge>& edges, const Graph& g) {
   cout << "\n=== Applying Custom Ship Preferences ===" << endl;
+  SearchConstraints constraints = g.compileConstraints(prefs);
+  vector<uint64_t> allowedEdges = g.edgeTable.filter(constraints);
 
   for (int i = 0; i < locations.size(); i++) {
-    bool isAvoidPort = g.portIsAvoid(locations[i].name, prefs);
+    bool isAvoidPort =
+        !constraints.allowsPort(g.getPortIndex(locations[i].name));
 
     if (isAvoidPort) {
       locations[i].pin.setFillColor(Color(150, 150, 150));
@@ -2481,15 +6134,17 @@ void customShipPreferences(const UserPreferences& prefs,
   int blockedRoutes = 0;
 
   for (auto& edge : edges) {
-    bool sourceAvoid = g.portIsAvoid(edge.sourceName, prefs);
-    bool destAvoid = g.portIsAvoid(edge.routeInfo.destination, prefs);
+    int id = edge.routeInfo.edgeId;
+    bool portBlocked = id < 0 || id >= g.edgeTable.count ||
+                       !constraints.allowsPort(g.edgeTable.srcId[id]) ||
+                       !constraints.allowsPort(g.edgeTable.dstId[id]);
 
-    if (sourceAvoid || destAvoid) {
+    if (portBlocked) {
       edge.line.setFillColor(Color(150, 150, 150, 100));
       blockedRoutes++;
       cout << "Route blocked: " << edge.sourceName << " -> "
            << edge.routeInfo.destination << " (Avoid port)" << endl;
-    } else if (g.routeMatchesPreferences(edge.routeInfo, prefs)) {
+    } else if (EdgeTable::test(allowedEdges, id)) {
       edge.line.setFillColor(Color(0, 255, 0, 255));
       allowedRoutes++;
       cout << "Route allowed: " << edge.sourceName << " -> "
@@ -2502,44 +6157,242 @@ void customShipPreferences(const UserPreferences& prefs,
     }
   }
 
-  cout << "\nRoute Summary:" << endl;
-  cout << "Allowed routes: " << allowedRoutes << endl;
-  cout << "Blocked/Not preferred routes: " << blockedRoutes << endl;
+  cout << "\nRoute Summary:" << endl;
+  cout << "Allowed routes: " << allowedRoutes << endl;
+  cout << "Blocked/Not preferred routes: " << blockedRoutes << endl;
+
+  cout << "\nApplied Preferences:" << endl;
+
+  if (prefs.hasCompanyFilter) {
+    cout << "Preferred Companies: ";
+    for (const string& company : prefs.preferredCompanies) {
+      cout << company << " ";
+    }
+    cout << endl;
+  }
+
+  if (prefs.hasPortFilter) {
+    cout << "Avoid Ports: ";
+    for (const string& port : prefs.avoidPorts) {
+      cout << port << " ";
+    }
+    cout << endl;
+  }
+
+  if (prefs.hasTimeFilter) {
+    cout << "Max Voyage Time: " << prefs.maxVoyageTime << " minutes ("
+         << (prefs.maxVoyageTime / 60) << "h " << (prefs.maxVoyageTime % 60)
+         << "m)" << endl;
+  }
+
+  cout << "======================================\n" << endl;
+}
+
+// Route search results formatted a page at a time. Summary lines are built
+// up front; per-route lines are only generated for pages that get scrolled
+// into view, and only the most recently used pages are kept.
+class RouteReport {
+ public:
+  static const size_t PAGE_LINES = 64;
+  static const size_t CACHED_PAGES = 8;
+
+  void setLines(const vector<string>& lines) {
+    clear();
+    addText(lines);
+  }
+
+  // Reports on results in place; they must outlive the report or the next
+  // clear().
+  void build(const Graph& g, int originIdx, int destIdx,
+             const ItineraryArena& results) {
+    clear();
+    graph = &g;
+    routes = &results;
+    string originName = g.ports[originIdx].name;
+    string destName = g.ports[destIdx].name;
+
+    if (results.empty()) {
+      addText({"=== NO ROUTES FOUND ===", "",
+               "No direct or connected routes available between " +
+                   originName + " and " + destName + "."});
+      return;
+    }
+
+    const Itinerary* shortest = &results[0];
+    const Itinerary* cheapest = &results[0];
+    vector<const Itinerary*> directRoutes, singleLayoverRoutes,
+        multiLayoverRoutes;
+    for (const Itinerary& route : results) {
+      if (route.totalDuration < shortest->totalDuration) shortest = &route;
+      if (route.totalCost < cheapest->totalCost) cheapest = &route;
+      if (route.layoverCount == 0)
+        directRoutes.push_back(&route);
+      else if (route.layoverCount == 1)
+        singleLayoverRoutes.push_back(&route);
+      else
+        multiLayoverRoutes.push_back(&route);
+    }
+
+    vector<string> display;
+    display.push_back(
+        "==================== ROUTE SEARCH RESULTS ====================");
+    display.push_back("");
+    display.push_back("Number of Available Routes: " +
+                      to_string(results.size()));
+    display.push_back("");
+
+    display.push_back(
+        "==================== QUICK SUMMARY ====================");
+    display.push_back("");
+    display.push_back("FASTEST ROUTE:");
+    display.push_back(g.formatItineraryPath(*shortest));
+    display.push_back(
+        "Door-to-Door: " + to_string(shortest->totalDuration / 60) + "h " +
+        to_string(shortest->totalDuration % 60) + "m | Sailing: " +
+        to_string(shortest->totalTime / 60) + "h " +
+        to_string(shortest->totalTime % 60) +
+        "m | Cost: $" + to_string(shortest->totalCost));
+    display.push_back("");
+    display.push_back("CHEAPEST ROUTE:");
+    display.push_back(g.formatItineraryPath(*cheapest));
+    display.push_back("Cost: $" + to_string(cheapest->totalCost) +
+                      "  Time: " + to_string(cheapest->totalTime / 60) +
+                      "h " + to_string(cheapest->totalTime % 60) + "m");
+    display.push_back("");
+    addText(display);
 
-  cout << "\nApplied Preferences:" << endl;
+    addCategory(directRoutes, "DIRECT ROUTES");
+    addCategory(singleLayoverRoutes, "SINGLE LAYOVER ROUTES");
+    addCategory(multiLayoverRoutes, "MULTI-LAYOVER ROUTES");
 
-  if (prefs.hasCompanyFilter) {
-    cout << "Preferred Companies: ";
-    for (const string& company : prefs.preferredCompanies) {
-      cout << company << " ";
-    }
-    cout << endl;
+    display.clear();
+    display.push_back("==================== SUMMARY ====================");
+    display.push_back("");
+    display.push_back("Direct Routes: " + to_string(directRoutes.size()));
+    display.push_back("Single Layover: " +
+                      to_string(singleLayoverRoutes.size()));
+    display.push_back("Multi-Layover: " + to_string(multiLayoverRoutes.size()));
+    display.push_back("Total Unique Routes: " + to_string(results.size()));
+    display.push_back("");
+    display.push_back("==================== COLOR LEGEND ====================");
+    display.push_back("");
+    display.push_back("MAGENTA = Direct Routes (No layovers)");
+    display.push_back("ORANGE = Single Layover Routes");
+    display.push_back("BLUE = Multi-Layover Routes (2+ stops)");
+    display.push_back("");
+    addText(display);
   }
 
-  if (prefs.hasPortFilter) {
-    cout << "Avoid Ports: ";
-    for (const string& port : prefs.avoidPorts) {
-      cout << port << " ";
-    }
-    cout << endl;
+  void clear() {
+    blocks.clear();
+    pages.clear();
+    totalLines = 0;
+    routes = nullptr;
   }
 
-  if (prefs.hasTimeFilter) {
-    cout << "Max Voyage Time: " << prefs.maxVoyageTime << " minutes ("
-         << (prefs.maxVoyageTime / 60) << "h " << (prefs.maxVoyageTime % 60)
-         << "m)" << endl;
+  size_t lineCount() const { return totalLines; }
+  size_t cachedPages() const { return pages.size(); }
+
+  // The reference is only valid until the next call that loads a page.
+  const string& line(size_t index) {
+    return page(index / PAGE_LINES)[index % PAGE_LINES];
   }
 
-  cout << "======================================\n" << endl;
-}
+ private:
+  struct Block {
+    size_t start;
+    vector<string> text;
+    vector<const Itinerary*> routes;
+    vector<size_t> offsets;
+  };
+  struct Page {
+    vector<string> lines;
+    unsigned lastUsed;
+  };
+
+  const Graph* graph = nullptr;
+  const ItineraryArena* routes = nullptr;
+  vector<Block> blocks;
+  map<size_t, Page> pages;
+  size_t totalLines = 0;
+  unsigned useCounter = 0;
+
+  void addText(const vector<string>& lines) {
+    if (lines.empty()) return;
+    blocks.push_back({totalLines, lines, {}, {}});
+    totalLines += lines.size();
+  }
+
+  void addCategory(const vector<const Itinerary*>& category,
+                   const string& title) {
+    if (category.empty()) return;
+    addText({" ==================== " + title + " (" +
+                 to_string(category.size()) + ") ====================",
+             ""});
+    Block block = {totalLines, {}, category, {0}};
+    for (const Itinerary* route : category) {
+      block.offsets.push_back(block.offsets.back() +
+                              Graph::itineraryLineCount(*route));
+    }
+    totalLines += block.offsets.back();
+    blocks.push_back(move(block));
+  }
+
+  const vector<string>& page(size_t number) {
+    auto cached = pages.find(number);
+    if (cached != pages.end()) {
+      cached->second.lastUsed = ++useCounter;
+      return cached->second.lines;
+    }
+    if (pages.size() >= CACHED_PAGES) {
+      auto oldest = pages.begin();
+      for (auto it = pages.begin(); it != pages.end(); ++it) {
+        if (it->second.lastUsed < oldest->second.lastUsed) oldest = it;
+      }
+      pages.erase(oldest);
+    }
+
+    Page& result = pages[number];
+    result.lastUsed = ++useCounter;
+    size_t first = number * PAGE_LINES;
+    size_t last = min(first + PAGE_LINES, totalLines);
+    vector<string> routeLines;
+    for (size_t i = first; i < last;) {
+      const Block& block =
+          *(upper_bound(blocks.begin(), blocks.end(), i,
+                        [](size_t line, const Block& b) {
+                          return line < b.start;
+                        }) -
+            1);
+      size_t local = i - block.start;
+      if (block.routes.empty()) {
+        result.lines.push_back(block.text[local]);
+        i++;
+        continue;
+      }
+      size_t r = upper_bound(block.offsets.begin(), block.offsets.end(),
+                             local) -
+                 block.offsets.begin() - 1;
+      routeLines.clear();
+      graph->appendItineraryLines(*block.routes[r], r + 1, routeLines);
+      for (size_t k = local - block.offsets[r];
+           k < routeLines.size() && i < last; k++, i++) {
+        result.lines.push_back(move(routeLines[k]));
+      }
+    }
+    result.lines.resize(PAGE_LINES);
+    return result.lines;
+  }
+};
 
 class RouteDisplayWindow {
  private:
   RectangleShape background;
   RectangleShape titleBar;
   Text titleText;
-  vector<Text> routeLines;
-  vector<RectangleShape> routeBoxes;
+  RouteReport report;
+  vector<Text> visibleLines;
+  size_t visibleFirst;
   Button* closeButton;
   bool isVisible;
   Font* font;
@@ -2548,9 +6401,49 @@ class RouteDisplayWindow {
   float windowWidth;
   float windowHeight;
 
+  static constexpr float ROW_HEIGHT = 22.0f;
+
+  void layoutReport(const string& from, const string& to) {
+    isVisible = true;
+    scrollOffset = 0;
+    visibleFirst = string::npos;
+    visibleLines.clear();
+    titleText.setString("Routes: " + from + " -> " + to);
+    updateScrollRange();
+  }
+
+  void updateScrollRange() {
+    float contentHeight = report.lineCount() * ROW_HEIGHT;
+    float visibleHeight = background.getSize().y - 90;
+    maxScrollOffset = max(0.0f, contentHeight - visibleHeight);
+    scrollOffset = min(scrollOffset, maxScrollOffset);
+  }
+
+  void loadVisibleLines(size_t first, size_t rows) {
+    visibleFirst = first;
+    visibleLines.clear();
+    size_t last = min(first + rows, report.lineCount());
+    for (size_t i = first; i < last; i++) {
+      const string& line = report.line(i);
+      Text text;
+      text.setFont(*font);
+      text.setString(line);
+      text.setCharacterSize(17);
+      text.setFillColor(Color::Black);
+      if (line.find("===") != string::npos ||
+          line.find("DIRECT") != string::npos ||
+          line.find("CONNECTED") != string::npos ||
+          line.find("MULTI-LAYOVER") != string::npos) {
+        text.setCharacterSize(19);
+      }
+      visibleLines.push_back(text);
+    }
+  }
+
  public:
   RouteDisplayWindow(Font& f, float windowWidth, float windowHeight)
-      : font(&f),
+      : visibleFirst(string::npos),
+        font(&f),
         isVisible(false),
         closeButton(nullptr),
         scrollOffset(0),
@@ -2587,81 +6480,23 @@ class RouteDisplayWindow {
 
   void show(const string& from, const string& to,
             const vector<string>& routes) {
-    isVisible = true;
-    scrollOffset = 0;
-    routeLines.clear();
-    routeBoxes.clear();
-
-    titleText.setString("Routes: " + from + " -> " + to);
-
-    float windowLeft = background.getPosition().x;
-    float windowTop = background.getPosition().y;
-    float windowWidth = background.getSize().x;
-    float windowHeight = background.getSize().y;
-
-    float leftX = windowLeft + 20;
-    float yPos = windowTop + 70;
-
-    if (routes.empty()) {
-      Text text;
-      text.setFont(*font);
-      text.setString("No routes found between these ports.");
-      text.setCharacterSize(22);
-      text.setFillColor(Color(200, 50, 50));
-      text.setOutlineThickness(1);
-      text.setOutlineColor(Color::White);
-
-      FloatRect bounds = text.getLocalBounds();
-      text.setOrigin(bounds.left + bounds.width / 2,
-                     bounds.top + bounds.height / 2);
-      text.setPosition(windowLeft + windowWidth / 2,
-                       windowTop + windowHeight / 2);
-
-      routeLines.push_back(text);
-    } else {
-      for (size_t i = 0; i < routes.size(); i++) {
-        Text text;
-        text.setFont(*font);
-        text.setString(routes[i]);
-        text.setCharacterSize(17);
-
-        const string& line = routes[i];
-
-        if (line.find("===") != string::npos ||
-            line.find("DIRECT") != string::npos ||
-            line.find("CONNECTED") != string::npos ||
-            line.find("MULTI-LAYOVER") != string::npos) {
-          text.setFillColor(Color(50, 100, 150));
-          text.setStyle(Text::Bold);
-          text.setCharacterSize(19);
-        } else if (line.find("->") != string::npos) {
-          text.setFillColor(Color(0, 120, 0));
-          text.setStyle(Text::Bold);
-        } else if (line.empty()) {
-          text.setCharacterSize(8);
-        } else {
-          text.setFillColor(Color::Black);
-        }
-
-        text.setPosition(leftX, yPos);
-        routeLines.push_back(text);
-
-        if (line.empty() || line.find("===") != string::npos)
-          yPos += 15;
-        else
-          yPos += 25;
-      }
-    }
-
-    float contentHeight = yPos - (windowTop + 70);
-    float visibleHeight = windowHeight - 90;
+    report.setLines(routes);
+    layoutReport(from, to);
+  }
 
-    maxScrollOffset = max(0.0f, contentHeight - visibleHeight);
+  // Search results between two ports, formatted lazily as they scroll into
+  // view. results must stay alive while the window shows them.
+  void showAllRoutes(const Graph& g, int originIdx, int destIdx,
+                     const ItineraryArena& results) {
+    report.build(g, originIdx, destIdx, results);
+    layoutReport(g.ports[originIdx].name, g.ports[destIdx].name);
   }
+
   void hide() {
     isVisible = false;
-    routeLines.clear();
-    routeBoxes.clear();
+    report.clear();
+    visibleLines.clear();
+    visibleFirst = string::npos;
     scrollOffset = 0;
     maxScrollOffset = 0;
   }
@@ -2703,17 +6538,30 @@ class RouteDisplayWindow {
     float visibleTop = boxY + 60;
     float visibleBottom = boxY + boxH - 20;
 
-    for (auto& line : routeLines) {
-      Vector2f orig = line.getPosition();
-      float newY = orig.y - scrollOffset;
+    if (report.lineCount() == 0) {
+      Text text;
+      text.setFont(*font);
+      text.setString("No routes found between these ports.");
+      text.setCharacterSize(22);
+      text.setFillColor(Color(200, 50, 50));
+      text.setOutlineThickness(1);
+      text.setOutlineColor(Color::White);
+      FloatRect bounds = text.getLocalBounds();
+      text.setOrigin(bounds.left + bounds.width / 2,
+                     bounds.top + bounds.height / 2);
+      text.setPosition(boxX + boxW / 2, boxY + boxH / 2);
+      window.draw(text);
+    }
 
-      if (newY >= visibleTop && newY <= visibleBottom) {
-        string lineStr = line.getString();
-        line.setFillColor(Color::Black);
-        line.setPosition(orig.x, newY);
-        window.draw(line);
-        line.setPosition(orig);
-        line.setStyle(Text::Regular);
+    size_t first = scrollOffset / ROW_HEIGHT;
+    size_t rows = (visibleBottom - visibleTop) / ROW_HEIGHT + 2;
+    if (first != visibleFirst) loadVisibleLines(first, rows);
+
+    for (size_t k = 0; k < visibleLines.size(); k++) {
+      float y = boxY + 70 + (first + k) * ROW_HEIGHT - scrollOffset;
+      if (y >= visibleTop && y <= visibleBottom) {
+        visibleLines[k].setPosition(boxX + 20, y);
+        window.draw(visibleLines[k]);
       }
     }
 
@@ -2770,6 +6618,8 @@ class RouteDisplayWindow {
     if (closeButton) {
       closeButton->setPosition(Vector2f(x + width - 45, y + 5));
     }
+    visibleFirst = string::npos;
+    updateScrollRange();
   }
 };
 class CompanySelectionWindow {
@@ -4076,7 +7926,8 @@ void rebuildJourneyVisualization(MultiLegJourney& journey,
   }
 }
 void displaySubgraph(Graph& g, vector<Location>& locations,
-                     vector<RouteEdge>& edges, const SubgraphMenu& menu) {
+                     vector<RouteEdge>& edges, const SubgraphMenu& menu,
+                     SubgraphIndex& subgraphs) {
   vector<string> selectedOptions = menu.getSelectedOptions();
   SubgraphMenu::SubgraphMode mode = menu.getCurrentMode();
 
@@ -4086,92 +7937,32 @@ void displaySubgraph(Graph& g, vector<Location>& locations,
   Color allowedRouteColor = Color(255, 215, 0, 200);
   Color blockedRouteColor = Color(100, 100, 100, 50);
 
-  for (auto& loc : locations) {
-    int portIdx = g.getPortIndex(loc.name);
-    if (portIdx == -1) continue;
-
-    bool portAllowed = true;
+  subgraphs.refresh(g);
+  SubgraphIndex::Selection selection =
+      mode == SubgraphMenu::COMPANY_MODE
+          ? subgraphs.selectCompanies(selectedOptions)
+          : subgraphs.selectAvoidingWeather(selectedOptions);
 
-    if (mode == SubgraphMenu::COMPANY_MODE) {
-      bool hasSelectedCompanyRoute = false;
-      for (const Route& route : g.routes[portIdx]) {
-        for (const string& company : selectedOptions) {
-          if (route.company == company) {
-            hasSelectedCompanyRoute = true;
-            break;
-          }
-        }
-        if (hasSelectedCompanyRoute) break;
-      }
-      if (!hasSelectedCompanyRoute) {
-        for (int i = 0; i < g.routes.size(); i++) {
-          for (const Route& route : g.routes[i]) {
-            if (route.destination == loc.name) {
-              for (const string& company : selectedOptions) {
-                if (route.company == company) {
-                  hasSelectedCompanyRoute = true;
-                  break;
-                }
-              }
-            }
-            if (hasSelectedCompanyRoute) break;
-          }
-          if (hasSelectedCompanyRoute) break;
-        }
-      }
-
-      portAllowed = hasSelectedCompanyRoute;
-
-    } else if (mode == SubgraphMenu::WEATHER_MODE) {
-      bool hasBadWeather = false;
-      for (const string& weather : selectedOptions) {
-        if (g.portHasWeather(loc.name, weather)) {
-          hasBadWeather = true;
-          break;
-        }
-      }
-      portAllowed = !hasBadWeather;
-    }
+  for (int i = 0; i < locations.size(); i++) {
+    Location& loc = locations[i];
+    int portIdx = i < g.ports.size() && g.ports[i].name == loc.name
+                      ? i
+                      : g.getPortIndex(loc.name);
+    if (portIdx == -1) continue;
 
+    bool portAllowed = EdgeTable::test(selection.ports, portIdx);
     loc.pin.setFillColor(portAllowed ? allowedPortColor : blockedPortColor);
     loc.label.setFillColor(portAllowed ? Color::White : Color(100, 100, 100));
   }
 
   for (auto& edge : edges) {
-    int sourceIdx = g.getPortIndex(edge.sourceName);
-    int destIdx = g.getPortIndex(edge.routeInfo.destination);
-
-    if (sourceIdx == -1 || destIdx == -1) continue;
-
-    bool routeAllowed = true;
-
-    if (mode == SubgraphMenu::COMPANY_MODE) {
-      bool companyMatch = false;
-      for (const string& company : selectedOptions) {
-        if (edge.routeInfo.company == company) {
-          companyMatch = true;
-          break;
-        }
-      }
-      routeAllowed = companyMatch;
-
-    } else if (mode == SubgraphMenu::WEATHER_MODE) {
-      bool sourceHasBadWeather = false;
-      bool destHasBadWeather = false;
-
-      for (const string& weather : selectedOptions) {
-        if (g.portHasWeather(edge.sourceName, weather)) {
-          sourceHasBadWeather = true;
-        }
-        if (g.portHasWeather(edge.routeInfo.destination, weather)) {
-          destHasBadWeather = true;
-        }
-        if (sourceHasBadWeather && destHasBadWeather) break;
-      }
-
-      routeAllowed = !(sourceHasBadWeather || destHasBadWeather);
+    int edgeId = edge.routeInfo.edgeId;
+    if (edgeId < 0 || edgeId >= g.edgeTable.count ||
+        g.edgeTable.dstId[edgeId] == -1) {
+      continue;
     }
 
+    bool routeAllowed = EdgeTable::test(selection.edges, edgeId);
     if (routeAllowed) {
       edge.line.setSize(Vector2f(edge.line.getSize().x, 1.5f));
       edge.line.setFillColor(allowedRouteColor);
@@ -4453,7 +8244,8 @@ class RouteBookingWindow {
   Font* font;
   float windowWidth;
   float windowHeight;
-  vector<CompleteRoute> availableRoutes;
+  const ItineraryArena* availableRoutes;
+  const Graph* graph;
   string originPort;
   string destPort;
   string selectedDate;
@@ -4469,6 +8261,8 @@ class RouteBookingWindow {
         bookButton(nullptr),
         windowWidth(winWidth),
         windowHeight(winHeight),
+        availableRoutes(nullptr),
+        graph(nullptr),
         selectedRouteIndex(-1),
         scrollOffset(0),
         maxScrollOffset(0) {
@@ -4511,12 +8305,13 @@ class RouteBookingWindow {
   }
 
 void show(const string& from, const string& to, const string& date, 
-          const vector<CompleteRoute>& routes, const Graph& g) {
+          const ItineraryArena& routes, const Graph& g) {
     isVisible = true;
     originPort = from;
     destPort = to;
     selectedDate = date;
-    availableRoutes = routes;
+    availableRoutes = &routes;
+    graph = &g;
     selectedRouteIndex = -1;
     scrollOffset = 0;
     
@@ -4554,7 +8349,7 @@ void show(const string& from, const string& to, const string& date,
         yPos += 45;
         
         for (size_t i = 0; i < routes.size(); i++) {
-            const CompleteRoute& route = routes[i];
+            const Itinerary& route = routes[i];
             Text routeHeader;
             routeHeader.setFont(*font);
             routeHeader.setString("=== ROUTE " + to_string(i + 1) + " ===");
@@ -4576,10 +8371,21 @@ void show(const string& from, const string& to, const string& date,
             routeSelectionButtons.push_back(selectBtn);
             
             yPos += 55;  
+            if (!g.itineraryLive(route)) {
+                Text removedText;
+                removedText.setFont(*font);
+                removedText.setString("A leg of this route is no longer scheduled");
+                removedText.setCharacterSize(16);
+                removedText.setFillColor(Color(200, 50, 50));
+                removedText.setPosition(x + 30, yPos);
+                routeDetails.push_back(removedText);
+                yPos += 65;
+                continue;
+            }
             string pathStr = "Path: ";
-            for (size_t j = 0; j < route.portPath.size(); j++) {
-                pathStr += g.ports[route.portPath[j]].name;
-                if (j < route.portPath.size() - 1) pathStr += " -> ";
+            for (int j = 0; j <= route.legCount; j++) {
+                pathStr += g.ports[g.itineraryPort(route, j)].name;
+                if (j < route.legCount) pathStr += " -> ";
             }
             Text pathText;
             pathText.setFont(*font);
@@ -4601,13 +8407,13 @@ void show(const string& from, const string& to, const string& date,
             summary.setPosition(x + 30, yPos);
             routeDetails.push_back(summary);
             yPos += 35;
-            for (size_t j = 0; j < route.routeLegs.size(); j++) {
-                const Route& leg = route.routeLegs[j];
+            for (int j = 0; j < route.legCount; j++) {
+                const Route& leg = *g.edgeRoute(route.legs[j]);
                 Text legHeader;
                 legHeader.setFont(*font);
                 legHeader.setString("  Leg " + to_string(j + 1) + ": " + 
-                                   g.ports[route.portPath[j]].name + " -> " + 
-                                   g.ports[route.portPath[j + 1]].name);
+                                   g.ports[g.itineraryPort(route, j)].name + " -> " + 
+                                   g.ports[g.itineraryPort(route, j + 1)].name);
                 legHeader.setCharacterSize(16);
                 legHeader.setFillColor(Color(50, 50, 150));
                 legHeader.setStyle(Text::Bold);
@@ -4651,7 +8457,7 @@ void show(const string& from, const string& to, const string& date,
 void update(RenderWindow& window) {
     if (!isVisible) return;
     closeButton->update(window);
-    if (!availableRoutes.empty()) {
+    if (availableRoutes && !availableRoutes->empty()) {
         bookButton->update(window);
     }
     
@@ -4756,7 +8562,7 @@ void draw(RenderWindow& window) {
         window.draw(statusText);
     }
     
-    if (!availableRoutes.empty()) {
+    if (availableRoutes && !availableRoutes->empty()) {
         if (selectedRouteIndex == -1) {
             bookButton->normalColor = Color(100, 100, 100);
             bookButton->shape.setFillColor(Color(100, 100, 100));
@@ -4779,8 +8585,10 @@ int checkClick(RenderWindow& window, Event& event) {
         return CLOSE;
     }
     
-    if (!availableRoutes.empty() && bookButton->isClicked(window, event)) {
-        if (selectedRouteIndex != -1) { 
+    if (availableRoutes && !availableRoutes->empty() &&
+        bookButton->isClicked(window, event)) {
+        if (selectedRouteIndex != -1 &&
+            graph->itineraryLive((*availableRoutes)[selectedRouteIndex])) {
             return BOOK;
         }
     }
@@ -4822,11 +8630,14 @@ int checkClick(RenderWindow& window, Event& event) {
     return NONE;
 }
 
-CompleteRoute getSelectedRoute() const {
-    if (selectedRouteIndex >= 0 && selectedRouteIndex < availableRoutes.size()) {
-        return availableRoutes[selectedRouteIndex];
+ItineraryHandle getSelectedRoute() const {
+    if (availableRoutes && selectedRouteIndex >= 0 &&
+        selectedRouteIndex < availableRoutes->size() &&
+        graph->itineraryLive((*availableRoutes)[selectedRouteIndex])) {
+        return make_shared<const CompleteRoute>(
+            graph->toCompleteRoute((*availableRoutes)[selectedRouteIndex]));
     }
-    return availableRoutes.empty() ? CompleteRoute() : CompleteRoute();  
+    return nullptr;
 }
 
   bool isMouseOverWindow(RenderWindow& window) const {
@@ -4856,7 +8667,7 @@ class ShipSprite {
     }
   }
 
-  void draw(RenderWindow& window, const Vector2f& position, float rotation,
+  void draw(RenderTarget& window, const Vector2f& position, float rotation,
             const Color& tint) {
     if (textureLoaded) {
       shipSprite.setPosition(position);
@@ -4876,6 +8687,16 @@ class ShipSprite {
 
 class LayoverSimulation {
  private:
+  struct ShipLabels {
+    Text name;
+    Text timer;
+    int timerSeconds;
+  };
+  struct QueueLabel {
+    Text text;
+    size_t shownSize;
+  };
+
   vector<Ship> ships;
   map<int, PortDockingQueue> portQueues;
   bool isRunning;
@@ -4883,15 +8704,24 @@ class LayoverSimulation {
   Clock animationClock;
   float simulationSpeed;
   ShipSprite shipRenderer;
+  Font* font;
+  vector<ShipLabels> shipLabels;
+  map<int, QueueLabel> queueLabels;
+  CircleShape queueDot;
 
  public:
-  LayoverSimulation()
-      : isRunning(false), isPaused(false), simulationSpeed(1.0f) {}
+  LayoverSimulation(Font& f)
+      : isRunning(false), isPaused(false), simulationSpeed(1.0f), font(&f) {
+    queueDot.setRadius(3);
+    queueDot.setFillColor(Color(255, 255, 0, 150));
+  }
 
   void initializeFromBookedRoutes(const vector<BookedRoute>& bookedRoutes,
                                   const Graph& g) {
     ships.clear();
     portQueues.clear();
+    shipLabels.clear();
+    queueLabels.clear();
 
     for (int i = 0; i < g.ports.size(); i++) {
       portQueues[i] = PortDockingQueue(g.ports[i].name, i);
@@ -4905,6 +8735,19 @@ class LayoverSimulation {
       ships.push_back(ship);
     }
 
+    shipLabels.resize(ships.size());
+    for (size_t i = 0; i < ships.size(); i++) {
+      ShipLabels& labels = shipLabels[i];
+      labels.name.setFont(*font);
+      labels.name.setString(ships[i].shipID);
+      labels.name.setCharacterSize(10);
+      labels.name.setFillColor(Color::White);
+      labels.timer.setFont(*font);
+      labels.timer.setCharacterSize(10);
+      labels.timer.setFillColor(Color::Cyan);
+      labels.timerSeconds = -1;
+    }
+
     isRunning = true;
     animationClock.restart();
   }
@@ -4919,7 +8762,7 @@ class LayoverSimulation {
     }
 
     for (auto& ship : ships) {
-      if (ship.currentLegIndex >= ship.route.routeLegs.size()) {
+      if (ship.currentLegIndex >= ship.route->routeLegs.size()) {
         continue;
       }
 
@@ -4930,15 +8773,15 @@ class LayoverSimulation {
           ship.isMoving = false;
           ship.animationProgress = 1.0f;
 
-          int nextPortIdx = ship.route.portPath[ship.currentLegIndex + 1];
+          int nextPortIdx = ship.route->portPath[ship.currentLegIndex + 1];
 
           if (portQueues.find(nextPortIdx) != portQueues.end()) {
             portQueues[nextPortIdx].addShip(&ship);
           }
         }
 
-        int fromIdx = ship.route.portPath[ship.currentLegIndex];
-        int toIdx = ship.route.portPath[ship.currentLegIndex + 1];
+        int fromIdx = ship.route->portPath[ship.currentLegIndex];
+        int toIdx = ship.route->portPath[ship.currentLegIndex + 1];
 
         Vector2f fromPos = locations[fromIdx].position;
         Vector2f toPos = locations[toIdx].position;
@@ -4948,7 +8791,7 @@ class LayoverSimulation {
     }
   }
 
-  void draw(RenderWindow& window, const vector<Location>& locations,
+  void draw(RenderTarget& window, const vector<Location>& locations,
             const Graph& g) {
     if (!isRunning) return;
     for (const auto& pair : portQueues) {
@@ -4957,21 +8800,25 @@ class LayoverSimulation {
       if (!queue.queue.empty()) {
         Vector2f portPos = locations[queue.portIndex].position;
 
-        Text queueText;
-        Font font;
-        if (font.loadFromFile("arial.ttf")) {
-          queueText.setFont(font);
-          queueText.setString("Queue: " + to_string(queue.queue.size()));
-          queueText.setCharacterSize(14);
-          queueText.setFillColor(Color::Yellow);
-          queueText.setPosition(portPos.x + 25, portPos.y - 25);
-          window.draw(queueText);
+        auto found = queueLabels.find(pair.first);
+        if (found == queueLabels.end()) {
+          QueueLabel label;
+          label.text.setFont(*font);
+          label.text.setCharacterSize(14);
+          label.text.setFillColor(Color::Yellow);
+          label.shownSize = 0;
+          found = queueLabels.emplace(pair.first, label).first;
+        }
+        QueueLabel& label = found->second;
+        if (label.shownSize != queue.queue.size()) {
+          label.shownSize = queue.queue.size();
+          label.text.setString("Queue: " + to_string(label.shownSize));
         }
+        label.text.setPosition(portPos.x + 25, portPos.y - 25);
+        window.draw(label.text);
 
         float queueOffset = 30.0f;
         for (size_t i = 0; i < queue.queue.size(); i++) {
-          CircleShape queueDot(3);
-          queueDot.setFillColor(Color(255, 255, 0, 150));
           queueDot.setPosition(portPos.x + queueOffset + i * 10,
                                portPos.y + 30);
           window.draw(queueDot);
@@ -4979,12 +8826,14 @@ class LayoverSimulation {
       }
     }
 
-    for (const auto& ship : ships) {
-      if (ship.currentLegIndex >= ship.route.routeLegs.size()) continue;
+    for (size_t s = 0; s < ships.size(); s++) {
+      const Ship& ship = ships[s];
+      ShipLabels& labels = shipLabels[s];
+      if (ship.currentLegIndex >= ship.route->routeLegs.size()) continue;
 
       if (ship.isMoving) {
-        int fromIdx = ship.route.portPath[ship.currentLegIndex];
-        int toIdx = ship.route.portPath[ship.currentLegIndex + 1];
+        int fromIdx = ship.route->portPath[ship.currentLegIndex];
+        int toIdx = ship.route->portPath[ship.currentLegIndex + 1];
 
         Vector2f fromPos = locations[fromIdx].position;
         Vector2f toPos = locations[toIdx].position;
@@ -4994,18 +8843,10 @@ class LayoverSimulation {
 
         shipRenderer.draw(window, ship.position, angle, ship.shipColor);
 
-        Font font;
-        if (font.loadFromFile("arial.ttf")) {
-          Text shipInfo;
-          shipInfo.setFont(font);
-          shipInfo.setString(ship.shipID);
-          shipInfo.setCharacterSize(10);
-          shipInfo.setFillColor(Color::White);
-          shipInfo.setPosition(ship.position.x + 15, ship.position.y - 5);
-          window.draw(shipInfo);
-        }
+        labels.name.setPosition(ship.position.x + 15, ship.position.y - 5);
+        window.draw(labels.name);
       } else if (ship.isDocked) {
-        int portIdx = ship.route.portPath[ship.currentLegIndex + 1];
+        int portIdx = ship.route->portPath[ship.currentLegIndex + 1];
         Vector2f portPos = locations[portIdx].position;
 
         Vector2f dockedPos =
@@ -5015,16 +8856,13 @@ class LayoverSimulation {
             window, dockedPos, 0,
             Color(ship.shipColor.r, ship.shipColor.g, ship.shipColor.b, 150));
 
-        Font font;
-        if (font.loadFromFile("arial.ttf")) {
-          Text timerText;
-          timerText.setFont(font);
-          timerText.setString(to_string((int)ship.dockingTimeRemaining) + "s");
-          timerText.setCharacterSize(10);
-          timerText.setFillColor(Color::Cyan);
-          timerText.setPosition(dockedPos.x, dockedPos.y + 15);
-          window.draw(timerText);
+        int seconds = (int)ship.dockingTimeRemaining;
+        if (labels.timerSeconds != seconds) {
+          labels.timerSeconds = seconds;
+          labels.timer.setString(to_string(seconds) + "s");
         }
+        labels.timer.setPosition(dockedPos.x, dockedPos.y + 15);
+        window.draw(labels.timer);
       }
     }
   }
@@ -5040,10 +8878,14 @@ class LayoverSimulation {
 
   bool isActive() const { return isRunning; }
 
+  bool isAnimating() const { return isRunning && !isPaused; }
+
   void stop() {
     isRunning = false;
     ships.clear();
     portQueues.clear();
+    shipLabels.clear();
+    queueLabels.clear();
   }
 
   string getStatistics() const {
@@ -5052,7 +8894,7 @@ class LayoverSimulation {
     int completedShips = 0;
 
     for (const auto& ship : ships) {
-      if (ship.currentLegIndex >= ship.route.routeLegs.size()) {
+      if (ship.currentLegIndex >= ship.route->routeLegs.size()) {
         completedShips++;
       } else if (ship.isMoving) {
         movingShips++;
@@ -5306,50 +9148,736 @@ class BookingConfirmationWindow {
       window.draw(text);
     }
 
-    closeButton->draw(window);
+    closeButton->draw(window);
+  }
+
+  bool checkClose(RenderWindow& window, Event& event) {
+    if (isVisible && closeButton->isClicked(window, event)) {
+      hide();
+      return true;
+    }
+    return false;
+  }
+};
+void showBookingRoute(const vector<Location>& locations, const Graph& g,
+                      const CompleteRoute& route,
+                      vector<RouteEdge>& bookingHighlightedRoutes) {
+  bookingHighlightedRoutes.clear();
+
+  Color routeColor;
+  if (route.layoverCount == 0) {
+    routeColor = Color::Magenta;
+  } else if (route.layoverCount == 1) {
+    routeColor = Color(255, 165, 0, 255);
+  } else {
+    routeColor = Color::Blue;
+  }
+
+  for (size_t i = 0; i < route.routeLegs.size(); i++) {
+    int fromIdx = route.portPath[i];
+    int toIdx = route.portPath[i + 1];
+
+    RouteEdge edge(locations[fromIdx].position, locations[toIdx].position,
+                   route.routeLegs[i], g.ports[fromIdx].name);
+    edge.line.setFillColor(routeColor);
+    bookingHighlightedRoutes.push_back(edge);
+  }
+}
+void benchDepartureIndex() {
+  Graph g;
+  g.parsePorts("PortCharges.txt");
+  generateSyntheticSchedule(g, "01/12/2024", 90, 6, 42);
+  size_t legCount = 0;
+  for (const vector<Route>& legs : g.routes) legCount += legs.size();
+  cout << "Synthetic schedule: " << g.ports.size() << " ports, " << legCount
+       << " legs over 90 days" << endl;
+  cout << "Departure index: " << legCount * sizeof(int) << " bytes ("
+       << legCount * sizeof(Route) << " bytes of Route records)" << endl;
+
+  vector<pair<int, int>> pairs;
+  srand(7);
+  for (int i = 0; i < 20; i++) {
+    int a = rand() % g.ports.size();
+    int b = (a + 1 + rand() % (g.ports.size() - 1)) % g.ports.size();
+    pairs.push_back({a, b});
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    g.useDepartureIndex = pass == 1;
+    Clock clock;
+    size_t feasible = 0;
+    for (int u = 0; u < g.ports.size(); u++) {
+      for (const Route& leg : g.routes[u]) {
+        int v = leg.destIdx;
+        const vector<int>& order = g.departureOrder[v];
+        for (size_t k = g.firstConnection(v, &leg); k < order.size(); k++) {
+          if (g.canConnect(leg, g.routes[v][order[k]])) feasible++;
+        }
+      }
+    }
+    float connectMs = clock.restart().asMicroseconds() / 1000.0f;
+    size_t twoLeg = 0;
+    for (const auto& p : pairs) {
+      twoLeg += g.findAllPossibleRoutes(p.first, p.second, nullptr, 1).size();
+    }
+    float enumerateMs = clock.restart().asMicroseconds() / 1000.0f;
+    size_t pareto = 0;
+    for (const auto& p : pairs) {
+      pareto += g.paretoRouteSearch(p.first, p.second, 3).size();
+    }
+    float paretoMs = clock.restart().asMicroseconds() / 1000.0f;
+    for (int i = 0; i < 10; i++) g.findShortestRoute(&g.ports[i]);
+    float dijkstraMs = clock.restart().asMicroseconds() / 1000.0f;
+    cout << (pass == 1 ? "Sorted departures" : "Linear scan") << ": "
+         << feasible << " connections in " << connectMs << " ms, " << twoLeg
+         << " two-leg routes in " << enumerateMs << " ms, "
+         << pareto << " Pareto routes in " << paretoMs << " ms, "
+         << "10 dijkstra runs in " << dijkstraMs << " ms" << endl;
+  }
+}
+
+void benchEdgeFilters() {
+  const int edgeCount = 2000000, portCount = 200, companyCount = 40;
+  EdgeTable table;
+  srand(11);
+  for (int i = 0; i < edgeCount; i++) {
+    Route r;
+    r.cost = 500 + rand() % 4500;
+    r.travelTime = 60 + rand() % (23 * 60);
+    r.destIdx = rand() % portCount;
+    r.companyId = rand() % companyCount;
+    table.add(rand() % portCount, r);
+  }
+
+  SearchConstraints constraints;
+  constraints.portAllowed.assign(portCount, 1);
+  for (int p = 0; p < portCount; p += 7) constraints.portAllowed[p] = 0;
+  constraints.companyAllowed.assign(companyCount, 0);
+  for (int c = 0; c < companyCount; c += 3) constraints.companyAllowed[c] = 1;
+  constraints.portPenalty.assign(portCount, 1.0f);
+  constraints.maxVoyageTime = 12 * 60;
+  constraints.hasCompanyFilter = true;
+  constraints.hasTimeFilter = true;
+  constraints.hasWeatherPenalty = false;
+
+  Clock clock;
+  size_t scalarAllowed = 0;
+  for (int i = 0; i < edgeCount; i++) {
+    Route r;
+    r.travelTime = table.travelTime[i];
+    r.destIdx = table.dstId[i];
+    r.companyId = table.companyId[i];
+    scalarAllowed +=
+        constraints.allowsPort(table.srcId[i]) && constraints.allowsLeg(r);
+  }
+  float scalarMs = clock.restart().asMicroseconds() / 1000.0f;
+  vector<uint64_t> mask = table.filter(constraints);
+  float maskMs = clock.restart().asMicroseconds() / 1000.0f;
+
+  cout << "Edge filters over " << edgeCount << " edges: per-edge checks "
+       << scalarMs << " ms, bitmask predicates " << maskMs << " ms ("
+       << scalarAllowed << " / " << EdgeTable::countBits(mask) << " allowed)"
+       << endl;
+}
+
+void benchEdgeKernels() {
+  const int edgeCount = 2000000, portCount = 200, companyCount = 40;
+  const int reps = 20;
+  EdgeTable table;
+  srand(13);
+  for (int i = 0; i < edgeCount; i++) {
+    Route r;
+    r.cost = 500 + rand() % 4500;
+    r.travelTime = 60 + rand() % (23 * 60);
+    r.destIdx = rand() % portCount;
+    r.companyId = rand() % companyCount;
+    table.add(rand() % portCount, r);
+  }
+  uint64_t allowed = 0;
+  for (int c = 0; c < companyCount; c += 3) allowed |= uint64_t(1) << c;
+
+  cout << "Edge kernels over " << edgeCount << " edges (ms per call):" << endl;
+  const EdgeKernels* previous = &edgeKernels();
+  for (const EdgeKernels* kernels : availableEdgeKernels()) {
+    activeEdgeKernels = kernels;
+    vector<uint64_t> mask;
+    Clock clock;
+    for (int i = 0; i < reps; i++) {
+      mask = table.alive;
+      kernels->maskLessEqual(table.travelTime.data(), table.count, 12 * 60,
+                             mask.data());
+    }
+    float lessEqualMs = clock.restart().asMicroseconds() / 1000.0f / reps;
+    size_t timeHits = EdgeTable::countBits(mask);
+    for (int i = 0; i < reps; i++) {
+      mask = table.alive;
+      kernels->maskBitsetIn(table.companyId.data(), table.count, allowed,
+                            mask.data());
+    }
+    float bitsetMs = clock.restart().asMicroseconds() / 1000.0f / reps;
+    size_t companyHits = EdgeTable::countBits(mask);
+    EdgeStats all = {0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < reps; i++) all = table.stats(table.alive);
+    float statsMs = clock.restart().asMicroseconds() / 1000.0f / reps;
+    vector<EdgeStats> byCompany;
+    for (int i = 0; i < 5; i++) {
+      byCompany = table.statsByKey(table.companyId, companyCount, table.alive);
+    }
+    float groupedMs = clock.restart().asMicroseconds() / 1000.0f / 5;
+
+    cout << "  " << kernels->name << ": travelTime<=max " << lessEqualMs
+         << " (" << timeHits << " hits), company bitset " << bitsetMs << " ("
+         << companyHits << " hits), min/avg/max " << statsMs << " (avg cost "
+         << all.avgCost() << "), per-company stats " << groupedMs
+         << " (company 0 max time " << byCompany[0].maxTime << ")" << endl;
+  }
+  activeEdgeKernels = previous;
+}
+
+// Heap bytes owned by an itinerary, counting string buffers only when they
+// live outside the string object itself.
+size_t itineraryBytes(const CompleteRoute& route) {
+  auto heapString = [](const string& s) -> size_t {
+    const char* data = s.data();
+    bool embedded = data >= reinterpret_cast<const char*>(&s) &&
+                   data < reinterpret_cast<const char*>(&s + 1);
+    return embedded ? 0 : s.capacity() + 1;
+  };
+  size_t bytes = route.portPath.capacity() * sizeof(int) +
+                 route.routeLegs.capacity() * sizeof(Route);
+  for (const Route& leg : route.routeLegs) {
+    bytes += heapString(leg.destination) + heapString(leg.date) +
+             heapString(leg.depTime) + heapString(leg.arrTime) +
+             heapString(leg.company);
+  }
+  return bytes;
+}
+
+void benchBookedItineraries() {
+  const int bookingCount = 100000;
+  Graph g;
+  g.parsePorts("PortCharges.txt");
+  generateSyntheticSchedule(g, "01/12/2024", 30, 6, 42);
+  ItineraryArena results;
+  for (int a = 0; a < g.ports.size() && results.size() < 2000; a++) {
+    for (int b = 0; b < g.ports.size(); b++) {
+      if (a != b) g.paretoRouteSearch(a, b, 3, results);
+    }
+  }
+  if (results.empty()) return;
+
+  Clock clock;
+  size_t copyBytes = 0;
+  {
+    vector<CompleteRoute> booked, shipped;
+    for (int i = 0; i < bookingCount; i++) {
+      CompleteRoute selected = g.toCompleteRoute(results[i % results.size()]);
+      booked.push_back(selected);
+      shipped.push_back(booked.back());
+    }
+    for (int i = 0; i < bookingCount; i++) {
+      copyBytes += sizeof(CompleteRoute) * 2 + itineraryBytes(booked[i]) +
+                   itineraryBytes(shipped[i]);
+    }
+  }
+  float copyMs = clock.restart().asMicroseconds() / 1000.0f;
+
+  size_t sharedBytes = 0;
+  {
+    vector<BookedRoute> booked;
+    vector<Ship> ships;
+    for (int i = 0; i < bookingCount; i++) {
+      ItineraryHandle selected = make_shared<const CompleteRoute>(
+          g.toCompleteRoute(results[i % results.size()]));
+      booked.push_back(BookedRoute(selected, "A", "B", "01/12/2024"));
+      ships.push_back(Ship(booked.back().bookingID, booked.back().route,
+                           booked.back().originPort, booked.back().destPort));
+    }
+    for (int i = 0; i < bookingCount; i++) {
+      sharedBytes += sizeof(CompleteRoute) + 2 * sizeof(ItineraryHandle) +
+                     itineraryBytes(*booked[i].route);
+    }
+  }
+  float sharedMs = clock.restart().asMicroseconds() / 1000.0f;
+
+  cout << bookingCount << " booked itineraries from " << results.size()
+       << " search results: copied per stage " << copyBytes / (1024 * 1024)
+       << " MB in " << copyMs << " ms, shared handles "
+       << sharedBytes / (1024 * 1024) << " MB in " << sharedMs << " ms"
+       << endl;
+}
+
+void benchEdgeRendering() {
+  RenderTexture target;
+  if (!target.create(1920, 1080)) {
+    cout << "Could not create an off-screen render target" << endl;
+    return;
+  }
+  const int frames = 20;
+  srand(17);
+  for (int edgeCount : {1000, 10000, 50000}) {
+    vector<RouteEdge> edges;
+    Route r = {"", "", "", "", 0, "", 0};
+    for (int i = 0; i < edgeCount; i++) {
+      Vector2f a(rand() % 1920, rand() % 1080);
+      Vector2f b(rand() % 1920, rand() % 1080);
+      edges.push_back(RouteEdge(a, b, r, ""));
+    }
+
+    Clock clock;
+    for (int f = 0; f < frames; f++) {
+      target.clear();
+      for (auto& edge : edges) edge.draw(target);
+      target.display();
+    }
+    float perEdgeMs = clock.restart().asMicroseconds() / 1000.0f / frames;
+
+    EdgeBatch batch;
+    for (int f = 0; f < frames; f++) {
+      target.clear();
+      batch.sync(edges);
+      batch.draw(target);
+      target.display();
+    }
+    float batchMs = clock.restart().asMicroseconds() / 1000.0f / frames;
+
+    cout << edgeCount << " edges: " << perEdgeMs
+         << " ms per frame with one draw per edge, " << batchMs
+         << " ms with the vertex batch" << endl;
+  }
+}
+
+void benchSimulationRendering() {
+  Font font;
+  if (!font.loadFromFile("arial.ttf")) {
+    cout << "Could not load arial.ttf" << endl;
+    return;
+  }
+  RenderTexture target;
+  if (!target.create(1920, 1080)) {
+    cout << "Could not create an off-screen render target" << endl;
+    return;
+  }
+  Graph g;
+  g.parsePorts("PortCharges.txt");
+  generateSyntheticSchedule(g, "01/12/2024", 30, 6, 42);
+  ItineraryArena results;
+  for (int a = 0; a < g.ports.size() && results.size() < 500; a++) {
+    for (int b = 0; b < g.ports.size(); b++) {
+      if (a != b) g.paretoRouteSearch(a, b, 3, results);
+    }
+  }
+  if (results.empty()) return;
+
+  vector<Location> locations;
+  for (int i = 0; i < g.ports.size(); i++) {
+    Vector2f pos(100 + (i % 8) * 220, 100 + (i / 8) * 180);
+    locations.push_back(Location(g.ports[i].name, pos, font));
+  }
+
+  const int frames = 30;
+  for (int shipCount : {10, 100, 1000, 10000}) {
+    vector<BookedRoute> booked;
+    for (int i = 0; i < shipCount; i++) {
+      booked.push_back(BookedRoute(
+          make_shared<const CompleteRoute>(
+              g.toCompleteRoute(results[i % results.size()])),
+          "A", "B", "01/12/2024"));
+    }
+    LayoverSimulation sim(font);
+    sim.initializeFromBookedRoutes(booked, g);
+    sim.setSpeed(20.0f);
+
+    Clock clock;
+    for (int f = 0; f < frames; f++) {
+      target.clear();
+      sim.update(locations, g);
+      sim.draw(target, locations, g);
+      target.display();
+    }
+    float frameMs = clock.getElapsedTime().asMicroseconds() / 1000.0f / frames;
+    cout << shipCount << " ships: " << frameMs << " ms per frame ("
+         << (frameMs > 0 ? 1000.0f / frameMs : 0.0f) << " FPS)" << endl;
+  }
+}
+
+void benchMapCamera() {
+  Font font;
+  if (!font.loadFromFile("arial.ttf")) {
+    cout << "Could not load arial.ttf" << endl;
+    return;
+  }
+  RenderTexture target;
+  if (!target.create(1920, 1080)) {
+    cout << "Could not create an off-screen render target" << endl;
+    return;
+  }
+  Texture mapTexture;
+  Sprite mapSprite(mapTexture);
+  srand(29);
+  const int frames = 10;
+  for (int edgeCount : {5000, 20000, 50000}) {
+    int portCount = edgeCount / 25;
+    vector<Location> locations;
+    for (int i = 0; i < portCount; i++) {
+      locations.push_back(Location("P" + to_string(i),
+                                   Vector2f(rand() % 1840 + 40,
+                                            rand() % 1000 + 40),
+                                   font));
+    }
+    vector<RouteEdge> edges;
+    Route r = {"", "", "", "", 0, "", 0};
+    for (int i = 0; i < edgeCount; i++) {
+      int a = rand() % portCount;
+      int b = (a + 1 + rand() % 8) % portCount;
+      edges.push_back(
+          RouteEdge(locations[a].position, locations[b].position, r, ""));
+    }
+    MapHitIndex hits;
+    hits.build(locations, edges);
+    EdgeBatch batch;
+    batch.sync(edges);
+    MapNetworkRenderer renderer(font);
+    MapCamera camera;
+    camera.resize(1920, 1080);
+
+    cout << edgeCount << " edges, " << portCount << " ports:";
+    for (float zoom : {1.0f, 0.25f, 0.05f}) {
+      camera.reset();
+      camera.zoomAt(Vector2i(960, 540), zoom);
+      Clock clock;
+      for (int f = 0; f < frames; f++) {
+        target.clear();
+        renderer.draw(target, mapSprite, batch, locations, camera, hits);
+        target.display();
+      }
+      cout << " zoom " << zoom << " "
+           << clock.getElapsedTime().asMicroseconds() / 1000.0f / frames
+           << " ms";
+    }
+    cout << endl;
+  }
+}
+
+void benchForceLayout() {
+  srand(31);
+  for (int portCount : {1000, 10000}) {
+    ForceLayout::Problem problem;
+    for (int i = 0; i < portCount; i++) {
+      problem.positions.push_back(Vector2f(0.1f + rand() % 800 / 1000.0f,
+                                           0.1f + rand() % 800 / 1000.0f));
+      problem.pinned.push_back(i % 10 == 0);
+    }
+    for (int i = 0; i < portCount; i++) {
+      problem.links.push_back({i, (i + 1) % portCount});
+      problem.links.push_back({i, rand() % portCount});
+    }
+    ForceLayout layout;
+    layout.start(problem);
+    layout.wait();
+    cout << portCount << " ports, " << problem.links.size()
+         << " links: " << layout.lastIterations() << " iterations in "
+         << layout.lastSeconds() << " s on "
+         << max(1u, thread::hardware_concurrency()) << " hardware threads"
+         << endl;
   }
+}
 
-  bool checkClose(RenderWindow& window, Event& event) {
-    if (isVisible && closeButton->isClicked(window, event)) {
-      hide();
-      return true;
+void benchEdgeBundling() {
+  Font font;
+  if (!font.loadFromFile("arial.ttf")) {
+    cout << "Could not load arial.ttf" << endl;
+    return;
+  }
+  RenderTexture target;
+  if (!target.create(1920, 1080)) {
+    cout << "Could not create an off-screen render target" << endl;
+    return;
+  }
+  Texture mapTexture;
+  Sprite mapSprite(mapTexture);
+  srand(37);
+  const int portCount = 200, pairCount = 1000, frames = 10;
+  vector<Location> locations;
+  for (int i = 0; i < portCount; i++) {
+    locations.push_back(Location(
+        "P" + to_string(i),
+        Vector2f(rand() % 1840 + 40, rand() % 1000 + 40), font));
+  }
+  vector<pair<int, int>> pairs;
+  for (int i = 0; i < pairCount; i++) {
+    int a = rand() % portCount;
+    pairs.push_back({a, (a + 1 + rand() % (portCount - 1)) % portCount});
+  }
+  for (int legsPerPair : {1, 10, 50}) {
+    vector<RouteEdge> edges;
+    Route r = {"", "", "", "", 0, "", 0};
+    for (const pair<int, int>& p : pairs) {
+      for (int k = 0; k < legsPerPair; k++) {
+        r.cost = 500 + rand() % 1500;
+        edges.push_back(RouteEdge(locations[p.first].position,
+                                  locations[p.second].position, r, ""));
+      }
+    }
+    MapHitIndex hits;
+    hits.build(locations, edges);
+    EdgeBatch batch;
+    batch.sync(edges);
+    MapNetworkRenderer renderer(font);
+    MapCamera camera;
+    camera.resize(1920, 1080);
+
+    cout << edges.size() << " legs on " << hits.groupCount() << " pairs:";
+    for (int bundled = 0; bundled < 2; bundled++) {
+      Clock clock;
+      for (int f = 0; f < frames; f++) {
+        target.clear();
+        renderer.draw(target, mapSprite, batch, locations, camera, hits);
+        target.display();
+      }
+      cout << (bundled ? " bundled " : " straight ")
+           << clock.getElapsedTime().asMicroseconds() / 1000.0f / frames
+           << " ms";
+      renderer.toggleBundling();
     }
-    return false;
+    cout << endl;
   }
-};
-vector<string> extractAvailableDates(const vector<CompleteRoute>& routes) {
-  set<string> uniqueDates;
-  for (const auto& route : routes) {
-    if (!route.routeLegs.empty()) {
-      uniqueDates.insert(route.routeLegs[0].date);
+}
+
+// Runs the bundled schedule through the searches with each weather
+// condition banned and then penalised. Banned ports must never appear on a
+// shortest, cheapest or enumerated route; penalties should only make the
+// routes through affected ports dearer.
+void benchWeatherRouting() {
+  Graph g;
+  g.parsePorts("PortCharges.txt");
+  g.parseRoute("Routes.txt");
+  g.parseWeatherData("WeatherData.txt");
+  int n = g.ports.size();
+  vector<pair<int, int>> pairs;
+  srand(41);
+  for (int i = 0; i < 20; i++) {
+    int a = rand() % n;
+    pairs.push_back({a, (a + 1 + rand() % (n - 1)) % n});
+  }
+
+  vector<ShortestRouteResult> baseCost;
+  for (Port& port : g.ports) baseCost.push_back(g.findCheapestRoute(&port));
+  for (const string& weather : g.getAllWeatherConditions()) {
+    UserPreferences banned;
+    banned.hasWeatherFilter = true;
+    banned.avoidWeather = {weather};
+    SearchConstraints bans = g.compileConstraints(banned);
+    UserPreferences penalised;
+    penalised.hasWeatherFilter = true;
+    penalised.weatherPenalties = {{weather, 3.0f}};
+    SearchConstraints penalties = g.compileConstraints(penalised);
+
+    int bannedPorts = 0, reachable = 0, violations = 0;
+    for (int i = 0; i < n; i++) bannedPorts += !bans.allowsPort(i);
+    Clock clock;
+    double baseTotal = 0, weighedTotal = 0;
+    for (int src = 0; src < n; src++) {
+      if (!bans.allowsPort(src)) continue;
+      ShortestRouteResult fastest = g.findShortestRoute(&g.ports[src], bans);
+      ShortestRouteResult cheapest = g.findCheapestRoute(&g.ports[src], bans);
+      ShortestRouteResult weighed =
+          g.findCheapestRoute(&g.ports[src], penalties);
+      for (int v = 0; v < n; v++) {
+        for (const ShortestRouteResult* r : {&fastest, &cheapest}) {
+          if (!r->found || r->dist[v] == INF) continue;
+          reachable++;
+          for (int p = v; p != -1; p = r->parent[p]) {
+            violations += !bans.allowsPort(p);
+          }
+        }
+        if (weighed.dist[v] != INF && baseCost[src].dist[v] != INF) {
+          baseTotal += baseCost[src].dist[v];
+          weighedTotal += weighed.dist[v];
+        }
+      }
+    }
+    SearchOptions options;
+    options.constraints = &bans;
+    size_t itineraries = 0;
+    for (const pair<int, int>& p : pairs) {
+      if (!bans.allowsPort(p.first) || !bans.allowsPort(p.second)) continue;
+      for (const CompleteRoute& route :
+           g.searchRoutes(p.first, p.second, options)) {
+        itineraries++;
+        for (int port : route.portPath) violations += !bans.allowsPort(port);
+      }
     }
+    cout << weather << ": " << bannedPorts << " ports banned, " << reachable
+         << " reachable pairs, " << itineraries << " itineraries, "
+         << violations << " through banned ports; x3 penalty raises cheapest "
+         << "costs " << fixed << setprecision(1)
+         << (baseTotal > 0 ? (weighedTotal / baseTotal - 1) * 100 : 0)
+         << "%, " << clock.getElapsedTime().asMilliseconds() << " ms"
+         << defaultfloat << endl;
   }
-  return vector<string>(uniqueDates.begin(), uniqueDates.end());
 }
-void showBookingRoute(const vector<Location>& locations, const Graph& g,
-                      const CompleteRoute& route,
-                      vector<RouteEdge>& bookingHighlightedRoutes) {
-  bookingHighlightedRoutes.clear();
 
-  Color routeColor;
-  if (route.layoverCount == 0) {
-    routeColor = Color::Magenta;
-  } else if (route.layoverCount == 1) {
-    routeColor = Color(255, 165, 0, 255);
-  } else {
-    routeColor = Color::Blue;
+void benchCargoFlow() {
+  for (int synthetic = 0; synthetic < 2; synthetic++) {
+    Graph g;
+    g.parsePorts("PortCharges.txt");
+    if (synthetic) {
+      generateSyntheticSchedule(g, "01/12/2024", 90, 6, 42);
+    } else {
+      g.parseRoute("Routes.txt");
+    }
+    int n = g.ports.size();
+    vector<CargoDemand> demands;
+    srand(43);
+    long long requested = 0;
+    for (int i = 0; i < 3000; i++) {
+      int a = rand() % n;
+      int b = (a + 1 + rand() % (n - 1)) % n;
+      int volume = 10 + rand() % 70;
+      string ready = to_string(1 + rand() % (synthetic ? 80 : 20)) +
+                     "/12/2024";
+      demands.push_back({a, b, volume, ready, "Customer" + to_string(i)});
+      requested += volume;
+    }
+
+    CargoFlowPlanner planner(g);
+    CargoPlan plan = planner.plan(demands);
+
+    map<int, int> load;
+    for (const BookedRoute& booking : plan.bookings) {
+      for (const Route& leg : booking.route->routeLegs) {
+        load[leg.edgeId] += booking.volume;
+      }
+    }
+    int overCapacity = 0;
+    size_t legCount = 0;
+    for (int u = 0; u < n; u++) {
+      legCount += g.routes[u].size();
+      for (int r = 0; r < g.routes[u].size(); r++) {
+        auto found = load.find(g.routes[u][r].edgeId);
+        if (found != load.end() &&
+            found->second > planner.getLegCapacity(u, r)) {
+          overCapacity++;
+        }
+      }
+    }
+    long long unmet = 0;
+    for (int v : plan.unmetVolume) unmet += v;
+    cout << (synthetic ? "Synthetic 90-day schedule" : "Bundled schedule")
+         << " (" << legCount << " legs): " << demands.size() << " demands, "
+         << requested << " units, solved in " << plan.solveMs << " ms with "
+         << plan.iterations << " augmentations, " << plan.bookings.size()
+         << " bookings costing $" << plan.totalCost << ", " << unmet
+         << " units unmet, " << overCapacity << " legs over capacity" << endl;
   }
+}
 
-  for (size_t i = 0; i < route.routeLegs.size(); i++) {
-    int fromIdx = route.portPath[i];
-    int toIdx = route.portPath[i + 1];
+int runBenchmarks(const string& name) {
+  if (name.empty() || name == "departures") benchDepartureIndex();
+  if (name.empty() || name == "edges") benchEdgeFilters();
+  if (name.empty() || name == "simd") benchEdgeKernels();
+  if (name.empty() || name == "bookings") benchBookedItineraries();
+  if (name.empty() || name == "render") benchEdgeRendering();
+  if (name.empty() || name == "simulation") benchSimulationRendering();
+  if (name.empty() || name == "camera") benchMapCamera();
+  if (name.empty() || name == "layout") benchForceLayout();
+  if (name.empty() || name == "bundling") benchEdgeBundling();
+  if (name.empty() || name == "weather") benchWeatherRouting();
+  if (name.empty() || name == "flow") benchCargoFlow();
+  return 0;
+}
 
-    RouteEdge edge(locations[fromIdx].position, locations[toIdx].position,
-                   route.routeLegs[i], g.ports[fromIdx].name);
-    edge.line.setFillColor(routeColor);
-    bookingHighlightedRoutes.push_back(edge);
+// Decides when the main loop renders. A frame is drawn after input, while
+// something animates, or when requestRedraw() was called; otherwise
+// nextEvent() blocks in waitEvent so an idle screen uses no CPU. Frames are
+// paced to the FPS cap (0 = uncapped) by sleeping off the rest of the budget.
+class FrameScheduler {
+ public:
+  FrameScheduler(unsigned fps)
+      : fpsCap(fps),
+        redrawPending(true),
+        animating(false),
+        inFrame(false),
+        statFrames(0),
+        statBusyUs(0),
+        lastFrameMs(0),
+        averageFrameMs(0),
+        measuredFps(0),
+        cpuPercent(0) {}
+
+  void setFpsCap(unsigned fps) { fpsCap = fps; }
+  void requestRedraw() { redrawPending = true; }
+  void setAnimating(bool active) { animating = active; }
+
+  // Use in place of window.pollEvent(); the first call of a frame waits for
+  // input when there is nothing else to draw.
+  bool nextEvent(RenderWindow& window, Event& event) {
+    if (!inFrame) {
+      inFrame = true;
+      bool idle = !redrawPending && !animating;
+      redrawPending = false;
+      if (idle) {
+        bool received = window.waitEvent(event);
+        frameClock.restart();
+        return received;
+      }
+      frameClock.restart();
+    }
+    return window.pollEvent(event);
+  }
+
+  // Call after window.display().
+  void endFrame() {
+    inFrame = false;
+    Int64 workUs = frameClock.getElapsedTime().asMicroseconds();
+    lastFrameMs = workUs / 1000.0f;
+    statFrames++;
+    statBusyUs += workUs;
+
+    if (fpsCap > 0) {
+      Int64 budgetUs = 1000000 / fpsCap;
+      if (workUs < budgetUs) sleep(microseconds(budgetUs - workUs));
+    }
+
+    Int64 wallUs = statsClock.getElapsedTime().asMicroseconds();
+    if (wallUs >= 1000000) {
+      measuredFps = statFrames * 1e6f / wallUs;
+      averageFrameMs = statBusyUs / 1000.0f / statFrames;
+      cpuPercent = 100.0f * statBusyUs / wallUs;
+      statFrames = 0;
+      statBusyUs = 0;
+      statsClock.restart();
+    }
+  }
+
+  float frameMs() const { return lastFrameMs; }
+  float fps() const { return measuredFps; }
+  float cpuUsage() const { return cpuPercent; }
+
+  string statsLine() const {
+    ostringstream out;
+    out << fixed << setprecision(1) << "FPS: " << measuredFps
+        << " | Frame: " << averageFrameMs << " ms | CPU: " << cpuPercent
+        << "% | Cap: " << (fpsCap ? to_string(fpsCap) : string("off"));
+    return out.str();
   }
-}
+
+ private:
+  unsigned fpsCap;
+  bool redrawPending;
+  bool animating;
+  bool inFrame;
+  Clock frameClock;
+  Clock statsClock;
+  int statFrames;
+  Int64 statBusyUs;
+  float lastFrameMs;
+  float averageFrameMs;
+  float measuredFps;
+  float cpuPercent;
+};
+
 enum GameState {
   MAIN_MENU,
   NAVIGATION_MENU,
@@ -5382,14 +9910,53 @@ enum GameState {
   BOOK_CARGO_CONFIRM,
 };
 
-int main() {
+bool showsMap(GameState state) {
+  switch (state) {
+    case MAP_VIEW:
+    case SEARCH_ROUTES:
+    case SHORTEST_ROUTE_SELECT:
+    case CHEAPEST_ROUTE_SELECT:
+    case FILTER_RESULT_MAP:
+    case PROCESS_LAYOVERS:
+    case TRACK_MULTI_LEG:
+    case TRACK_MULTI_LEG_ADD_PORT:
+    case SUBGRAPH_VIEW:
+    case BOOK_CARGO_SELECT_PORTS:
+    case BOOK_CARGO_SELECT_DATE:
+    case BOOK_CARGO_VIEW_ROUTES:
+    case BOOK_CARGO_CONFIRM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string(argv[1]) == "--bench") {
+    return runBenchmarks(argc > 2 ? argv[2] : "");
+  }
+  unsigned fpsCap = 60;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (string(argv[i]) == "--fps") fpsCap = max(0, atoi(argv[i + 1]));
+  }
+
   Graph g;
   g.parsePorts("PortCharges.txt");
   g.parseRoute("Routes.txt");
   g.parseWeatherData("WeatherData.txt");
+  g.parseConnectionTimes("ConnectionTimes.txt");
+  g.parsePortCoordinates("PortCoordinates.txt");
 
   vector<string> weatherConditions = g.getAllWeatherConditions();
   vector<string> availableCompanies = g.getAllShippingCompanies();
+  DynamicShortestPaths shortestPaths(g, false);
+  DynamicShortestPaths cheapestPaths(g, true);
+  size_t mapSyncedChange = g.getChangeCount();
+  MapEdgeIndex mapEdgeIndex;
+  SearchOptions searchOptions;
+  RouteShardStore routeShards(g);
+  SubgraphIndex subgraphs;
+  subgraphs.build(g);
   Font font;
   if (!font.loadFromFile("arial.ttf")) {
     cout << "Error: Could not load arial.ttf, trying system font..." << endl;
@@ -5427,6 +9994,18 @@ int main() {
   Sprite mapSprite;
   vector<Location> locations;
   vector<RouteEdge> edges;
+  EdgeBatch edgeBatch;
+  MapLayer mapLayer;
+  MapHitIndex mapHits;
+  MapLayout mapLayout;
+  ForceLayout forceLayout;
+  size_t layoutChange = g.getChangeCount();
+  forceLayout.start(g, mapLayout);
+  MapFilterView filterView;
+  MapCamera camera;
+  camera.resize(windowWidth, windowHeight);
+  MapNetworkRenderer mapRenderer(font);
+  int hoveredLocation = -1;
   RouteTooltip routeTooltip(font);
   InfoWindow infoWindow(font, windowWidth, windowHeight);
   RouteDisplayWindow routeDisplayWindow(font, windowWidth, windowHeight);
@@ -5438,7 +10017,7 @@ int main() {
   bool shortestRouteCalculated = false;
   vector<RouteEdge> cheapestPathEdges;
   bool cheapestRouteCalculated = false;
-  UserPreferences userPreferences = {{}, {}, 999999, false, false, false};
+  UserPreferences userPreferences;
   MultiLegJourney currentJourney;
   int selectedJourneyPortIdx = -1;
   bool journeyBuildingMode = false;
@@ -5455,12 +10034,14 @@ int main() {
 
   vector<int> bookingSelectedPorts;
   string selectedBookingDate = "";
-  vector<CompleteRoute> availableBookingRoutes;
+  ItineraryHandle selectedBookingRoute;
+  ItineraryArena bookingResults;
+  ItineraryArena searchResults;
   int selectedBookingRouteIndex = -1;
   bool showingBookingRoutes = false;
   vector<RouteEdge> bookingHighlightedRoutes;
   Button* bookRouteButton = nullptr;
-  LayoverSimulation layoverSim;
+  LayoverSimulation layoverSim(font);
   LayoverControlPanel* layoverControls = nullptr;
   float currentSimSpeed = 1.0f;
   FilterSidebar filterSidebar(font, windowWidth, windowHeight);
@@ -5509,19 +10090,49 @@ int main() {
   FilterPreferencesMenu filterMenu(font, windowWidth, windowHeight,
                                    oceanTexture);
   GameState currentState = MAIN_MENU;
+  GameState renderedState = currentState;
   CompanySelectionWindow companyWindow(font, windowWidth, windowHeight);
   PortAvoidanceWindow portWindow(font, windowWidth, windowHeight);
   VoyageTimeWindow timeWindow(font, windowWidth, windowHeight);
+  // While one of these is open the map underneath takes no wheel zoom.
+  auto modalWindowOpen = [&]() {
+    return companyWindow.visible() || portWindow.visible() ||
+           timeWindow.visible() || filterPopup.visible() ||
+           filterMenu.visible() || portAddWindow.visible() ||
+           dateSelectionWindow.visible() || routeBookingWindow.visible() ||
+           bookingConfirmationWindow.visible();
+  };
+  FrameScheduler frameScheduler(fpsCap);
+  bool showFrameStats = false;
+  Text frameStatsText;
+  frameStatsText.setFont(font);
+  frameStatsText.setCharacterSize(16);
+  frameStatsText.setFillColor(Color::White);
+  frameStatsText.setOutlineThickness(2);
+  frameStatsText.setOutlineColor(Color::Black);
+  Text bundlingHint = frameStatsText;
+  bundlingHint.setString(
+      "Bundled routes (F4). Highlighted routes and route hover still use "
+      "straight lines.");
   while (window.isOpen()) {
     Event event;
-    while (window.pollEvent(event)) {
+    while (frameScheduler.nextEvent(window, event)) {
+      if (event.type != Event::MouseMoved) mapLayer.invalidate();
+      if (showsMap(currentState)) camera.handleEvent(event);
+      if (event.type == Event::KeyPressed && event.key.code == Keyboard::F3) {
+        showFrameStats = !showFrameStats;
+      }
+      if (event.type == Event::KeyPressed && event.key.code == Keyboard::F4 &&
+          showsMap(currentState)) {
+        mapRenderer.toggleBundling();
+      }
       if (event.type == Event::Closed) window.close();
       if (event.type == Event::Resized) {
         windowWidth = event.size.width;
         windowHeight = event.size.height;
 
-        View view(FloatRect(0, 0, event.size.width, event.size.height));
-        window.setView(view);
+        camera.resize(windowWidth, windowHeight);
+        window.setView(camera.worldView());
 
         if (oceanLoaded) {
           Vector2u oceanTextureSize = oceanTexture.getSize();
@@ -5548,10 +10159,10 @@ int main() {
         if (currentState == MAP_VIEW || currentState == SEARCH_ROUTES ||
             currentState == SHORTEST_ROUTE_SELECT ||
             currentState == CHEAPEST_ROUTE_SELECT) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
 
-          if (userPreferences.hasCompanyFilter ||
-              userPreferences.hasPortFilter || userPreferences.hasTimeFilter) {
+          if (userPreferences.filtersActive()) {
             customShipPreferences(userPreferences, locations, edges, g);
           }
         }
@@ -5562,6 +10173,12 @@ int main() {
         }
         if (routeDisplayWindow.isMouseOverWindow(window)) {
           routeDisplayWindow.scroll(event.mouseWheelScroll.delta);
+        } else if (showsMap(currentState) && !modalWindowOpen() &&
+                   !infoWindow.isMouseOverWindow(window) &&
+                   !journeyControls.isMouseOver(window)) {
+          camera.zoomAt(
+              Vector2i(event.mouseWheelScroll.x, event.mouseWheelScroll.y),
+              event.mouseWheelScroll.delta > 0 ? 0.8f : 1.25f);
         }
       }
 
@@ -5599,17 +10216,19 @@ int main() {
       else if (currentState == NAVIGATION_MENU) {
         int clicked = navMenu.checkClick(window, event);
         if (clicked == 0) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           selectedPorts.clear();
           highlightedRoutes.clear();
           routesDisplayed = false;
           currentState = SEARCH_ROUTES;
           navMenu.hide();
         } else if (clicked == 1) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           bookingSelectedPorts.clear();
           selectedBookingDate = "";
-          availableBookingRoutes.clear();
+          selectedBookingRoute.reset();
           bookingHighlightedRoutes.clear();
           showingBookingRoutes = false;
           selectedBookingRouteIndex = -1;
@@ -5621,12 +10240,14 @@ int main() {
           currentState = BOOK_CARGO_SELECT_PORTS;
           navMenu.hide();
         } else if (clicked == 2) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           selectedEdgeIndex = -1;
           currentState = MAP_VIEW;
           navMenu.hide();
         } else if (clicked == 3) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           selectedEdgeIndex = -1;
           selectedPorts.clear();
           shortestPathEdges.clear();
@@ -5634,7 +10255,8 @@ int main() {
           currentState = SHORTEST_ROUTE_SELECT;
           navMenu.hide();
         } else if (clicked == 4) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           selectedEdgeIndex = -1;
           selectedPorts.clear();
           cheapestPathEdges.clear();
@@ -5655,13 +10277,14 @@ int main() {
             noBookings.setFillColor(Color::Red);
           } else {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             layoverSim.initializeFromBookedRoutes(bookedRoutes, g);
             currentState = PROCESS_LAYOVERS;
             navMenu.hide();
           }
         } else if (clicked == 7) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
 
           currentJourney = MultiLegJourney();
           currentJourney.isComplete = false;
@@ -5695,7 +10318,7 @@ int main() {
             timeWindow.show(userPreferences.maxVoyageTime);
           } else if (popupClick == 3) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             filterPopup.hide();
             cout << "Filters applied!" << endl;
@@ -5764,13 +10387,16 @@ int main() {
           userPreferences.hasCompanyFilter = false;
           userPreferences.hasPortFilter = false;
           userPreferences.hasTimeFilter = false;
+          userPreferences.hasWeatherFilter = false;
           userPreferences.maxVoyageTime = 999999;
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
           cout << "All filters removed!" << endl;
         } else if (!filterPopup.isMouseOverWindow(window)) {
           bool locationClicked = false;
 
-          for (auto& location : locations) {
+          for (int i : mapHits.locationsAt(window)) {
+            Location& location = locations[i];
             if (userPreferences.hasPortFilter &&
                 g.portIsAvoid(location.name, userPreferences)) {
               continue;
@@ -5790,7 +10416,7 @@ int main() {
           }
 
           if (!locationClicked) {
-            for (int i = 0; i < edges.size(); i++) {
+            for (int i : mapHits.edgesAt(window)) {
               bool sourceAvoid =
                   g.portIsAvoid(edges[i].sourceName, userPreferences);
               bool destAvoid = g.portIsAvoid(edges[i].routeInfo.destination,
@@ -5833,7 +10459,7 @@ int main() {
             timeWindow.show(userPreferences.maxVoyageTime);
           } else if (popupClick == 3) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             filterPopup.hide();
             cout << "Filters applied!" << endl;
@@ -5902,6 +10528,7 @@ int main() {
           userPreferences.hasCompanyFilter = false;
           userPreferences.hasPortFilter = false;
           userPreferences.hasTimeFilter = false;
+          userPreferences.hasWeatherFilter = false;
           userPreferences.maxVoyageTime = 999999;
           highlightedRoutes.clear();
           routesDisplayed = false;
@@ -5913,7 +10540,7 @@ int main() {
         } else if (!filterPopup.isMouseOverWindow(window)) {
           bool locationClicked = false;
 
-          for (int i = 0; i < locations.size(); i++) {
+          for (int i : mapHits.locationsAt(window)) {
             if (userPreferences.hasPortFilter &&
                 g.portIsAvoid(locations[i].name, userPreferences)) {
               continue;
@@ -5946,70 +10573,47 @@ int main() {
                 int srcIdx = selectedPorts[0];
                 int destIdx = selectedPorts[1];
 
-                vector<CompleteRoute> allRoutes =
-                    g.findAllPossibleRoutes(srcIdx, destIdx);
-                vector<CompleteRoute> filteredRoutes;
-
-                for (const auto& route : allRoutes) {
-                  bool routeValid = true;
-
-                  for (const Route& leg : route.routeLegs) {
-                    if (!g.routeMatchesPreferences(leg, userPreferences)) {
-                      routeValid = false;
-                      break;
-                    }
-                  }
-
-                  if (routeValid) {
-                    for (int portIdx : route.portPath) {
-                      if (g.portIsAvoid(g.ports[portIdx].name,
-                                        userPreferences)) {
-                        routeValid = false;
-                        break;
-                      }
-                    }
-                  }
-
-                  if (routeValid) {
-                    filteredRoutes.push_back(route);
-                  }
-                }
+                SearchConstraints constraints =
+                    g.compileConstraints(userPreferences);
+                SearchOptions options = searchOptions;
+                options.constraints = &constraints;
+                searchResults.reset();
+                g.searchRoutes(srcIdx, destIdx, options, searchResults);
+                searchResults.removeDuplicates();
 
                 highlightedRoutes.clear();
 
-                if (filteredRoutes.empty()) {
+                if (searchResults.empty()) {
                   vector<string> info;
                   info.push_back("No routes found matching your filters");
                   infoWindow.show("No Routes", info);
                 } else {
-                  for (const auto& completeRoute : filteredRoutes) {
+                  for (const Itinerary& itinerary : searchResults) {
+                    if (!g.itineraryLive(itinerary)) continue;
                     Color routeColor;
-                    if (completeRoute.layoverCount == 0) {
+                    if (itinerary.layoverCount == 0) {
                       routeColor = Color::Magenta;
-                    } else if (completeRoute.layoverCount == 1) {
+                    } else if (itinerary.layoverCount == 1) {
                       routeColor = Color(255, 165, 0, 255);
                     } else {
                       routeColor = Color::Blue;
                     }
 
-                    for (size_t i = 0; i < completeRoute.routeLegs.size();
-                         i++) {
-                      int fromIdx = completeRoute.portPath[i];
-                      int toIdx = completeRoute.portPath[i + 1];
+                    for (int i = 0; i < itinerary.legCount; i++) {
+                      int fromIdx = g.itineraryPort(itinerary, i);
+                      int toIdx = g.itineraryPort(itinerary, i + 1);
 
                       RouteEdge edge(locations[fromIdx].position,
                                      locations[toIdx].position,
-                                     completeRoute.routeLegs[i],
+                                     *g.edgeRoute(itinerary.legs[i]),
                                      g.ports[fromIdx].name);
                       edge.line.setFillColor(routeColor);
                       highlightedRoutes.push_back(edge);
                     }
                   }
 
-                  vector<string> routeDisplay =
-                      g.formatAllRoutes(srcIdx, destIdx);
-                  routeDisplayWindow.show(g.ports[srcIdx].name,
-                                          g.ports[destIdx].name, routeDisplay);
+                  routeDisplayWindow.showAllRoutes(g, srcIdx, destIdx,
+                                                 searchResults);
                   routesDisplayed = true;
                 }
               }
@@ -6046,7 +10650,7 @@ int main() {
             timeWindow.show(userPreferences.maxVoyageTime);
           } else if (popupClick == 3) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             filterPopup.hide();
             cout << "Filters applied!" << endl;
@@ -6115,6 +10719,7 @@ int main() {
           userPreferences.hasCompanyFilter = false;
           userPreferences.hasPortFilter = false;
           userPreferences.hasTimeFilter = false;
+          userPreferences.hasWeatherFilter = false;
           userPreferences.maxVoyageTime = 999999;
           selectedPorts.clear();
           shortestPathEdges.clear();
@@ -6125,7 +10730,7 @@ int main() {
           cout << "All filters removed!" << endl;
         } else if (!filterPopup.isMouseOverWindow(window)) {
           bool locationClicked = false;
-          for (int i = 0; i < locations.size(); i++) {
+          for (int i : mapHits.locationsAt(window)) {
             if (userPreferences.hasPortFilter &&
                 g.portIsAvoid(locations[i].name, userPreferences)) {
               continue;
@@ -6153,16 +10758,13 @@ int main() {
               if (selectedPorts.size() == 2) {
                 int srcIdx = selectedPorts[0];
                 int destIdx = selectedPorts[1];
-                if (userPreferences.hasCompanyFilter ||
-                    userPreferences.hasPortFilter ||
-                    userPreferences.hasTimeFilter) {
+                if (userPreferences.filtersActive()) {
                   shortestRouteResult =
                       g.findShortestRoute(&g.ports[srcIdx], &userPreferences);
                   cout << "Computing shortest route WITH FILTERS applied"
                        << endl;
                 } else {
-                  shortestRouteResult =
-                      g.findShortestRoute(&g.ports[srcIdx], &userPreferences);
+                  shortestRouteResult = shortestPaths.query(srcIdx);
                   cout << "Computing shortest route (no filters)" << endl;
                 }
 
@@ -6175,63 +10777,23 @@ int main() {
                     curr = shortestRouteResult.parent[curr];
                   }
                   reverse(path.begin(), path.end());
-                  vector<Route> routeLegs;
+                  vector<Route> routeLegs =
+                      g.pathLegs(shortestRouteResult, destIdx);
                   int totalTime = 0;
                   int totalCost = 0;
 
                   shortestPathEdges.clear();
-                  for (int i = 0; i < path.size() - 1; i++) {
+                  for (size_t i = 0; i < routeLegs.size(); i++) {
                     int from = path[i];
                     int to = path[i + 1];
-
-                    bool legFound = false;
-                    for (const Route& route : g.routes[from]) {
-                      if (route.destination == g.ports[to].name) {
-                        bool routeValid = true;
-                        if (userPreferences.hasCompanyFilter) {
-                          bool found = false;
-                          for (const string& comp :
-                               userPreferences.preferredCompanies) {
-                            if (route.company == comp) {
-                              found = true;
-                              break;
-                            }
-                          }
-                          routeValid = found;
-                        }
-                        if (routeValid && userPreferences.hasTimeFilter) {
-                          routeValid =
-                              route.travelTime <= userPreferences.maxVoyageTime;
-                        }
-
-                        if (routeValid) {
-                          if (!routeLegs.empty()) {
-                            if (!isValidLegTransition(routeLegs.back(),
-                                                      route)) {
-                              continue;
-                            }
-                          }
-
-                          routeLegs.push_back(route);
-                          totalTime += route.travelTime;
-                          totalCost += route.cost;
-
-                          RouteEdge edge(locations[from].position,
-                                         locations[to].position, route,
-                                         g.ports[from].name);
-                          edge.line.setFillColor(Color::Green);
-                          shortestPathEdges.push_back(edge);
-                          legFound = true;
-                          break;
-                        }
-                      }
-                    }
-
-                    if (!legFound) {
-                      cout << "Warning: No valid route leg found from "
-                           << g.ports[from].name << " to " << g.ports[to].name
-                           << endl;
-                    }
+                    totalTime += routeLegs[i].travelTime;
+                    totalCost += routeLegs[i].cost;
+
+                    RouteEdge edge(locations[from].position,
+                                   locations[to].position, routeLegs[i],
+                                   g.ports[from].name);
+                    edge.line.setFillColor(Color::Green);
+                    shortestPathEdges.push_back(edge);
                   }
 
                   for (size_t i = 1; i < path.size(); i++) {
@@ -6251,6 +10813,13 @@ int main() {
                   shortestRouteDisplay.push_back(
                       "Total Time: " + to_string(totalTime / 60) + "h " +
                       to_string(totalTime % 60) + "m");
+                  int doorToDoor = routeLegs.empty()
+                                       ? 0
+                                       : routeLegs.back().arrStamp -
+                                             routeLegs.front().depStamp;
+                  shortestRouteDisplay.push_back(
+                      "Door-to-Door: " + to_string(doorToDoor / 60) + "h " +
+                      to_string(doorToDoor % 60) + "m");
                   shortestRouteDisplay.push_back("Total Cost: $" +
                                                  to_string(totalCost));
                   shortestRouteDisplay.push_back("Number of Legs: " +
@@ -6282,15 +10851,14 @@ int main() {
 
                 } else {
                   vector<string> info;
-                  if (userPreferences.hasCompanyFilter ||
-                      userPreferences.hasPortFilter ||
-                      userPreferences.hasTimeFilter) {
+                  if (userPreferences.filtersActive()) {
                     info.push_back("No shortest route found!");
                     info.push_back("");
                     info.push_back("This may be because:");
                     info.push_back("- No routes match the selected companies");
                     info.push_back("- Route passes through avoided ports");
                     info.push_back("- No routes within max voyage time");
+                    info.push_back("- Ports with avoided weather");
                   } else {
                     info.push_back("No route found between these ports");
                   }
@@ -6331,7 +10899,7 @@ int main() {
             timeWindow.show(userPreferences.maxVoyageTime);
           } else if (popupClick == 3) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             filterPopup.hide();
             cout << "Filters applied!" << endl;
@@ -6400,6 +10968,7 @@ int main() {
           userPreferences.hasCompanyFilter = false;
           userPreferences.hasPortFilter = false;
           userPreferences.hasTimeFilter = false;
+          userPreferences.hasWeatherFilter = false;
           userPreferences.maxVoyageTime = 999999;
           selectedPorts.clear();
           cheapestPathEdges.clear();
@@ -6410,7 +10979,7 @@ int main() {
           cout << "All filters removed!" << endl;
         } else if (!filterPopup.isMouseOverWindow(window)) {
           bool locationClicked = false;
-          for (int i = 0; i < locations.size(); i++) {
+          for (int i : mapHits.locationsAt(window)) {
             if (userPreferences.hasPortFilter &&
                 g.portIsAvoid(locations[i].name, userPreferences)) {
               continue;
@@ -6439,8 +11008,12 @@ int main() {
                 int srcIdx = selectedPorts[0];
                 int destIdx = selectedPorts[1];
 
-                shortestRouteResult =
-                    g.findCheapestRoute(&g.ports[srcIdx], &userPreferences);
+                if (userPreferences.filtersActive()) {
+                  shortestRouteResult =
+                      g.findCheapestRoute(&g.ports[srcIdx], &userPreferences);
+                } else {
+                  shortestRouteResult = cheapestPaths.query(srcIdx);
+                }
                 if (shortestRouteResult.found &&
                     shortestRouteResult.dist[destIdx] != INF) {
                   vector<int> path;
@@ -6450,48 +11023,22 @@ int main() {
                     curr = shortestRouteResult.parent[curr];
                   }
                   reverse(path.begin(), path.end());
-                  vector<Route> routeLegs;
+                  vector<Route> routeLegs =
+                      g.pathLegs(shortestRouteResult, destIdx);
                   int totalTime = 0;
                   int totalCost = shortestRouteResult.dist[destIdx];
 
                   cheapestPathEdges.clear();
-                  for (int i = 0; i < path.size() - 1; i++) {
+                  for (size_t i = 0; i < routeLegs.size(); i++) {
                     int from = path[i];
                     int to = path[i + 1];
+                    totalTime += routeLegs[i].travelTime;
 
-                    bool legFound = false;
-                    for (const Route& route : g.routes[from]) {
-                      if (route.destination == g.ports[to].name) {
-                        bool routeValid =
-                            g.routeMatchesPreferences(route, userPreferences);
-
-                        if (routeValid) {
-                          if (!routeLegs.empty()) {
-                            if (!isValidLegTransition(routeLegs.back(),
-                                                      route)) {
-                              continue;
-                            }
-                          }
-
-                          routeLegs.push_back(route);
-                          totalTime += route.travelTime;
-
-                          RouteEdge edge(locations[from].position,
-                                         locations[to].position, route,
-                                         g.ports[from].name);
-                          edge.line.setFillColor(Color::Blue);
-                          cheapestPathEdges.push_back(edge);
-                          legFound = true;
-                          break;
-                        }
-                      }
-                    }
-
-                    if (!legFound) {
-                      cout << "Warning: No valid route leg found from "
-                           << g.ports[from].name << " to " << g.ports[to].name
-                           << endl;
-                    }
+                    RouteEdge edge(locations[from].position,
+                                   locations[to].position, routeLegs[i],
+                                   g.ports[from].name);
+                    edge.line.setFillColor(Color::Blue);
+                    cheapestPathEdges.push_back(edge);
                   }
 
                   cheapestRouteCalculated = true;
@@ -6561,9 +11108,7 @@ int main() {
 
                 } else {
                   vector<string> info;
-                  if (userPreferences.hasCompanyFilter ||
-                      userPreferences.hasPortFilter ||
-                      userPreferences.hasTimeFilter) {
+                  if (userPreferences.filtersActive()) {
                     info.push_back(
                         "No shortest route found with current filters!");
                     info.push_back("");
@@ -6571,6 +11116,7 @@ int main() {
                     info.push_back("- No routes match the selected companies");
                     info.push_back("- Route passes through avoided ports");
                     info.push_back("- No routes within max voyage time");
+                    info.push_back("- Ports with avoided weather");
                     info.push_back("- Timing constraints between legs");
                   } else {
                     info.push_back("No route found between these ports");
@@ -6605,7 +11151,7 @@ int main() {
                  !infoWindow.visible()) {
         bool locationClicked = false;
 
-        for (int i = 0; i < locations.size(); i++) {
+        for (int i : mapHits.locationsAt(window)) {
           if (locations[i].isClicked(window, event)) {
             bool alreadySelected = false;
             for (int idx : bookingSelectedPorts) {
@@ -6622,11 +11168,10 @@ int main() {
               if (bookingSelectedPorts.size() == 2) {
                 int srcIdx = bookingSelectedPorts[0];
                 int destIdx = bookingSelectedPorts[1];
-                availableBookingRoutes =
-                    g.findAllPossibleRoutes(srcIdx, destIdx);
+                selectedBookingRoute.reset();
 
                 vector<string> availableDates =
-                    extractAvailableDates(availableBookingRoutes);
+                    routeShards.departureDates(srcIdx, destIdx, searchOptions);
 
                 if (!availableDates.empty()) {
                   dateSelectionWindow.show(g.ports[srcIdx].name,
@@ -6682,32 +11227,32 @@ int main() {
           selectedBookingDate = dateSelectionWindow.getSelectedDate();
           if (!selectedBookingDate.empty()) {
             dateSelectionWindow.hide();
-            vector<CompleteRoute> filteredRoutes;
-            for (const auto& route : availableBookingRoutes) {
-              if (!route.routeLegs.empty() &&
-                  route.routeLegs[0].date == selectedBookingDate) {
-                filteredRoutes.push_back(route);
-              }
-            }
-
-            cout << "Found " << filteredRoutes.size() << " routes on "
+            bookingResults.reset();
+            routeShards.searchFromDate(bookingSelectedPorts[0],
+                                       bookingSelectedPorts[1],
+                                       selectedBookingDate, bookingResults,
+                                       searchOptions);
+            bookingResults.removeDuplicates();
+
+            cout << "Found " << bookingResults.size() << " routes on "
                  << selectedBookingDate << endl;
 
-            if (filteredRoutes.size() == 1) {
-              showBookingRoute(locations, g, filteredRoutes[0],
+            selectedBookingRoute.reset();
+            if (bookingResults.size() == 1) {
+              selectedBookingRoute = make_shared<const CompleteRoute>(
+                  g.toCompleteRoute(bookingResults[0]));
+              showBookingRoute(locations, g, *selectedBookingRoute,
                                bookingHighlightedRoutes);
               showingBookingRoutes = true;
-              availableBookingRoutes = filteredRoutes;
               currentState = BOOK_CARGO_VIEW_ROUTES;
               cout << "Showing single route visualization" << endl;
-            } else if (filteredRoutes.size() > 1) {
+            } else if (bookingResults.size() > 1) {
               routeBookingWindow.show(g.ports[bookingSelectedPorts[0]].name,
                                       g.ports[bookingSelectedPorts[1]].name,
-                                      selectedBookingDate, filteredRoutes, g);
-              availableBookingRoutes = filteredRoutes;
+                                      selectedBookingDate, bookingResults, g);
               currentState = BOOK_CARGO_VIEW_ROUTES;
               cout << "Showing route selection window with "
-                   << filteredRoutes.size() << " options" << endl;
+                   << bookingResults.size() << " options" << endl;
             } else {
               vector<string> info;
               info.push_back("No routes available on " + selectedBookingDate);
@@ -6735,29 +11280,33 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
             dateSelectionWindow.show(
                 g.ports[bookingSelectedPorts[0]].name,
                 g.ports[bookingSelectedPorts[1]].name,
-                extractAvailableDates(availableBookingRoutes)
+                routeShards.departureDates(bookingSelectedPorts[0],
+                                           bookingSelectedPorts[1],
+                                           searchOptions)
             );
         }
         else if (clicked == RouteBookingWindow::BOOK) {
-            CompleteRoute selectedRoute = routeBookingWindow.getSelectedRoute();
-            
-            availableBookingRoutes.clear();
-            availableBookingRoutes.push_back(selectedRoute);
-            
-            routeBookingWindow.hide();
-            
-            bookingConfirmationWindow.show(
-                selectedRoute,
-                g.ports[bookingSelectedPorts[0]].name,
-                g.ports[bookingSelectedPorts[1]].name,
-                selectedBookingDate,
-                g
-            );
-            currentState = BOOK_CARGO_CONFIRM;
-            cout << "Booking confirmed for Route " << (routeBookingWindow.selectedRouteIndex + 1) << "!" << endl;
+            selectedBookingRoute = routeBookingWindow.getSelectedRoute();
+            if (selectedBookingRoute) {
+                int bookedIndex = routeBookingWindow.selectedRouteIndex;
+                
+                routeBookingWindow.hide();
+                
+                bookingConfirmationWindow.show(
+                    *selectedBookingRoute,
+                    g.ports[bookingSelectedPorts[0]].name,
+                    g.ports[bookingSelectedPorts[1]].name,
+                    selectedBookingDate,
+                    g
+                );
+                currentState = BOOK_CARGO_CONFIRM;
+                cout << "Booking confirmed for Route " << (bookedIndex + 1) << "!" << endl;
+            } else {
+                cout << "Selected route is no longer available" << endl;
+            }
         }
         else if (clicked >= 0) {
-            cout << "User selected route " << (clicked + 1) << " of " << availableBookingRoutes.size() << endl;
+            cout << "User selected route " << (clicked + 1) << " of " << bookingResults.size() << endl;
         }
     }
     
@@ -6767,16 +11316,17 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         dateSelectionWindow.show(
             g.ports[bookingSelectedPorts[0]].name,
             g.ports[bookingSelectedPorts[1]].name,
-            extractAvailableDates(availableBookingRoutes)
+            routeShards.departureDates(bookingSelectedPorts[0],
+                                       bookingSelectedPorts[1],
+                                       searchOptions)
         );
     }
 }
 
       else if (currentState == BOOK_CARGO_CONFIRM) {
         if (bookingConfirmationWindow.checkClose(window, event)) {
-          if (!availableBookingRoutes.empty()) {
-            CompleteRoute bookedRoute = availableBookingRoutes[0];
-            BookedRoute newBooking(bookedRoute,
+          if (selectedBookingRoute) {
+            BookedRoute newBooking(selectedBookingRoute,
                                    g.ports[bookingSelectedPorts[0]].name,
                                    g.ports[bookingSelectedPorts[1]].name,
                                    selectedBookingDate, "Guest");
@@ -6787,7 +11337,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
 
           bookingSelectedPorts.clear();
           selectedBookingDate = "";
-          availableBookingRoutes.clear();
+          selectedBookingRoute.reset();
           bookingHighlightedRoutes.clear();
           showingBookingRoutes = false;
           if (bookRouteButton) {
@@ -6878,7 +11428,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         } else if (!journeyControls.isMouseOver(window)) {
           bool locationClicked = false;
 
-          for (int i = 0; i < locations.size(); i++) {
+          for (int i : mapHits.locationsAt(window)) {
             if (locations[i].isClicked(window, event)) {
               bool isInJourney = false;
               int journeyIndex = -1;
@@ -7080,7 +11630,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
           if (clicked == filterMenu.getButtonCount() - 1) {
             userPreferences.hasCompanyFilter = true;
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             currentState = FILTER_RESULT_MAP;
             cout << "Company filter applied, showing filtered map" << endl;
@@ -7106,7 +11656,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
           if (clicked == filterMenu.getButtonCount() - 1) {
             userPreferences.hasPortFilter = true;
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             currentState = FILTER_RESULT_MAP;
             cout << "Port filter applied, showing filtered map" << endl;
@@ -7166,7 +11716,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
 
           if (timeSelected) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             currentState = FILTER_RESULT_MAP;
           }
@@ -7264,7 +11814,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
 
           if (timeSelected) {
             loadMapView(mapTexture, mapSprite, locations, edges, window, font,
-                        g);
+                        g, mapHits, mapLayout);
             customShipPreferences(userPreferences, locations, edges, g);
             currentState = FILTER_RESULT_MAP;
           }
@@ -7301,9 +11851,10 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
                 subgraphMenu.buttons[i]->normalColor);
           }
         } else if (clicked == -4) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
 
-          displaySubgraph(g, locations, edges, subgraphMenu);
+          displaySubgraph(g, locations, edges, subgraphMenu, subgraphs);
 
           currentState = SUBGRAPH_VIEW;
         } else if (clicked >= 0 && clicked < (int)companies.size()) {
@@ -7324,16 +11875,18 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
                 subgraphMenu.buttons[i]->normalColor);
           }
         } else if (clicked == -4) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
 
-          displaySubgraph(g, locations, edges, subgraphMenu);
+          displaySubgraph(g, locations, edges, subgraphMenu, subgraphs);
 
           currentState = SUBGRAPH_VIEW;
         }
       } else if (currentState == SUBGRAPH_VIEW) {
         bool clickedOnSomething = false;
 
-        for (auto& location : locations) {
+        for (int i : mapHits.locationsAt(window)) {
+          Location& location = locations[i];
           if (location.isClicked(window, event)) {
             Color portColor = location.pin.getFillColor();
 
@@ -7364,7 +11917,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         }
 
         if (!clickedOnSomething) {
-          for (int i = 0; i < edges.size(); i++) {
+          for (int i : mapHits.edgesAt(window)) {
             if (edges[i].isClicked(window, event)) {
               Color routeColor = edges[i].line.getFillColor();
 
@@ -7408,6 +11961,16 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         }
       }
 
+      if ((currentState == SEARCH_ROUTES || currentState == BOOK_CARGO) &&
+          event.type == Event::KeyPressed &&
+          (event.key.code == Keyboard::Up ||
+           event.key.code == Keyboard::Down)) {
+        int delta = event.key.code == Keyboard::Up ? 1 : -1;
+        searchOptions.maxLayovers =
+            max(0, min(8, searchOptions.maxLayovers + delta));
+        cout << "Maximum layovers: " << searchOptions.maxLayovers << endl;
+      }
+
       if ((currentState == MAP_VIEW || currentState == SEARCH_ROUTES ||
            currentState == BOOK_CARGO || currentState == FILTER_PREFERENCES ||
            currentState == FILTER_COMPANIES || currentState == FILTER_PORTS ||
@@ -7427,7 +11990,8 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
           event.type == Event::KeyPressed &&
           event.key.code == Keyboard::Escape) {
         if (currentState == SUBGRAPH_VIEW) {
-          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g);
+          loadMapView(mapTexture, mapSprite, locations, edges, window, font, g,
+                      mapHits, mapLayout);
         }
 
         if (currentState == TRACK_MULTI_LEG ||
@@ -7451,6 +12015,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         userPreferences.hasCompanyFilter = false;
         userPreferences.hasPortFilter = false;
         userPreferences.hasTimeFilter = false;
+        userPreferences.hasWeatherFilter = false;
         userPreferences.preferredCompanies.clear();
         userPreferences.avoidPorts.clear();
         routeDisplayWindow.hide();
@@ -7465,6 +12030,27 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         subgraphMenu.hide();
       }
     }
+    int changedEdges = syncMapWithGraph(g, mapSyncedChange, locations, edges,
+                                        mapEdgeIndex, window, font);
+    if (changedEdges > 0) {
+      cout << "Map updated incrementally: " << changedEdges << " edges"
+           << endl;
+      mapLayer.invalidate();
+    }
+    if (layoutChange != g.getChangeCount()) {
+      layoutChange = g.getChangeCount();
+      forceLayout.start(g, mapLayout);
+    }
+    bool relaidOut = forceLayout.poll(mapLayout);
+    if (relaidOut) {
+      mapLayout.placeGenerated(g, locations, edges, window.getSize());
+      mapLayer.invalidate();
+      frameScheduler.requestRedraw();
+    }
+    if (changedEdges > 0 || relaidOut ||
+        !mapHits.isCurrent(locations, edges)) {
+      mapHits.build(locations, edges);
+    }
     if (currentState == MAIN_MENU) {
       startButton.update(window);
       settingsButton.update(window);
@@ -7472,34 +12058,31 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     } else if (currentState == NAVIGATION_MENU) {
       navMenu.update(window);
     } else if (currentState == MAP_VIEW) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
-      for (auto& location : locations) {
-        location.update(window);
+      mapHits.updateEdgeHover(edges, window);
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
+      int hoveredEdge = mapHits.hoveredEdge();
+      if (hoveredEdge != -1 && hoveredLocation == -1 &&
+          !infoWindow.visible()) {
+        routeTooltip.show(Vector2f(Mouse::getPosition(window)),
+                          describeRoutePair(edges[hoveredEdge],
+                                            mapHits.pairOf(hoveredEdge)));
+      } else {
+        routeTooltip.hide();
       }
       infoWindow.update(window);
       companyWindow.update(window);
       portWindow.update(window);
       timeWindow.update(window);
     } else if (currentState == FILTER_RESULT_MAP) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
-      for (auto& location : locations) {
-        location.update(window);
-      }
+      mapHits.updateEdgeHover(edges, window);
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
       infoWindow.update(window);
     } else if (currentState == SEARCH_ROUTES) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
+      mapHits.updateEdgeHover(edges, window);
       for (auto& edge : highlightedRoutes) {
         edge.update(window);
       }
-      for (auto& location : locations) {
-        location.update(window);
-      }
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
       infoWindow.update(window);
       companyWindow.update(window);
       portWindow.update(window);
@@ -7510,29 +12093,21 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
         layoverControls->update(window, false);
       }
     } else if (currentState == SHORTEST_ROUTE_SELECT) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
+      mapHits.updateEdgeHover(edges, window);
       for (auto& edge : shortestPathEdges) {
         edge.update(window);
       }
-      for (auto& location : locations) {
-        location.update(window);
-      }
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
       infoWindow.update(window);
       companyWindow.update(window);
       portWindow.update(window);
       timeWindow.update(window);
     } else if (currentState == CHEAPEST_ROUTE_SELECT) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
+      mapHits.updateEdgeHover(edges, window);
       for (auto& edge : cheapestPathEdges) {
         edge.update(window);
       }
-      for (auto& location : locations) {
-        location.update(window);
-      }
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
       infoWindow.update(window);
       companyWindow.update(window);
       portWindow.update(window);
@@ -7546,6 +12121,20 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       filterMenu.update(window);
     }
 
+    if (filterView.refresh(g, userPreferences, locations, edges)) {
+      mapLayer.invalidate();
+    }
+
+    MapLayer::Key layerKey;
+    layerKey.state = currentState;
+    layerKey.size = window.getSize();
+    layerKey.hoveredLocation = hoveredLocation;
+    layerKey.preferences = preferencesKey(userPreferences);
+    layerKey.edgeCount = edges.size();
+    layerKey.locationCount = locations.size();
+    layerKey.camera = camera.revision();
+
+    window.setView(camera.screenView());
     window.clear();
 
     if (oceanLoaded) {
@@ -7562,35 +12151,19 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     } else if (currentState == NAVIGATION_MENU) {
       navMenu.draw(window);
     } else if (currentState == MAP_VIEW) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        if (userPreferences.hasCompanyFilter || userPreferences.hasPortFilter ||
-            userPreferences.hasTimeFilter) {
-          if (g.routeMatchesPreferences(edge.routeInfo, userPreferences) &&
-              !g.portIsAvoid(edge.sourceName, userPreferences) &&
-              !g.portIsAvoid(edge.routeInfo.destination, userPreferences)) {
-            edge.line.setFillColor(Color(0, 255, 0, 150));
-          } else {
-            edge.line.setFillColor(Color(150, 150, 150, 50));
-          }
-        }
-        edge.draw(window);
-      }
-
-      for (auto& location : locations) {
-        if (userPreferences.hasPortFilter || userPreferences.hasCompanyFilter ||
-            userPreferences.hasTimeFilter) {
-          if (g.portIsAvoid(location.name, userPreferences)) {
-            location.pin.setFillColor(Color(150, 150, 150));
-            location.label.setFillColor(Color(150, 150, 150));
-          } else {
-            location.pin.setFillColor(Color(0, 255, 0));
-            location.label.setFillColor(Color::White);
-          }
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        if (filterView.active) {
+          filterView.paintEdges(edgeBatch, Color(0, 255, 0, 150),
+                                Color(150, 150, 150, 50));
+          filterView.paintPins(locations, Color(0, 255, 0));
         }
-        location.draw(window);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
+      routeTooltip.draw(window);
 
       infoWindow.draw(window);
       instructionText.setCharacterSize(20);
@@ -7611,13 +12184,13 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       timeWindow.draw(window);
 
     } else if (currentState == BOOK_CARGO_SELECT_PORTS) {
-      window.draw(mapSprite);
-      for (auto& edge : edges) {
-        edge.draw(window);
-      }
-      for (auto& location : locations) {
-        location.draw(window);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
       Text instructionText;
       instructionText.setFont(font);
       instructionText.setCharacterSize(24);
@@ -7632,24 +12205,26 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     }
 
     else if (currentState == BOOK_CARGO_SELECT_DATE) {
-      window.draw(mapSprite);
-      for (auto& edge : edges) {
-        edge.draw(window);
-      }
-      for (int i = 0; i < locations.size(); i++) {
-        bool isSelected = false;
-        for (int idx : bookingSelectedPorts) {
-          if (idx == i) {
-            locations[i].pin.setOutlineColor(Color::Magenta);
-            isSelected = true;
-            break;
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        for (int i = 0; i < locations.size(); i++) {
+          bool isSelected = false;
+          for (int idx : bookingSelectedPorts) {
+            if (idx == i) {
+              locations[i].pin.setOutlineColor(Color::Magenta);
+              isSelected = true;
+              break;
+            }
+          }
+          if (!isSelected) {
+            locations[i].pin.setOutlineColor(Color::White);
           }
         }
-        if (!isSelected) {
-          locations[i].pin.setOutlineColor(Color::White);
-        }
-        locations[i].draw(window);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
       dateSelectionWindow.draw(window);
 
@@ -7657,21 +12232,20 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     }
 
     else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        RectangleShape fadedEdge = edge.line;
-        fadedEdge.setFillColor(Color(150, 150, 150, 50));
-        window.draw(fadedEdge);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        edgeBatch.fill(Color(150, 150, 150, 50));
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
+      window.setView(camera.worldView());
       for (auto& edge : bookingHighlightedRoutes) {
         edge.draw(window);
       }
-
-      for (auto& location : locations) {
-        location.draw(window);
-      }
+      window.setView(camera.screenView());
 
       Text instructionText;
       instructionText.setFont(font);
@@ -7697,28 +12271,27 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     }
 
     else if (currentState == BOOK_CARGO_CONFIRM) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        RectangleShape fadedEdge = edge.line;
-        fadedEdge.setFillColor(Color(150, 150, 150, 30));
-        window.draw(fadedEdge);
-      }
-
-      for (auto& location : locations) {
-        location.draw(window);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        edgeBatch.fill(Color(150, 150, 150, 30));
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
       bookingConfirmationWindow.draw(window);
     } else if (currentState == TRACK_MULTI_LEG) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        RectangleShape fadedLine = edge.line;
-        fadedLine.setFillColor(Color(150, 150, 150, 30));
-        window.draw(fadedLine);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        edgeBatch.fill(Color(150, 150, 150, 30));
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
+      window.setView(camera.worldView());
       for (auto& edge : journeyPathEdges) {
         edge.line.setFillColor(Color(255, 105, 180, 255));
         window.draw(edge.line);
@@ -7730,10 +12303,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
           window.draw(edge.line);
         }
       }
-
-      for (auto& location : locations) {
-        location.draw(window);
-      }
+      window.setView(camera.screenView());
 
       Text instructionText;
       instructionText.setFont(font);
@@ -7750,6 +12320,7 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
 
       infoWindow.draw(window);
     } else if (currentState == TRACK_MULTI_LEG_ADD_PORT) {
+      window.setView(camera.worldView());
       window.draw(mapSprite);
       for (auto& edge : journeyPathEdges) {
         window.draw(edge.line);
@@ -7757,53 +12328,32 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       for (auto& location : locations) {
         location.draw(window);
       }
+      window.setView(camera.screenView());
 
       portAddWindow.draw(window);
     } else if (currentState == SEARCH_ROUTES) {
-      window.draw(mapSprite);
-
-      bool filtersActive = userPreferences.hasCompanyFilter ||
-                           userPreferences.hasPortFilter ||
-                           userPreferences.hasTimeFilter;
-
-      for (auto& edge : edges) {
-        RectangleShape tempLine = edge.line;
-
-        if (filtersActive) {
-          bool allowed =
-              g.routeMatchesPreferences(edge.routeInfo, userPreferences) &&
-              !g.portIsAvoid(edge.sourceName, userPreferences) &&
-              !g.portIsAvoid(edge.routeInfo.destination, userPreferences);
-
-          if (allowed)
-            tempLine.setFillColor(Color(0, 255, 0, 160));
-          else
-            tempLine.setFillColor(Color(150, 150, 150, 40));
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        if (filterView.active) {
+          filterView.paintEdges(edgeBatch, Color(0, 255, 0, 160),
+                                Color(150, 150, 150, 40));
+          filterView.paintPins(locations, Color(0, 255, 0));
         } else {
-          tempLine.setFillColor(Color(150, 150, 150, 50));
+          edgeBatch.fill(Color(150, 150, 150, 50));
         }
-
-        window.draw(tempLine);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
+      window.setView(camera.worldView());
       for (auto& hr : highlightedRoutes) {
         RectangleShape glow = hr.line;
         glow.setFillColor(Color(255, 215, 0, 230));
         window.draw(glow);
       }
-      for (auto& location : locations) {
-        if (filtersActive) {
-          if (g.portIsAvoid(location.name, userPreferences)) {
-            location.pin.setFillColor(Color(150, 150, 150));
-            location.label.setFillColor(Color(150, 150, 150));
-          } else {
-            location.pin.setFillColor(Color(0, 255, 0));
-            location.label.setFillColor(Color::White);
-          }
-        }
-
-        location.draw(window);
-      }
+      window.setView(camera.screenView());
 
       infoWindow.draw(window);
       routeDisplayWindow.draw(window);
@@ -7824,19 +12374,18 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       timeWindow.draw(window);
 
     } else if (currentState == PROCESS_LAYOVERS) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        RectangleShape fadedLine = edge.line;
-        fadedLine.setFillColor(Color(150, 150, 150, 30));
-        window.draw(fadedLine);
-      }
-
-      for (auto& location : locations) {
-        location.draw(window);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        edgeBatch.fill(Color(150, 150, 150, 30));
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
+      window.setView(camera.worldView());
       layoverSim.draw(window, locations, g);
+      window.setView(camera.screenView());
 
       if (layoverControls) {
         layoverControls->updateStats(layoverSim.getStatistics());
@@ -7845,52 +12394,28 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       }
     } else if (currentState == SHORTEST_ROUTE_SELECT ||
                currentState == CHEAPEST_ROUTE_SELECT) {
-      window.draw(mapSprite);
-
-      bool filtersActive = userPreferences.hasCompanyFilter ||
-                           userPreferences.hasPortFilter ||
-                           userPreferences.hasTimeFilter;
-
-      for (auto& edge : edges) {
-        if (filtersActive) {
-          bool allowed =
-              g.routeMatchesPreferences(edge.routeInfo, userPreferences) &&
-              !g.portIsAvoid(edge.sourceName, userPreferences) &&
-              !g.portIsAvoid(edge.routeInfo.destination, userPreferences);
-
-          if (allowed) {
-            if (currentState == SHORTEST_ROUTE_SELECT)
-              edge.line.setFillColor(Color(255, 255, 0, 160));
-            else
-              edge.line.setFillColor(Color(0, 255, 255, 160));
-          } else {
-            edge.line.setFillColor(Color(150, 150, 150, 40));
-          }
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        if (filterView.active) {
+          bool shortest = currentState == SHORTEST_ROUTE_SELECT;
+          filterView.paintEdges(edgeBatch,
+                                shortest ? Color(255, 255, 0, 160)
+                                         : Color(0, 255, 255, 160),
+                                Color(150, 150, 150, 40));
+          filterView.paintPins(locations, shortest ? Color(255, 255, 0)
+                                                   : Color(0, 255, 255));
         }
-
-        edge.draw(window);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
+      window.setView(camera.worldView());
       for (auto& edge : shortestPathEdges) {
         edge.draw(window);
       }
-
-      for (auto& location : locations) {
-        if (filtersActive) {
-          if (g.portIsAvoid(location.name, userPreferences)) {
-            location.pin.setFillColor(Color(150, 150, 150));
-            location.label.setFillColor(Color(150, 150, 150));
-          } else {
-            if (currentState == SHORTEST_ROUTE_SELECT)
-              location.pin.setFillColor(Color(255, 255, 0));
-            else
-              location.pin.setFillColor(Color(0, 255, 255));
-            location.label.setFillColor(Color::White);
-          }
-        }
-
-        location.draw(window);
-      }
+      window.setView(camera.screenView());
 
       routeDisplayWindow.draw(window);
 
@@ -7971,18 +12496,14 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
     if (currentState == BOOK_CARGO_CONFIRM) {
       bookingConfirmationWindow.update(window);
     } else if (currentState == TRACK_MULTI_LEG) {
-      for (auto& edge : edges) {
-        edge.update(window);
-      }
+      mapHits.updateEdgeHover(edges, window);
       for (auto& edge : availableRouteEdges) {
         edge.update(window);
       }
       for (auto& edge : journeyPathEdges) {
         edge.update(window);
       }
-      for (auto& location : locations) {
-        location.update(window);
-      }
+      hoveredLocation = mapHits.updateLocationHover(locations, window);
       journeyControls.updateStats(currentJourney, g);
       journeyControls.update(window);
       infoWindow.update(window);
@@ -7994,27 +12515,23 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
                currentState == SUBGRAPH_WEATHER_SELECT) {
       subgraphMenu.draw(window);
     } else if (currentState == SUBGRAPH_VIEW) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        edge.draw(window);
-      }
-
-      for (auto& location : locations) {
-        location.draw(window);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
       infoWindow.draw(window);
     } else if (currentState == FILTER_RESULT_MAP) {
-      window.draw(mapSprite);
-
-      for (auto& edge : edges) {
-        edge.draw(window);
-      }
-
-      for (auto& location : locations) {
-        location.draw(window);
+      if (RenderTarget* layer = mapLayer.begin(layerKey, window)) {
+        edgeBatch.sync(edges);
+        mapRenderer.draw(*layer, mapSprite, edgeBatch, locations, camera,
+                         mapHits);
+        mapLayer.end();
       }
+      mapLayer.draw(window);
 
       infoWindow.draw(window);
 
@@ -8030,7 +12547,28 @@ else if (currentState == BOOK_CARGO_VIEW_ROUTES) {
       window.draw(instructionText);
     }
 
+    if (showsMap(currentState) && mapRenderer.bundling()) {
+      bundlingHint.setPosition(20, windowHeight - 55);
+      window.draw(bundlingHint);
+    }
+
+    if (showFrameStats) {
+      frameStatsText.setString(frameScheduler.statsLine());
+      frameStatsText.setPosition(20, windowHeight - 30);
+      window.draw(frameStatsText);
+    }
+
     window.display();
+    window.setView(camera.worldView());
+
+    frameScheduler.setAnimating((currentState == PROCESS_LAYOVERS &&
+                                 layoverSim.isAnimating()) ||
+                                forceLayout.isRunning());
+    if (currentState != renderedState) {
+      renderedState = currentState;
+      frameScheduler.requestRedraw();
+    }
+    frameScheduler.endFrame();
   }
   delete applyFiltersButton;
   delete removeFiltersButton;